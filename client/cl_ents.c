@@ -237,83 +237,291 @@ int CL_ParseEntityBits (unsigned *bits)
 	return number;
 }
 
+/*
+=================
+CL_ParseEntityNumberBits
+
+The PROTOCOL_VERSION_BITS record header.  There are no flag words, so
+the bits returned are U_REMOVE or U_BITPACKED.
+=================
+*/
+#define	U_BITPACKED	(1<<28)		// CL_ParseDelta reads a MSG_WriteDeltaEntityBits record
+
+int CL_ParseEntityNumberBits (unsigned *bits)
+{
+	int			number;
+
+	number = MSG_ReadBits (&net_message, ENTITYNUM_BITS);
+	if (number > 0 && MSG_ReadBits (&net_message, 1))
+		*bits = U_REMOVE;
+	else
+		*bits = U_BITPACKED;
+
+	return number;
+}
+
+/*
+==================
+CL_ParseDeltaBits
+
+Field order must match MSG_WriteDeltaEntityBits
+==================
+*/
+void CL_ParseDeltaBits (entity_state_t *from, entity_state_t *to)
+{
+	int		coord[3];
+	int		i;
+
+	for (i=0 ; i<3 ; i++)
+	{
+		coord[i] = MSG_ReadDeltaBits (&net_message, COORD2SHORT(from->origin[i]));
+		to->origin[i] = coord[i] * (1.0/8);
+	}
+
+	for (i=0 ; i<3 ; i++)
+		if (MSG_ReadBits (&net_message, 1))
+			to->angles[i] = (signed char)MSG_ReadBits (&net_message, 8) * (360.0/256);
+
+	if (MSG_ReadBits (&net_message, 1))
+	{
+		if (MSG_ReadBits (&net_message, 1))
+			to->frame = from->frame + 1;
+		else
+			to->frame = MSG_ReadVarBits (&net_message);
+	}
+
+	if (MSG_ReadBits (&net_message, 1))
+		to->event = MSG_ReadBits (&net_message, 8);
+	else
+		to->event = 0;
+
+	if (MSG_ReadBits (&net_message, 1))
+		for (i=0 ; i<3 ; i++)
+			to->old_origin[i] = MSG_ReadDeltaBits (&net_message, coord[i]) * (1.0/8);
+
+	if (!MSG_ReadBits (&net_message, 1))
+		return;
+
+	if (MSG_ReadBits (&net_message, 1))
+		to->modelindex = MSG_ReadBits (&net_message, 8);
+	if (MSG_ReadBits (&net_message, 1))
+		to->modelindex2 = MSG_ReadBits (&net_message, 8);
+	if (MSG_ReadBits (&net_message, 1))
+		to->modelindex3 = MSG_ReadBits (&net_message, 8);
+	if (MSG_ReadBits (&net_message, 1))
+		to->modelindex4 = MSG_ReadBits (&net_message, 8);
+
+	if (MSG_ReadBits (&net_message, 1))
+		to->skinnum = MSG_ReadVarBits (&net_message);
+	if (MSG_ReadBits (&net_message, 1))
+		to->effects = MSG_ReadVarBits (&net_message);
+	if (MSG_ReadBits (&net_message, 1))
+		to->renderfx = MSG_ReadVarBits (&net_message);
+
+	if (MSG_ReadBits (&net_message, 1))
+		to->solid = (short)MSG_ReadBits (&net_message, 16);
+	if (MSG_ReadBits (&net_message, 1))
+		to->sound = MSG_ReadBits (&net_message, 8);
+}
+
+/*
+==================
+CL_DeltaSize
+
+Bytes of fields that follow an entity header with these bits
+==================
+*/
+static int CL_DeltaSize (int bits)
+{
+	int		size;
+
+	size = 0;
+	if (bits & U_MODEL)
+		size++;
+	if (bits & U_MODEL2)
+		size++;
+	if (bits & U_MODEL3)
+		size++;
+	if (bits & U_MODEL4)
+		size++;
+
+	if (bits & U_FRAME8)
+		size++;
+	if (bits & U_FRAME16)
+		size += 2;
+
+	if ((bits & U_SKIN8) && (bits & U_SKIN16))
+		size += 4;
+	else if (bits & (U_SKIN8|U_SKIN16))
+		size += (bits & U_SKIN8) ? 1 : 2;
+
+	if ( (bits & (U_EFFECTS8|U_EFFECTS16)) == (U_EFFECTS8|U_EFFECTS16) )
+		size += 4;
+	else if (bits & (U_EFFECTS8|U_EFFECTS16))
+		size += (bits & U_EFFECTS8) ? 1 : 2;
+
+	if ( (bits & (U_RENDERFX8|U_RENDERFX16)) == (U_RENDERFX8|U_RENDERFX16) )
+		size += 4;
+	else if (bits & (U_RENDERFX8|U_RENDERFX16))
+		size += (bits & U_RENDERFX8) ? 1 : 2;
+
+	if (bits & U_ORIGIN1)
+		size += 2;
+	if (bits & U_ORIGIN2)
+		size += 2;
+	if (bits & U_ORIGIN3)
+		size += 2;
+
+	if (bits & U_ANGLE1)
+		size++;
+	if (bits & U_ANGLE2)
+		size++;
+	if (bits & U_ANGLE3)
+		size++;
+
+	if (bits & U_OLDORIGIN)
+		size += 6;
+	if (bits & U_SOUND)
+		size++;
+	if (bits & U_EVENT)
+		size++;
+	if (bits & U_SOLID)
+		size += 2;
+
+	return size;
+}
+
+#define	DELTA_SHORT(p)	((short)((p)[0] + ((p)[1]<<8)))
+#define	DELTA_LONG(p)	((p)[0] + ((p)[1]<<8) + ((p)[2]<<16) + ((p)[3]<<24))
+
 /*
 ==================
 CL_ParseDelta
 
 Can go from either a baseline or a previous packet_entity
+
+The fields are bounds checked together and read straight out of
+net_message.  If they run past the end, to is left the same as from and
+the message is overrun for CL_ParsePacketEntities to catch.
 ==================
 */
 void CL_ParseDelta (entity_state_t *from, entity_state_t *to, int number, int bits)
 {
+	byte	*p;
+
 	// set everything to the state we are delta'ing from
 	*to = *from;
 
 	VectorCopy (from->origin, to->old_origin);
 	to->number = number;
 
+	if (bits & U_BITPACKED)
+	{
+		CL_ParseDeltaBits (from, to);
+		return;
+	}
+
+	p = MSG_ReadBlock (&net_message, CL_DeltaSize (bits));
+	if (!p)
+		return;
+
 	if (bits & U_MODEL)
-		to->modelindex = MSG_ReadByte (&net_message);
+		to->modelindex = *p++;
 	if (bits & U_MODEL2)
-		to->modelindex2 = MSG_ReadByte (&net_message);
+		to->modelindex2 = *p++;
 	if (bits & U_MODEL3)
-		to->modelindex3 = MSG_ReadByte (&net_message);
+		to->modelindex3 = *p++;
 	if (bits & U_MODEL4)
-		to->modelindex4 = MSG_ReadByte (&net_message);
+		to->modelindex4 = *p++;
 		
 	if (bits & U_FRAME8)
-		to->frame = MSG_ReadByte (&net_message);
+		to->frame = *p++;
 	if (bits & U_FRAME16)
-		to->frame = MSG_ReadShort (&net_message);
+	{
+		to->frame = DELTA_SHORT(p);
+		p += 2;
+	}
 
 	if ((bits & U_SKIN8) && (bits & U_SKIN16))		//used for laser colors
-		to->skinnum = MSG_ReadLong(&net_message);
+	{
+		to->skinnum = DELTA_LONG(p);
+		p += 4;
+	}
 	else if (bits & U_SKIN8)
-		to->skinnum = MSG_ReadByte(&net_message);
+		to->skinnum = *p++;
 	else if (bits & U_SKIN16)
-		to->skinnum = MSG_ReadShort(&net_message);
+	{
+		to->skinnum = DELTA_SHORT(p);
+		p += 2;
+	}
 
 	if ( (bits & (U_EFFECTS8|U_EFFECTS16)) == (U_EFFECTS8|U_EFFECTS16) )
-		to->effects = MSG_ReadLong(&net_message);
+	{
+		to->effects = DELTA_LONG(p);
+		p += 4;
+	}
 	else if (bits & U_EFFECTS8)
-		to->effects = MSG_ReadByte(&net_message);
+		to->effects = *p++;
 	else if (bits & U_EFFECTS16)
-		to->effects = MSG_ReadShort(&net_message);
+	{
+		to->effects = DELTA_SHORT(p);
+		p += 2;
+	}
 
 	if ( (bits & (U_RENDERFX8|U_RENDERFX16)) == (U_RENDERFX8|U_RENDERFX16) )
-		to->renderfx = MSG_ReadLong(&net_message);
+	{
+		to->renderfx = DELTA_LONG(p);
+		p += 4;
+	}
 	else if (bits & U_RENDERFX8)
-		to->renderfx = MSG_ReadByte(&net_message);
+		to->renderfx = *p++;
 	else if (bits & U_RENDERFX16)
-		to->renderfx = MSG_ReadShort(&net_message);
+	{
+		to->renderfx = DELTA_SHORT(p);
+		p += 2;
+	}
 
 	if (bits & U_ORIGIN1)
-		to->origin[0] = MSG_ReadCoord (&net_message);
+	{
+		to->origin[0] = DELTA_SHORT(p) * (1.0/8);
+		p += 2;
+	}
 	if (bits & U_ORIGIN2)
-		to->origin[1] = MSG_ReadCoord (&net_message);
+	{
+		to->origin[1] = DELTA_SHORT(p) * (1.0/8);
+		p += 2;
+	}
 	if (bits & U_ORIGIN3)
-		to->origin[2] = MSG_ReadCoord (&net_message);
+	{
+		to->origin[2] = DELTA_SHORT(p) * (1.0/8);
+		p += 2;
+	}
 		
 	if (bits & U_ANGLE1)
-		to->angles[0] = MSG_ReadAngle(&net_message);
+		to->angles[0] = (signed char)*p++ * (360.0/256);
 	if (bits & U_ANGLE2)
-		to->angles[1] = MSG_ReadAngle(&net_message);
+		to->angles[1] = (signed char)*p++ * (360.0/256);
 	if (bits & U_ANGLE3)
-		to->angles[2] = MSG_ReadAngle(&net_message);
+		to->angles[2] = (signed char)*p++ * (360.0/256);
 
 	if (bits & U_OLDORIGIN)
-		MSG_ReadPos (&net_message, to->old_origin);
+	{
+		to->old_origin[0] = DELTA_SHORT(p) * (1.0/8);
+		to->old_origin[1] = DELTA_SHORT(p+2) * (1.0/8);
+		to->old_origin[2] = DELTA_SHORT(p+4) * (1.0/8);
+		p += 6;
+	}
 
 	if (bits & U_SOUND)
-		to->sound = MSG_ReadByte (&net_message);
+		to->sound = *p++;
 
 	if (bits & U_EVENT)
-		to->event = MSG_ReadByte (&net_message);
+		to->event = *p++;
 	else
 		to->event = 0;
 
 	if (bits & U_SOLID)
-		to->solid = MSG_ReadShort (&net_message);
+		to->solid = DELTA_SHORT(p);
 }
 
 /*
@@ -388,7 +596,7 @@ rest of the data stream.
 void CL_ParsePacketEntities (frame_t *oldframe, frame_t *newframe)
 {
 	int			newnum;
-	int			bits;
+	unsigned	bits;
 	entity_state_t	*oldstate;
 	int			oldindex, oldnum;
 
@@ -412,7 +620,10 @@ void CL_ParsePacketEntities (frame_t *oldframe, frame_t *newframe)
 
 	while (1)
 	{
-		newnum = CL_ParseEntityBits (&bits);
+		if (cls.serverProtocol == PROTOCOL_VERSION_BITS)
+			newnum = CL_ParseEntityNumberBits (&bits);
+		else
+			newnum = CL_ParseEntityBits (&bits);
 		if (newnum >= MAX_EDICTS)
 			Com_Error (ERR_DROP,"CL_ParsePacketEntities: bad number:%i", newnum);
 
@@ -507,6 +718,93 @@ void CL_ParsePacketEntities (frame_t *oldframe, frame_t *newframe)
 
 
 
+/*
+===================
+CL_ParsePlayerstateBits
+
+Field order must match SV_WritePlayerstateBits
+===================
+*/
+void CL_ParsePlayerstateBits (player_state_t *state)
+{
+	int			flags;
+	int			i;
+
+	flags = MSG_ReadBits (&net_message, PS_BITS);
+
+	//
+	// parse the pmove_state_t
+	//
+	if (flags & PS_M_TYPE)
+		state->pmove.pm_type = MSG_ReadBits (&net_message, 8);
+
+	if (flags & PS_M_ORIGIN)
+		for (i=0 ; i<3 ; i++)
+			state->pmove.origin[i] = MSG_ReadDeltaBits (&net_message, state->pmove.origin[i]);
+
+	if (flags & PS_M_VELOCITY)
+		for (i=0 ; i<3 ; i++)
+			state->pmove.velocity[i] = MSG_ReadDeltaBits (&net_message, state->pmove.velocity[i]);
+
+	if (flags & PS_M_TIME)
+		state->pmove.pm_time = MSG_ReadBits (&net_message, 8);
+
+	if (flags & PS_M_FLAGS)
+		state->pmove.pm_flags = MSG_ReadBits (&net_message, 8);
+
+	if (flags & PS_M_GRAVITY)
+		state->pmove.gravity = (short)MSG_ReadBits (&net_message, 16);
+
+	if (flags & PS_M_DELTA_ANGLES)
+		for (i=0 ; i<3 ; i++)
+			state->pmove.delta_angles[i] = MSG_ReadDeltaBits (&net_message, state->pmove.delta_angles[i]);
+
+	if (cl.attractloop)
+		state->pmove.pm_type = PM_FREEZE;		// demo playback
+
+	//
+	// parse the rest of the player_state_t
+	//
+	if (flags & PS_VIEWOFFSET)
+		for (i=0 ; i<3 ; i++)
+			state->viewoffset[i] = (signed char)MSG_ReadBits (&net_message, 8) * 0.25;
+
+	if (flags & PS_VIEWANGLES)
+		for (i=0 ; i<3 ; i++)
+			if (MSG_ReadBits (&net_message, 1))
+				state->viewangles[i] = SHORT2ANGLE((short)MSG_ReadBits (&net_message, 16));
+
+	if (flags & PS_KICKANGLES)
+		for (i=0 ; i<3 ; i++)
+			state->kick_angles[i] = (signed char)MSG_ReadBits (&net_message, 8) * 0.25;
+
+	if (flags & PS_WEAPONINDEX)
+		state->gunindex = MSG_ReadBits (&net_message, 8);
+
+	if (flags & PS_WEAPONFRAME)
+	{
+		state->gunframe = MSG_ReadBits (&net_message, 8);
+		for (i=0 ; i<3 ; i++)
+			state->gunoffset[i] = (signed char)MSG_ReadBits (&net_message, 8) * 0.25;
+		for (i=0 ; i<3 ; i++)
+			state->gunangles[i] = (signed char)MSG_ReadBits (&net_message, 8) * 0.25;
+	}
+
+	if (flags & PS_BLEND)
+		for (i=0 ; i<4 ; i++)
+			state->blend[i] = MSG_ReadBits (&net_message, 8) / 255.0;
+
+	if (flags & PS_FOV)
+		state->fov = MSG_ReadBits (&net_message, 8);
+
+	if (flags & PS_RDFLAGS)
+		state->rdflags = MSG_ReadBits (&net_message, 8);
+
+	// parse stats
+	for (i=0 ; i<MAX_STATS ; i++)
+		state->stats[i] = MSG_ReadDeltaBits (&net_message, state->stats[i]);
+}
+
 /*
 ===================
 CL_ParsePlayerstate
@@ -527,6 +825,12 @@ void CL_ParsePlayerstate (frame_t *oldframe, frame_t *newframe)
 	else
 		memset (state, 0, sizeof(*state));
 
+	if (cls.serverProtocol == PROTOCOL_VERSION_BITS)
+	{
+		CL_ParsePlayerstateBits (state);
+		return;
+	}
+
 	flags = MSG_ReadShort (&net_message);
 
 	//
@@ -210,7 +210,7 @@ void CL_Record_f (void)
 
 	// send the serverdata
 	MSG_WriteByte (&buf, svc_serverdata);
-	MSG_WriteLong (&buf, PROTOCOL_VERSION);
+	MSG_WriteLong (&buf, cls.serverProtocol);	// frames are saved as they came in
 	MSG_WriteLong (&buf, 0x10000 + cl.servercount);
 	MSG_WriteByte (&buf, 1);	// demos are always attract loops
 	MSG_WriteString (&buf, cl.gamedir);
@@ -434,8 +434,8 @@ void CL_SendConnectPacket (void)
 	port = Cvar_VariableValue ("qport");
 	userinfo_modified = qFalse;
 
-	Netchan_OutOfBandPrint (NS_CLIENT, adr, "connect %i %i %i \"%s\"\n",
-		PROTOCOL_VERSION, port, cls.challenge, Cvar_Userinfo() );
+	Netchan_OutOfBandPrint (NS_CLIENT, adr, "connect %i %i %i \"%s\" %i\n",
+		PROTOCOL_VERSION, port, cls.challenge, Cvar_Userinfo(), PROTOCOL_VERSION_BITS );
 }
 
 /*
@@ -784,7 +784,7 @@ void CL_ParseStatusMessage (void)
 {
 	char	*s;
 
-	s = MSG_ReadString(&net_message);
+	s = MSG_ReadStringView (&net_message);
 
 	Com_Printf ("%s\n", s);
 	M_AddToServerList (net_from, s);
@@ -924,7 +924,7 @@ void CL_ConnectionlessPacket (void)
 			return;
 		}
 		Sys_AppActivate ();
-		s = MSG_ReadString (&net_message);
+		s = MSG_ReadStringView (&net_message);
 		Cbuf_AddText (s);
 		Cbuf_AddText ("\n");
 		return;
@@ -932,7 +932,7 @@ void CL_ConnectionlessPacket (void)
 	// print command from somewhere
 	if (!strcmp(c, "print"))
 	{
-		s = MSG_ReadString (&net_message);
+		s = MSG_ReadStringView (&net_message);
 		Com_Printf ("%s", s);
 		return;
 	}
@@ -1378,6 +1378,9 @@ before allowing the client into the server
 */
 void CL_Precache_f (void)
 {
+	// record or read ahead the files this map loads
+	FS_BeginMapLoad (cl.configstrings[CS_MODELS+1]);
+
 	//Yet another hack to let old demos work
 	//the old precache sequence
 	if (Cmd_Argc() < 2) {
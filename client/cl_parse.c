@@ -201,6 +201,7 @@ void CL_ParseDownload (void)
 {
 	int		size, percent;
 	char	name[MAX_OSPATH];
+	byte	*data;
 	int		r;
 
 	// read the data
@@ -219,6 +220,10 @@ void CL_ParseDownload (void)
 		return;
 	}
 
+	data = MSG_ReadBlock (&net_message, size);
+	if (!data)
+		Com_Error (ERR_DROP, "CL_ParseDownload: bad block size %i", size);
+
 	// open the file if not opened yet
 	if (!cls.download)
 	{
@@ -229,15 +234,13 @@ void CL_ParseDownload (void)
 		cls.download = fopen (name, "wb");
 		if (!cls.download)
 		{
-			net_message.readcount += size;
 			Com_Printf ("Failed to open %s\n", cls.downloadtempname);
 			CL_RequestNextDownload ();
 			return;
 		}
 	}
 
-	fwrite (net_message.data + net_message.readcount, 1, size, cls.download);
-	net_message.readcount += size;
+	fwrite (data, 1, size, cls.download);
 
 	if (percent != 100)
 	{
@@ -316,14 +319,14 @@ void CL_ParseServerData (void)
 	if (Com_ServerState() && PROTOCOL_VERSION == 34)
 	{
 	}
-	else if (i != PROTOCOL_VERSION)
+	else if (i != PROTOCOL_VERSION && i != PROTOCOL_VERSION_BITS)
 		Com_Error (ERR_DROP,"Server returned version %i, not %i", i, PROTOCOL_VERSION);
 
 	cl.servercount = MSG_ReadLong (&net_message);
 	cl.attractloop = MSG_ReadByte (&net_message);
 
 	// game directory
-	str = MSG_ReadString (&net_message);
+	str = MSG_ReadStringView (&net_message);
 	strncpy (cl.gamedir, str, sizeof(cl.gamedir)-1);
 
 	// set gamedir
@@ -334,7 +337,7 @@ void CL_ParseServerData (void)
 	cl.playernum = MSG_ReadShort (&net_message);
 
 	// get the full level name
-	str = MSG_ReadString (&net_message);
+	str = MSG_ReadStringView (&net_message);
 
 	if (cl.playernum == -1)
 	{	// playing a cinematic or showing a pic, not a level
@@ -525,7 +528,7 @@ void CL_ParseConfigString (void)
 	i = MSG_ReadShort (&net_message);
 	if (i < 0 || i >= MAX_CONFIGSTRINGS)
 		Com_Error (ERR_DROP, "configstring > MAX_CONFIGSTRINGS");
-	s = MSG_ReadString(&net_message);
+	s = MSG_ReadStringView (&net_message);
 
 	strncpy (olds, cl.configstrings[i], sizeof(olds));
 	olds[sizeof(olds) - 1] = 0;
@@ -729,16 +732,16 @@ void CL_ParseServerMessage (void)
 				S_StartLocalSound ("misc/talk.wav");
 				con.ormask = 128;
 			}
-			Com_Printf ("%s", MSG_ReadString (&net_message));
+			Com_Printf ("%s", MSG_ReadStringView (&net_message));
 			con.ormask = 0;
 			break;
 			
 		case svc_centerprint:
-			SCR_CenterPrint (MSG_ReadString (&net_message));
+			SCR_CenterPrint (MSG_ReadStringView (&net_message));
 			break;
 			
 		case svc_stufftext:
-			s = MSG_ReadString (&net_message);
+			s = MSG_ReadStringView (&net_message);
 			Com_DPrintf ("stufftext: %s\n", s);
 			Cbuf_AddText (s);
 			break;
@@ -785,7 +788,7 @@ void CL_ParseServerMessage (void)
 			break;
 
 		case svc_layout:
-			s = MSG_ReadString (&net_message);
+			s = MSG_ReadStringView (&net_message);
 			strncpy (cl.layout, s, sizeof(cl.layout)-1);
 			break;
 
@@ -344,6 +344,9 @@ void CL_PrepRefresh (void)
 	// the renderer can now free unneeded stuff
 	re.EndRegistration ();
 
+	// everything the map needs has been loaded
+	FS_EndMapLoad ();
+
 	// clear any lines of console text
 	Con_ClearNotify ();
 
@@ -329,6 +329,10 @@ typedef struct cvar_s
 	qboolean	modified;	// set each time the cvar is changed
 	float		value;
 	struct cvar_s *next;
+
+	// engine bookkeeping, after the fields the dlls use
+	struct cvar_s *hashnext;
+	int			modifiedcount;	// cvar_modifiedcount at the last change
 } cvar_t;
 
 #endif		// CVAR
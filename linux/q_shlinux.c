@@ -25,6 +25,9 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include <unistd.h>
 #include <sys/mman.h>
 #include <sys/time.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
 
 #include "../linux/glob.h"
 
@@ -87,6 +90,148 @@ void Hunk_Free (void *base)
 	}
 }
 
+/*
+================
+Sys_MapFile
+================
+*/
+void *Sys_MapFile (FILE *f, int offset, int length)
+{
+	byte	*view;
+	int		base;
+
+	if (length <= 0)
+		return NULL;
+
+	// mappings have to start on a page
+	base = offset - offset % getpagesize();
+	view = mmap(0, offset - base + length, PROT_READ, MAP_PRIVATE, fileno(f), base);
+	if (view == (byte *)-1)
+		return NULL;
+
+	return view + offset - base;
+}
+
+void Sys_UnmapFile (void *buffer, int offset, int length)
+{
+	int		skip;
+
+	skip = offset % getpagesize();
+	if (munmap((byte *)buffer - skip, skip + length))
+		Sys_Error("Sys_UnmapFile: munmap failed (%d)", errno);
+}
+
+/*
+================
+Sys_ReadFileAt
+================
+*/
+int Sys_ReadFileAt (FILE *f, void *buffer, int length, int offset)
+{
+	return pread(fileno(f), buffer, length, offset);
+}
+
+/*
+================
+Sys_CreateThread
+================
+*/
+typedef struct
+{
+	void	(*func) (void *data);
+	void	*data;
+	pthread_t	thread;
+} threadstart_t;
+
+static void *ThreadStart (void *parm)
+{
+	threadstart_t	*start;
+
+	start = (threadstart_t *)parm;
+	start->func (start->data);
+
+	return NULL;
+}
+
+void *Sys_CreateThread (void (*func) (void *data), void *data)
+{
+	threadstart_t	*start;
+
+	start = malloc (sizeof(*start));
+	if (!start)
+		return NULL;
+	start->func = func;
+	start->data = data;
+
+	if (pthread_create (&start->thread, NULL, ThreadStart, start))
+	{
+		free (start);
+		return NULL;
+	}
+
+	return start;
+}
+
+void Sys_WaitThread (void *thread)
+{
+	threadstart_t	*start;
+
+	start = (threadstart_t *)thread;
+	pthread_join (start->thread, NULL);
+	free (start);
+}
+
+/*
+================
+Sys_CreateSemaphore
+================
+*/
+void *Sys_CreateSemaphore (void)
+{
+	sem_t	*sem;
+
+	sem = malloc (sizeof(*sem));
+	if (!sem)
+		return NULL;
+	if (sem_init (sem, 0, 0))
+	{
+		free (sem);
+		return NULL;
+	}
+
+	return sem;
+}
+
+void Sys_PostSemaphore (void *sem, int count)
+{
+	while (count-- > 0)
+		sem_post ((sem_t *)sem);
+}
+
+void Sys_WaitSemaphore (void *sem)
+{
+	while (sem_wait ((sem_t *)sem) && errno == EINTR)
+		;
+}
+
+int Sys_NumProcessors (void)
+{
+	int		n;
+
+	n = sysconf (_SC_NPROCESSORS_ONLN);
+	return n < 1 ? 1 : n;
+}
+
+int Sys_AtomicIncrement (volatile int *value)
+{
+	return __sync_add_and_fetch (value, 1);
+}
+
+int Sys_AtomicLoad (volatile int *value)
+{
+	return __atomic_load_n (value, __ATOMIC_ACQUIRE);
+}
+
 //===============================================================================
 
 
@@ -115,6 +260,24 @@ int Sys_Milliseconds (void)
 	return curtime;
 }
 
+/*
+================
+Sys_FloatTime
+================
+*/
+double Sys_FloatTime (void)
+{
+	struct timespec ts;
+	static int		secbase;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+
+	if (!secbase)
+		secbase = ts.tv_sec;
+
+	return (ts.tv_sec - secbase) + ts.tv_nsec*1e-9;
+}
+
 void Sys_Mkdir (char *path)
 {
     mkdir (path, 0777);
@@ -108,6 +108,63 @@ int		Sys_Milliseconds (void)
 	return 0;
 }
 
+double	Sys_FloatTime (void)
+{
+	return 0;
+}
+
+void	*Sys_MapFile (FILE *f, int offset, int length)
+{
+	return NULL;
+}
+
+void	Sys_UnmapFile (void *buffer, int offset, int length)
+{
+}
+
+int		Sys_ReadFileAt (FILE *f, void *buffer, int length, int offset)
+{
+	fseek (f, offset, SEEK_SET);
+	return fread (buffer, 1, length, f);
+}
+
+void	*Sys_CreateThread (void (*func) (void *data), void *data)
+{
+	return NULL;
+}
+
+void	Sys_WaitThread (void *thread)
+{
+}
+
+void	*Sys_CreateSemaphore (void)
+{
+	return NULL;
+}
+
+void	Sys_PostSemaphore (void *sem, int count)
+{
+}
+
+void	Sys_WaitSemaphore (void *sem)
+{
+}
+
+int		Sys_NumProcessors (void)
+{
+	return 1;
+}
+
+int		Sys_AtomicIncrement (volatile int *value)
+{
+	return ++*value;
+}
+
+int		Sys_AtomicLoad (volatile int *value)
+{
+	return *value;
+}
+
 void	Sys_Mkdir (char *path)
 {
 }
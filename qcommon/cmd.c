@@ -28,14 +28,52 @@ void Cmd_ForwardToServer (void);
 typedef struct cmdalias_s
 {
 	struct cmdalias_s	*next;
+	struct cmdalias_s	*hashnext;
 	char	name[MAX_ALIAS_NAME];
 	char	*value;
 } cmdalias_t;
 
 cmdalias_t	*cmd_alias;
 
+// commands and aliases are also chained by a case insensitive hash of
+// their names, newest first like the lists, so Cmd_ExecuteString finds
+// the same entry the list walk used to
+#define	CMD_HASH_SIZE	512		// power of two
+
+static cmdalias_t	*alias_hash[CMD_HASH_SIZE];
+
+static char		**cmd_sorted;		// completion index, see Cmd_SortNames
+static int		cmd_numsorted, cmd_numsortedcmds;
+static qboolean	cmd_sortdirty = qTrue;
+
+/*
+============
+Cmd_HashName
+
+Case insensitive, like the Q_strcasecmp Cmd_ExecuteString matches with
+============
+*/
+static unsigned Cmd_HashName (char *name)
+{
+	unsigned	hash;
+	int			c;
+
+	hash = 0;
+	while (*name)
+	{
+		c = *name++;
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		hash = hash * 31 + c;
+	}
+
+	return hash & (CMD_HASH_SIZE-1);
+}
+
 qboolean	cmd_wait;
 
+int		cmd_executed;		// command lines run, for cmd_bench
+
 #define	ALIAS_LOOP_COUNT	16
 int		alias_count;		// for detecting runaway loops
 
@@ -445,7 +483,7 @@ void Cmd_Alias_f (void)
 	}
 
 	// if the alias already exists, reuse it
-	for (a = cmd_alias ; a ; a=a->next)
+	for (a = alias_hash[Cmd_HashName (s)] ; a ; a=a->hashnext)
 	{
 		if (!strcmp(s, a->name))
 		{
@@ -459,6 +497,9 @@ void Cmd_Alias_f (void)
 		a = Z_Malloc (sizeof(cmdalias_t));
 		a->next = cmd_alias;
 		cmd_alias = a;
+		a->hashnext = alias_hash[Cmd_HashName (s)];
+		alias_hash[Cmd_HashName (s)] = a;
+		cmd_sortdirty = qTrue;
 	}
 	strcpy (a->name, s);	
 
@@ -487,6 +528,7 @@ void Cmd_Alias_f (void)
 typedef struct cmd_function_s
 {
 	struct cmd_function_s	*next;
+	struct cmd_function_s	*hashnext;
 	char					*name;
 	xcommand_t				function;
 } cmd_function_t;
@@ -498,6 +540,7 @@ static	char		*cmd_null_string = "";
 static	char		cmd_args[MAX_STRING_CHARS];
 
 static	cmd_function_t	*cmd_functions;		// possible commands to execute
+static	cmd_function_t	*cmd_hash[CMD_HASH_SIZE];
 
 /*
 ============
@@ -700,7 +743,7 @@ void	Cmd_AddCommand (char *cmd_name, xcommand_t function)
 	}
 	
 // fail if the command already exists
-	for (cmd=cmd_functions ; cmd ; cmd=cmd->next)
+	for (cmd=cmd_hash[Cmd_HashName (cmd_name)] ; cmd ; cmd=cmd->hashnext)
 	{
 		if (!strcmp (cmd_name, cmd->name))
 		{
@@ -714,6 +757,9 @@ void	Cmd_AddCommand (char *cmd_name, xcommand_t function)
 	cmd->function = function;
 	cmd->next = cmd_functions;
 	cmd_functions = cmd;
+	cmd->hashnext = cmd_hash[Cmd_HashName (cmd_name)];
+	cmd_hash[Cmd_HashName (cmd_name)] = cmd;
+	cmd_sortdirty = qTrue;
 }
 
 /*
@@ -725,7 +771,7 @@ void	Cmd_RemoveCommand (char *cmd_name)
 {
 	cmd_function_t	*cmd, **back;
 
-	back = &cmd_functions;
+	back = &cmd_hash[Cmd_HashName (cmd_name)];
 	while (1)
 	{
 		cmd = *back;
@@ -736,12 +782,17 @@ void	Cmd_RemoveCommand (char *cmd_name)
 		}
 		if (!strcmp (cmd_name, cmd->name))
 		{
-			*back = cmd->next;
-			Z_Free (cmd);
-			return;
+			*back = cmd->hashnext;
+			break;
 		}
-		back = &cmd->next;
+		back = &cmd->hashnext;
 	}
+
+	for (back = &cmd_functions ; *back != cmd ; back = &(*back)->next)
+		;
+	*back = cmd->next;
+	Z_Free (cmd);
+	cmd_sortdirty = qTrue;
 }
 
 /*
@@ -753,7 +804,7 @@ qboolean	Cmd_Exists (char *cmd_name)
 {
 	cmd_function_t	*cmd;
 
-	for (cmd=cmd_functions ; cmd ; cmd=cmd->next)
+	for (cmd=cmd_hash[Cmd_HashName (cmd_name)] ; cmd ; cmd=cmd->hashnext)
 	{
 		if (!strcmp (cmd_name,cmd->name))
 			return qTrue;
@@ -764,9 +815,79 @@ qboolean	Cmd_Exists (char *cmd_name)
 
 
 
+/*
+============
+Cmd_SortNames
+
+Rebuilds the completion index after commands or aliases come or go:
+all the command names sorted, followed by all the alias names sorted
+============
+*/
+static int Cmd_CompareNames (const void *a, const void *b)
+{
+	return strcmp (*(char **)a, *(char **)b);
+}
+
+static void Cmd_SortNames (void)
+{
+	cmd_function_t	*cmd;
+	cmdalias_t		*a;
+	int				count;
+
+	if (cmd_sorted)
+		Z_Free (cmd_sorted);
+
+	count = 0;
+	for (cmd=cmd_functions ; cmd ; cmd=cmd->next)
+		count++;
+	for (a=cmd_alias ; a ; a=a->next)
+		count++;
+	cmd_sorted = Z_Malloc ((count + 1) * sizeof(*cmd_sorted));
+
+	cmd_numsorted = 0;
+	for (cmd=cmd_functions ; cmd ; cmd=cmd->next)
+		cmd_sorted[cmd_numsorted++] = cmd->name;
+	cmd_numsortedcmds = cmd_numsorted;
+	for (a=cmd_alias ; a ; a=a->next)
+		cmd_sorted[cmd_numsorted++] = a->name;
+
+	qsort (cmd_sorted, cmd_numsortedcmds, sizeof(*cmd_sorted), Cmd_CompareNames);
+	qsort (cmd_sorted + cmd_numsortedcmds, cmd_numsorted - cmd_numsortedcmds, sizeof(*cmd_sorted), Cmd_CompareNames);
+	cmd_sortdirty = qFalse;
+}
+
+/*
+============
+Cmd_FindPrefix
+
+Returns the first name in the sorted run [first, last) that starts
+with partial, or NULL
+============
+*/
+static char *Cmd_FindPrefix (char *partial, int len, int first, int last)
+{
+	int		mid;
+
+	while (first < last)
+	{	// lower bound: the first name not sorting before partial
+		mid = (first + last) >> 1;
+		if (strcmp (cmd_sorted[mid], partial) < 0)
+			first = mid + 1;
+		else
+			last = mid;
+	}
+
+	if (first < cmd_numsorted && !strncmp (partial, cmd_sorted[first], len))
+		return cmd_sorted[first];
+	return NULL;
+}
+
 /*
 ============
 Cmd_CompleteCommand
+
+Commands win over aliases.  A partial name completes to the
+alphabetically first command (or alias) it is a prefix of.
 ============
 */
 char *Cmd_CompleteCommand (char *partial)
@@ -774,6 +895,7 @@ char *Cmd_CompleteCommand (char *partial)
 	cmd_function_t	*cmd;
 	int				len;
 	cmdalias_t		*a;
+	char			*name;
 	
 	len = strlen(partial);
 	
@@ -781,22 +903,21 @@ char *Cmd_CompleteCommand (char *partial)
 		return NULL;
 		
 // check for exact match
-	for (cmd=cmd_functions ; cmd ; cmd=cmd->next)
+	for (cmd=cmd_hash[Cmd_HashName (partial)] ; cmd ; cmd=cmd->hashnext)
 		if (!strcmp (partial,cmd->name))
 			return cmd->name;
-	for (a=cmd_alias ; a ; a=a->next)
+	for (a=alias_hash[Cmd_HashName (partial)] ; a ; a=a->hashnext)
 		if (!strcmp (partial, a->name))
 			return a->name;
 
 // check for partial match
-	for (cmd=cmd_functions ; cmd ; cmd=cmd->next)
-		if (!strncmp (partial,cmd->name, len))
-			return cmd->name;
-	for (a=cmd_alias ; a ; a=a->next)
-		if (!strncmp (partial, a->name, len))
-			return a->name;
+	if (cmd_sortdirty)
+		Cmd_SortNames ();
 
-	return NULL;
+	name = Cmd_FindPrefix (partial, len, 0, cmd_numsortedcmds);
+	if (!name)
+		name = Cmd_FindPrefix (partial, len, cmd_numsortedcmds, cmd_numsorted);
+	return name;
 }
 
 
@@ -819,8 +940,10 @@ void	Cmd_ExecuteString (char *text)
 	if (!Cmd_Argc())
 		return;		// no tokens
 
+	cmd_executed++;
+
 	// check functions
-	for (cmd=cmd_functions ; cmd ; cmd=cmd->next)
+	for (cmd=cmd_hash[Cmd_HashName (cmd_argv[0])] ; cmd ; cmd=cmd->hashnext)
 	{
 		if (!Q_strcasecmp (cmd_argv[0],cmd->name))
 		{
@@ -835,7 +958,7 @@ void	Cmd_ExecuteString (char *text)
 	}
 
 	// check alias
-	for (a=cmd_alias ; a ; a=a->next)
+	for (a=alias_hash[Cmd_HashName (cmd_argv[0])] ; a ; a=a->hashnext)
 	{
 		if (!Q_strcasecmp (cmd_argv[0], a->name))
 		{
@@ -873,6 +996,91 @@ void Cmd_List_f (void)
 	Com_Printf ("%i commands\n", i);
 }
 
+/*
+============
+Cmd_Bench_f
+
+Runs a config file through the command buffer, the way exec does, and
+reports the dispatch rate.  Whatever the file does really happens, so
+use a config that is safe to run repeatedly.
+============
+*/
+void Cmd_Bench_f (void)
+{
+	char	name[MAX_QPATH];
+	char	*f, *saved;
+	int		len, savedlen;
+	int		passes, pass, start, end, i;
+	int		executed;
+	double	time;
+
+	if (Cmd_Argc() < 2)
+	{
+		Com_Printf ("usage: cmd_bench <cfgfile> [passes]\n");
+		return;
+	}
+
+	// the commands being timed will retokenize over Cmd_Argv
+	strncpy (name, Cmd_Argv(1), sizeof(name)-1);
+	name[sizeof(name)-1] = 0;
+
+	len = FS_LoadFile (name, (void **)&f);
+	if (!f)
+	{
+		Com_Printf ("couldn't load %s\n", name);
+		return;
+	}
+
+	passes = Cmd_Argc() > 2 ? atoi(Cmd_Argv(2)) : 100;
+	if (passes < 1)
+		passes = 1;
+
+	// hold on to whatever was queued behind this command
+	savedlen = cmd_text.cursize;
+	saved = Z_Malloc (savedlen + 1);
+	memcpy (saved, cmd_text.data, savedlen);
+	cmd_text.cursize = 0;
+
+	executed = cmd_executed;
+	time = Sys_FloatTime ();
+
+	for (pass=0 ; pass<passes ; pass++)
+	{
+		// feed it in pieces that end on a line, the buffer is only 8k
+		for (start=0 ; start<len ; start=end)
+		{
+			end = len;
+			if (end - start > cmd_text.maxsize / 2)
+			{
+				end = start + cmd_text.maxsize / 2;
+				for (i=end-1 ; i>start ; i--)
+					if (f[i] == '\n')
+					{
+						end = i + 1;
+						break;
+					}
+			}
+
+			SZ_Write (&cmd_text, f + start, end - start);
+			SZ_Write (&cmd_text, "\n", 1);
+			while (cmd_text.cursize)
+				Cbuf_Execute ();
+		}
+	}
+
+	time = Sys_FloatTime () - time;
+	executed = cmd_executed - executed;
+
+	cmd_text.cursize = 0;
+	SZ_Write (&cmd_text, saved, savedlen);
+	Z_Free (saved);
+	FS_FreeFile (f);
+
+	Com_Printf ("%s: %i commands in %i passes, %.3f ms per pass, %.3f usec per command\n",
+		name, executed, passes, time * 1000 / passes,
+		executed ? time * 1000000 / executed : 0);
+}
+
 /*
 ============
 Cmd_Init
@@ -888,5 +1096,6 @@ void Cmd_Init (void)
 	Cmd_AddCommand ("echo",Cmd_Echo_f);
 	Cmd_AddCommand ("alias",Cmd_Alias_f);
 	Cmd_AddCommand ("wait", Cmd_Wait_f);
+	Cmd_AddCommand ("cmd_bench", Cmd_Bench_f);
 }
 
@@ -21,12 +21,26 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "qcommon.h"
 
+#if defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2) || defined __SSE2__
+#define	CM_SSE2	1
+#include <emmintrin.h>
+#else
+#define	CM_SSE2	0
+#endif
+
 typedef struct
 {
 	cplane_t	*plane;
 	int			children[2];		// negative numbers are leafs
 } cnode_t;
 
+// node of the compiled layout, with its plane stored inline
+typedef struct
+{
+	cplane_t	plane;
+	int			children[2];		// compiled node numbers, negative numbers are leafs
+} ccnode_t;
+
 typedef struct
 {
 	cplane_t	*plane;
@@ -40,6 +54,7 @@ typedef struct
 	int			area;
 	unsigned short	firstleafbrush;
 	unsigned short	numleafbrushes;
+	vec3_t		mins, maxs;			// bounds of all the leaf's brushes
 } cleaf_t;
 
 typedef struct
@@ -47,18 +62,54 @@ typedef struct
 	int			contents;
 	int			numsides;
 	int			firstbrushside;
-	int			checkcount;		// to avoid repeated testings
+	vec3_t		mins, maxs;			// from the axial sides, huge if there are none
 } cbrush_t;
 
+// a sweep whose bounds miss a brush's bounds by more than this on any axis
+// is in front of that side by more than DIST_EPSILON at both ends, so
+// clipping against the brush could not change the trace
+#define	BOUNDS_EPSILON	1.0
+#define	BOUNDS_HUGE		999999
+
 typedef struct
 {
 	int		numareaportals;
 	int		firstareaportal;
 	int		floodnum;			// if two areas have equal floodnums, they are connected
-	int		floodvalid;
+	int		floodmark;			// for the searches in CM_SetAreaPortalState
 } carea_t;
 
-int			checkcount;
+struct cmcontext_s
+{
+	// the trace in progress
+	vec3_t		start, end;
+	vec3_t		mins, maxs;
+	vec3_t		extents;
+	trace_t		trace;
+	int			contents;
+	qboolean	ispoint;		// optimized case
+	vec3_t		absmins, absmaxs;	// bounds of the whole sweep
+	qboolean	compiled;		// use the compiled layout
+	vec3_t		corners[8];		// box corner to push each plane out by, by signbits
+
+	// brushes stamped with the current checkcount have already been
+	// tested by this trace
+	int			checkcount;
+	int			brushchecks[MAX_MAP_BRUSHES];
+
+	// CM_BoxLeafnums
+	int			leaf_count, leaf_maxcount;
+	int			*leaf_list;
+	float		*leaf_mins, *leaf_maxs;
+	int			leaf_topnode;
+
+	// CM_HeadnodeForBox
+	cplane_t	box_planes[12];
+
+	// CM_ClusterPVS and CM_ClusterPHS rows without the vis matrix
+	byte		pvsrow[MAX_MAP_LEAFS/8];
+	byte		phsrow[MAX_MAP_LEAFS/8];
+};
 
 char		map_name[MAX_QPATH];
 
@@ -87,9 +138,16 @@ cmodel_t	map_cmodels[MAX_MAP_MODELS];
 int			numbrushes;
 cbrush_t	map_brushes[MAX_MAP_BRUSHES];
 
+// compiled collision layout, see CM_CompileCollision
+int			map_nodeorder[MAX_MAP_NODES];			// map node number to compiled node number
+ccnode_t	map_cnodes[MAX_MAP_NODES];
+cplane_t	map_sideplanes[MAX_MAP_BRUSHSIDES];		// copy of each brush side's plane
+mapsurface_t	*map_sidesurfaces[MAX_MAP_BRUSHSIDES];
+
 int			numvisibility;
-byte		map_visibility[MAX_MAP_VISIBILITY];
-dvis_t		*map_vis = (dvis_t *)map_visibility;
+byte		map_visibilitybuf[MAX_MAP_VISIBILITY];	// when it can't be used in place
+byte		*map_visibility = map_visibilitybuf;
+dvis_t		*map_vis = (dvis_t *)map_visibilitybuf;
 
 int			numentitychars;
 char		map_entitystring[MAX_MAP_ENTSTRING];
@@ -104,17 +162,33 @@ int			numclusters = 1;
 
 mapsurface_t	nullsurface;
 
-int			floodvalid;
-
 qboolean	portalopen[MAX_MAP_AREAPORTALS];
+int			portalareas[MAX_MAP_AREAPORTALS][2];	// the areas on each side
+
+// flood bookkeeping so a portal change only has to touch the floods
+// on either side of it
+int			floodsize[MAX_MAP_AREAS+1];		// areas in each floodnum
+int			freefloods[MAX_MAP_AREAS+1];	// floodnums not in use
+int			numfreefloods;
+int			floodmark;
 
 
 cvar_t		*map_noareas;
+cvar_t		*cm_compiled;
+cvar_t		*cm_verify;
+cvar_t		*cm_vismatrix;
+cvar_t		*cm_loadtimes;
 
 void	CM_InitBoxHull (void);
+void	CM_CompileCollision (void);
+void	CMod_SetBrushBounds (void);
+void	CM_BuildVisMatrix (void);
+void	CM_FreeVisMatrix (void);
 void	FloodAreaConnections (void);
 
 
+// statistics, shared by all threads so only approximate when
+// several are tracing
 int		c_pointcontents;
 int		c_traces, c_brush_traces;
 
@@ -128,6 +202,14 @@ int		c_traces, c_brush_traces;
 */
 
 byte	*cmod_base;
+byte	*cmod_mapping;		// the mapped file, while lumps are still viewed in it
+qboolean	cmod_viewed;
+
+// Every lump is loaded in two steps.  CMod_Load* checks the lump and sets
+// its count on the main thread, where Com_Error is safe.  CMod_Convert*
+// then swaps it into the map arrays, and may run on a worker alongside the
+// other lumps, since no conversion reads another lump's converted data.
+// The checks that do are in CMod_CheckLumps.
 
 /*
 =================
@@ -136,14 +218,11 @@ CMod_LoadSubmodels
 */
 void CMod_LoadSubmodels (lump_t *l)
 {
-	dmodel_t	*in;
-	cmodel_t	*out;
-	int			i, j, count;
+	int			count;
 
-	in = (void *)(cmod_base + l->fileofs);
-	if (l->filelen % sizeof(*in))
+	if (l->filelen % sizeof(dmodel_t))
 		Com_Error (ERR_DROP, "MOD_LoadBmodel: funny lump size");
-	count = l->filelen / sizeof(*in);
+	count = l->filelen / sizeof(dmodel_t);
 
 	if (count < 1)
 		Com_Error (ERR_DROP, "Map with no models");
@@ -151,8 +230,17 @@ void CMod_LoadSubmodels (lump_t *l)
 		Com_Error (ERR_DROP, "Map has too many models");
 
 	numcmodels = count;
+}
+
+void CMod_ConvertSubmodels (lump_t *l)
+{
+	dmodel_t	*in;
+	cmodel_t	*out;
+	int			i, j;
+
+	in = (void *)(cmod_base + l->fileofs);
 
-	for ( i=0 ; i<count ; i++, in++, out++)
+	for ( i=0 ; i<numcmodels ; i++, in++)
 	{
 		out = &map_cmodels[i];
 
@@ -174,23 +262,29 @@ CMod_LoadSurfaces
 */
 void CMod_LoadSurfaces (lump_t *l)
 {
-	texinfo_t	*in;
-	mapsurface_t	*out;
-	int			i, count;
+	int			count;
 
-	in = (void *)(cmod_base + l->fileofs);
-	if (l->filelen % sizeof(*in))
+	if (l->filelen % sizeof(texinfo_t))
 		Com_Error (ERR_DROP, "MOD_LoadBmodel: funny lump size");
-	count = l->filelen / sizeof(*in);
+	count = l->filelen / sizeof(texinfo_t);
 	if (count < 1)
 		Com_Error (ERR_DROP, "Map with no surfaces");
 	if (count > MAX_MAP_TEXINFO)
 		Com_Error (ERR_DROP, "Map has too many surfaces");
 
 	numtexinfo = count;
+}
+
+void CMod_ConvertSurfaces (lump_t *l)
+{
+	texinfo_t	*in;
+	mapsurface_t	*out;
+	int			i;
+
+	in = (void *)(cmod_base + l->fileofs);
 	out = map_surfaces;
 
-	for ( i=0 ; i<count ; i++, in++, out++)
+	for ( i=0 ; i<numtexinfo ; i++, in++, out++)
 	{
 		strncpy (out->c.name, in->texture, sizeof(out->c.name)-1);
 		strncpy (out->rname, in->texture, sizeof(out->rname)-1);
@@ -208,26 +302,31 @@ CMod_LoadNodes
 */
 void CMod_LoadNodes (lump_t *l)
 {
-	dnode_t		*in;
-	int			child;
-	cnode_t		*out;
-	int			i, j, count;
+	int			count;
 	
-	in = (void *)(cmod_base + l->fileofs);
-	if (l->filelen % sizeof(*in))
+	if (l->filelen % sizeof(dnode_t))
 		Com_Error (ERR_DROP, "MOD_LoadBmodel: funny lump size");
-	count = l->filelen / sizeof(*in);
+	count = l->filelen / sizeof(dnode_t);
 
 	if (count < 1)
 		Com_Error (ERR_DROP, "Map has no nodes");
 	if (count > MAX_MAP_NODES)
 		Com_Error (ERR_DROP, "Map has too many nodes");
 
-	out = map_nodes;
-
 	numnodes = count;
+}
+
+void CMod_ConvertNodes (lump_t *l)
+{
+	dnode_t		*in;
+	int			child;
+	cnode_t		*out;
+	int			i, j;
+
+	in = (void *)(cmod_base + l->fileofs);
+	out = map_nodes;
 
-	for (i=0 ; i<count ; i++, out++, in++)
+	for (i=0 ; i<numnodes ; i++, out++, in++)
 	{
 		out->plane = map_planes + LittleLong(in->planenum);
 		for (j=0 ; j<2 ; j++)
@@ -247,23 +346,28 @@ CMod_LoadBrushes
 */
 void CMod_LoadBrushes (lump_t *l)
 {
-	dbrush_t	*in;
-	cbrush_t	*out;
-	int			i, count;
+	int			count;
 	
-	in = (void *)(cmod_base + l->fileofs);
-	if (l->filelen % sizeof(*in))
+	if (l->filelen % sizeof(dbrush_t))
 		Com_Error (ERR_DROP, "MOD_LoadBmodel: funny lump size");
-	count = l->filelen / sizeof(*in);
+	count = l->filelen / sizeof(dbrush_t);
 
 	if (count > MAX_MAP_BRUSHES)
 		Com_Error (ERR_DROP, "Map has too many brushes");
 
-	out = map_brushes;
-
 	numbrushes = count;
+}
+
+void CMod_ConvertBrushes (lump_t *l)
+{
+	dbrush_t	*in;
+	cbrush_t	*out;
+	int			i;
+
+	in = (void *)(cmod_base + l->fileofs);
+	out = map_brushes;
 
-	for (i=0 ; i<count ; i++, out++, in++)
+	for (i=0 ; i<numbrushes ; i++, out++, in++)
 	{
 		out->firstbrushside = LittleLong(in->firstside);
 		out->numsides = LittleLong(in->numsides);
@@ -279,15 +383,11 @@ CMod_LoadLeafs
 */
 void CMod_LoadLeafs (lump_t *l)
 {
-	int			i;
-	cleaf_t		*out;
-	dleaf_t 	*in;
 	int			count;
 	
-	in = (void *)(cmod_base + l->fileofs);
-	if (l->filelen % sizeof(*in))
+	if (l->filelen % sizeof(dleaf_t))
 		Com_Error (ERR_DROP, "MOD_LoadBmodel: funny lump size");
-	count = l->filelen / sizeof(*in);
+	count = l->filelen / sizeof(dleaf_t);
 
 	if (count < 1)
 		Com_Error (ERR_DROP, "Map with no leafs");
@@ -295,11 +395,20 @@ void CMod_LoadLeafs (lump_t *l)
 	if (count > MAX_MAP_PLANES)
 		Com_Error (ERR_DROP, "Map has too many planes");
 
-	out = map_leafs;	
 	numleafs = count;
+}
+
+void CMod_ConvertLeafs (lump_t *l)
+{
+	int			i;
+	cleaf_t		*out;
+	dleaf_t 	*in;
+
+	in = (void *)(cmod_base + l->fileofs);
+	out = map_leafs;	
 	numclusters = 0;
 
-	for ( i=0 ; i<count ; i++, in++, out++)
+	for ( i=0 ; i<numleafs ; i++, in++, out++)
 	{
 		out->contents = LittleLong (in->contents);
 		out->cluster = LittleShort (in->cluster);
@@ -310,21 +419,6 @@ void CMod_LoadLeafs (lump_t *l)
 		if (out->cluster >= numclusters)
 			numclusters = out->cluster + 1;
 	}
-
-	if (map_leafs[0].contents != CONTENTS_SOLID)
-		Com_Error (ERR_DROP, "Map leaf 0 is not CONTENTS_SOLID");
-	solidleaf = 0;
-	emptyleaf = -1;
-	for (i=1 ; i<numleafs ; i++)
-	{
-		if (!map_leafs[i].contents)
-		{
-			emptyleaf = i;
-			break;
-		}
-	}
-	if (emptyleaf == -1)
-		Com_Error (ERR_DROP, "Map does not have an empty leaf");
 }
 
 /*
@@ -334,16 +428,11 @@ CMod_LoadPlanes
 */
 void CMod_LoadPlanes (lump_t *l)
 {
-	int			i, j;
-	cplane_t	*out;
-	dplane_t 	*in;
 	int			count;
-	int			bits;
 	
-	in = (void *)(cmod_base + l->fileofs);
-	if (l->filelen % sizeof(*in))
+	if (l->filelen % sizeof(dplane_t))
 		Com_Error (ERR_DROP, "MOD_LoadBmodel: funny lump size");
-	count = l->filelen / sizeof(*in);
+	count = l->filelen / sizeof(dplane_t);
 
 	if (count < 1)
 		Com_Error (ERR_DROP, "Map with no planes");
@@ -351,10 +440,20 @@ void CMod_LoadPlanes (lump_t *l)
 	if (count > MAX_MAP_PLANES)
 		Com_Error (ERR_DROP, "Map has too many planes");
 
-	out = map_planes;	
 	numplanes = count;
+}
+
+void CMod_ConvertPlanes (lump_t *l)
+{
+	int			i, j;
+	cplane_t	*out;
+	dplane_t 	*in;
+	int			bits;
+	
+	in = (void *)(cmod_base + l->fileofs);
+	out = map_planes;	
 
-	for ( i=0 ; i<count ; i++, in++, out++)
+	for ( i=0 ; i<numplanes ; i++, in++, out++)
 	{
 		bits = 0;
 		for (j=0 ; j<3 ; j++)
@@ -370,6 +469,52 @@ void CMod_LoadPlanes (lump_t *l)
 	}
 }
 
+/*
+=================
+CMod_SetBrushBounds
+
+Bounds for every brush from its axial sides, and for every leaf from
+its brushes, so traces can skip brushes and leafs they can't reach.
+Needs the planes, brushes and brush sides loaded.
+=================
+*/
+void CMod_SetBrushBounds (void)
+{
+	int			i, j, k;
+	cbrush_t	*brush;
+	cleaf_t		*leaf;
+	cplane_t	*plane;
+
+	for (i=0, brush=map_brushes ; i<numbrushes ; i++, brush++)
+	{
+		VectorSet (brush->mins, -BOUNDS_HUGE, -BOUNDS_HUGE, -BOUNDS_HUGE);
+		VectorSet (brush->maxs, BOUNDS_HUGE, BOUNDS_HUGE, BOUNDS_HUGE);
+
+		for (j=0 ; j<brush->numsides ; j++)
+		{
+			plane = map_brushsides[brush->firstbrushside+j].plane;
+			for (k=0 ; k<3 ; k++)
+			{
+				if (plane->normal[k] == 1 && plane->dist < brush->maxs[k])
+					brush->maxs[k] = plane->dist;
+				else if (plane->normal[k] == -1 && -plane->dist > brush->mins[k])
+					brush->mins[k] = -plane->dist;
+			}
+		}
+	}
+
+	for (i=0, leaf=map_leafs ; i<numleafs ; i++, leaf++)
+	{
+		ClearBounds (leaf->mins, leaf->maxs);
+		for (j=0 ; j<leaf->numleafbrushes ; j++)
+		{
+			brush = &map_brushes[map_leafbrushes[leaf->firstleafbrush+j]];
+			AddPointToBounds (brush->mins, leaf->mins, leaf->maxs);
+			AddPointToBounds (brush->maxs, leaf->mins, leaf->maxs);
+		}
+	}
+}
+
 /*
 =================
 CMod_LoadLeafBrushes
@@ -377,15 +522,11 @@ CMod_LoadLeafBrushes
 */
 void CMod_LoadLeafBrushes (lump_t *l)
 {
-	int			i;
-	unsigned short	*out;
-	unsigned short 	*in;
 	int			count;
 	
-	in = (void *)(cmod_base + l->fileofs);
-	if (l->filelen % sizeof(*in))
+	if (l->filelen % sizeof(unsigned short))
 		Com_Error (ERR_DROP, "MOD_LoadBmodel: funny lump size");
-	count = l->filelen / sizeof(*in);
+	count = l->filelen / sizeof(unsigned short);
 
 	if (count < 1)
 		Com_Error (ERR_DROP, "Map with no planes");
@@ -393,10 +534,19 @@ void CMod_LoadLeafBrushes (lump_t *l)
 	if (count > MAX_MAP_LEAFBRUSHES)
 		Com_Error (ERR_DROP, "Map has too many leafbrushes");
 
-	out = map_leafbrushes;
 	numleafbrushes = count;
+}
+
+void CMod_ConvertLeafBrushes (lump_t *l)
+{
+	int			i;
+	unsigned short	*out;
+	unsigned short 	*in;
+	
+	in = (void *)(cmod_base + l->fileofs);
+	out = map_leafbrushes;
 
-	for ( i=0 ; i<count ; i++, in++, out++)
+	for ( i=0 ; i<numleafbrushes ; i++, in++, out++)
 		*out = LittleShort (*in);
 }
 
@@ -407,32 +557,32 @@ CMod_LoadBrushSides
 */
 void CMod_LoadBrushSides (lump_t *l)
 {
-	int			i, j;
-	cbrushside_t	*out;
-	dbrushside_t 	*in;
 	int			count;
-	int			num;
 
-	in = (void *)(cmod_base + l->fileofs);
-	if (l->filelen % sizeof(*in))
+	if (l->filelen % sizeof(dbrushside_t))
 		Com_Error (ERR_DROP, "MOD_LoadBmodel: funny lump size");
-	count = l->filelen / sizeof(*in);
+	count = l->filelen / sizeof(dbrushside_t);
 
 	// need to save space for box planes
 	if (count > MAX_MAP_BRUSHSIDES)
 		Com_Error (ERR_DROP, "Map has too many planes");
 
-	out = map_brushsides;	
 	numbrushsides = count;
+}
+
+void CMod_ConvertBrushSides (lump_t *l)
+{
+	int			i;
+	cbrushside_t	*out;
+	dbrushside_t 	*in;
+
+	in = (void *)(cmod_base + l->fileofs);
+	out = map_brushsides;	
 
-	for ( i=0 ; i<count ; i++, in++, out++)
+	for ( i=0 ; i<numbrushsides ; i++, in++, out++)
 	{
-		num = LittleShort (in->planenum);
-		out->plane = &map_planes[num];
-		j = LittleShort (in->texinfo);
-		if (j >= numtexinfo)
-			Com_Error (ERR_DROP, "Bad brushside texinfo");
-		out->surface = &map_surfaces[j];
+		out->plane = &map_planes[LittleShort (in->planenum)];
+		out->surface = &map_surfaces[LittleShort (in->texinfo)];	// checked in CMod_CheckLumps
 	}
 }
 
@@ -443,28 +593,33 @@ CMod_LoadAreas
 */
 void CMod_LoadAreas (lump_t *l)
 {
-	int			i;
-	carea_t		*out;
-	darea_t 	*in;
 	int			count;
 
-	in = (void *)(cmod_base + l->fileofs);
-	if (l->filelen % sizeof(*in))
+	if (l->filelen % sizeof(darea_t))
 		Com_Error (ERR_DROP, "MOD_LoadBmodel: funny lump size");
-	count = l->filelen / sizeof(*in);
+	count = l->filelen / sizeof(darea_t);
 
 	if (count > MAX_MAP_AREAS)
 		Com_Error (ERR_DROP, "Map has too many areas");
 
-	out = map_areas;
 	numareas = count;
+}
+
+void CMod_ConvertAreas (lump_t *l)
+{
+	int			i;
+	carea_t		*out;
+	darea_t 	*in;
+
+	in = (void *)(cmod_base + l->fileofs);
+	out = map_areas;
 
-	for ( i=0 ; i<count ; i++, in++, out++)
+	for ( i=0 ; i<numareas ; i++, in++, out++)
 	{
 		out->numareaportals = LittleLong (in->numareaportals);
 		out->firstareaportal = LittleLong (in->firstareaportal);
-		out->floodvalid = 0;
 		out->floodnum = 0;
+		out->floodmark = 0;
 	}
 }
 
@@ -475,29 +630,55 @@ CMod_LoadAreaPortals
 */
 void CMod_LoadAreaPortals (lump_t *l)
 {
-	int			i;
-	dareaportal_t		*out;
-	dareaportal_t 	*in;
 	int			count;
 
-	in = (void *)(cmod_base + l->fileofs);
-	if (l->filelen % sizeof(*in))
+	if (l->filelen % sizeof(dareaportal_t))
 		Com_Error (ERR_DROP, "MOD_LoadBmodel: funny lump size");
-	count = l->filelen / sizeof(*in);
+	count = l->filelen / sizeof(dareaportal_t);
 
 	if (count > MAX_MAP_AREAS)
 		Com_Error (ERR_DROP, "Map has too many areas");
 
-	out = map_areaportals;
 	numareaportals = count;
+}
+
+void CMod_ConvertAreaPortals (lump_t *l)
+{
+	int			i;
+	dareaportal_t		*out;
+	dareaportal_t 	*in;
+
+	in = (void *)(cmod_base + l->fileofs);
+	out = map_areaportals;
 
-	for ( i=0 ; i<count ; i++, in++, out++)
+	for ( i=0 ; i<numareaportals ; i++, in++, out++)
 	{
 		out->portalnum = LittleLong (in->portalnum);
 		out->otherarea = LittleLong (in->otherarea);
 	}
 }
 
+/*
+=================
+CMod_LumpView
+
+Returns the lump where it sits in the mapped file if it can be used as is,
+which needs a little-endian host and an aligned lump, otherwise NULL and
+the caller copies and swaps it.  The file stays mapped until the next map.
+=================
+*/
+byte *CMod_LumpView (lump_t *l)
+{
+	byte	*view;
+
+	view = cmod_base + l->fileofs;
+	if (!l->filelen || LittleLong (1) != 1 || ((size_t)view & 3))
+		return NULL;
+
+	cmod_viewed = qTrue;
+	return view;
+}
+
 /*
 =================
 CMod_LoadVisibility
@@ -505,12 +686,22 @@ CMod_LoadVisibility
 */
 void CMod_LoadVisibility (lump_t *l)
 {
-	int		i;
-
 	numvisibility = l->filelen;
 	if (l->filelen > MAX_MAP_VISIBILITY)
 		Com_Error (ERR_DROP, "Map has too large visibility lump");
+}
+
+void CMod_ConvertVisibility (lump_t *l)
+{
+	int		i;
 
+	map_visibility = CMod_LumpView (l);
+	map_vis = (dvis_t *)map_visibility;
+	if (map_visibility)
+		return;		// already in native order
+
+	map_visibility = map_visibilitybuf;
+	map_vis = (dvis_t *)map_visibility;
 	memcpy (map_visibility, cmod_base + l->fileofs, l->filelen);
 
 	map_vis->numclusters = LittleLong (map_vis->numclusters);
@@ -532,51 +723,220 @@ void CMod_LoadEntityString (lump_t *l)
 	numentitychars = l->filelen;
 	if (l->filelen > MAX_MAP_ENTSTRING)
 		Com_Error (ERR_DROP, "Map has too large entity lump");
+}
 
+void CMod_ConvertEntityString (lump_t *l)
+{
 	memcpy (map_entitystring, cmod_base + l->fileofs, l->filelen);
 }
 
 
-
 /*
-==================
-CM_LoadMap
+=================
+CMod_CheckLumps
 
-Loads in the map and all submodels
-==================
+The checks that need the lumps converted
+=================
 */
-cmodel_t *CM_LoadMap (char *name, qboolean clientload, unsigned *checksum)
+void CMod_CheckLumps (void)
 {
-	unsigned		*buf;
-	int				i;
-	dheader_t		header;
-	int				length;
-	static unsigned	last_checksum;
-
-	map_noareas = Cvar_Get ("map_noareas", "0", 0);
+	int				i, j;
+	int				child;
+	dareaportal_t	*p;
 
-	if (  !strcmp (map_name, name) && (clientload || !Cvar_VariableValue ("flushmap")) )
+	if (map_leafs[0].contents != CONTENTS_SOLID)
+		Com_Error (ERR_DROP, "Map leaf 0 is not CONTENTS_SOLID");
+	solidleaf = 0;
+	emptyleaf = -1;
+	for (i=1 ; i<numleafs ; i++)
 	{
-		*checksum = last_checksum;
-		if (!clientload)
+		if (!map_leafs[i].contents)
 		{
-			memset (portalopen, 0, sizeof(portalopen));
-			FloodAreaConnections ();
+			emptyleaf = i;
+			break;
 		}
-		return &map_cmodels[0];		// still have the right version
 	}
+	if (emptyleaf == -1)
+		Com_Error (ERR_DROP, "Map does not have an empty leaf");
 
-	// free old stuff
-	numplanes = 0;
-	numnodes = 0;
-	numleafs = 0;
-	numcmodels = 0;
-	numvisibility = 0;
-	numentitychars = 0;
-	map_entitystring[0] = 0;
-	map_name[0] = 0;
-
-	if (!name || !name[0])
+	for (i=0 ; i<numbrushsides ; i++)
+	{
+		if (map_brushsides[i].surface >= map_surfaces + numtexinfo)
+			Com_Error (ERR_DROP, "Bad brushside texinfo");
+	}
+
+	// CM_CompileCollision and the traces follow these without checking
+	for (i=0 ; i<numnodes ; i++)
+	{
+		if (map_nodes[i].plane < map_planes || map_nodes[i].plane >= map_planes + numplanes)
+			Com_Error (ERR_DROP, "Bad node plane");
+		for (j=0 ; j<2 ; j++)
+		{
+			child = map_nodes[i].children[j];
+			if (child >= numnodes || (child < 0 && -1-child >= numleafs))
+				Com_Error (ERR_DROP, "Bad node child");
+		}
+	}
+
+	for (i=0, p=map_areaportals ; i<numareaportals ; i++, p++)
+	{
+		if (p->portalnum < 0 || p->portalnum >= MAX_MAP_AREAPORTALS
+			|| p->otherarea < 0 || p->otherarea >= numareas)
+			Com_Error (ERR_DROP, "CMod_LoadAreaPortals: bad portal");
+	}
+
+	// every portal is listed from both of its areas
+	memset (portalareas, 0, sizeof(portalareas));
+	for (i=0 ; i<numareas ; i++)
+	{
+		p = &map_areaportals[map_areas[i].firstareaportal];
+		for (j=0 ; j<map_areas[i].numareaportals ; j++, p++)
+		{
+			if (map_areas[i].firstareaportal + j >= numareaportals)
+				Com_Error (ERR_DROP, "CMod_LoadAreaPortals: bad area");
+			portalareas[p->portalnum][0] = i;
+			portalareas[p->portalnum][1] = p->otherarea;
+		}
+	}
+}
+
+
+typedef struct
+{
+	char	*name;
+	int		lump;
+	void	(*load) (lump_t *l);
+	void	(*convert) (lump_t *l);
+	double	time;				// converting it, for cm_loadtimes
+} cmodlump_t;
+
+cmodlump_t	cmod_lumps[] =
+{
+	{"surfaces", LUMP_TEXINFO, CMod_LoadSurfaces, CMod_ConvertSurfaces},
+	{"leafs", LUMP_LEAFS, CMod_LoadLeafs, CMod_ConvertLeafs},
+	{"planes", LUMP_PLANES, CMod_LoadPlanes, CMod_ConvertPlanes},
+	{"brushes", LUMP_BRUSHES, CMod_LoadBrushes, CMod_ConvertBrushes},
+	{"brushsides", LUMP_BRUSHSIDES, CMod_LoadBrushSides, CMod_ConvertBrushSides},
+	{"leafbrushes", LUMP_LEAFBRUSHES, CMod_LoadLeafBrushes, CMod_ConvertLeafBrushes},
+	{"submodels", LUMP_MODELS, CMod_LoadSubmodels, CMod_ConvertSubmodels},
+	{"nodes", LUMP_NODES, CMod_LoadNodes, CMod_ConvertNodes},
+	{"areas", LUMP_AREAS, CMod_LoadAreas, CMod_ConvertAreas},
+	{"areaportals", LUMP_AREAPORTALS, CMod_LoadAreaPortals, CMod_ConvertAreaPortals},
+	{"visibility", LUMP_VISIBILITY, CMod_LoadVisibility, CMod_ConvertVisibility},
+	{"entities", LUMP_ENTITIES, CMod_LoadEntityString, CMod_ConvertEntityString}
+};
+
+#define	NUM_CMOD_LUMPS	(sizeof(cmod_lumps)/sizeof(cmod_lumps[0]))
+
+typedef struct
+{
+	dheader_t	*header;
+	int			order[NUM_CMOD_LUMPS];	// biggest first, so the workers finish together
+} cmodjobs_t;
+
+/*
+=================
+CMod_ConvertJob
+=================
+*/
+void CMod_ConvertJob (int index, void *data)
+{
+	cmodjobs_t	*jobs;
+	cmodlump_t	*cl;
+	double		start;
+
+	jobs = (cmodjobs_t *)data;
+	cl = &cmod_lumps[jobs->order[index]];
+
+	start = Sys_FloatTime ();
+	cl->convert (&jobs->header->lumps[cl->lump]);
+	cl->time = Sys_FloatTime () - start;
+}
+
+/*
+=================
+CMod_ConvertLumps
+
+Converts every lump on the worker threads
+=================
+*/
+void CMod_ConvertLumps (dheader_t *header)
+{
+	cmodjobs_t	jobs;
+	int			i, j, t;
+
+	jobs.header = header;
+	for (i=0 ; i<NUM_CMOD_LUMPS ; i++)
+	{
+		jobs.order[i] = i;
+		for (j=i ; j>0 ; j--)
+		{
+			if (header->lumps[cmod_lumps[jobs.order[j]].lump].filelen
+				<= header->lumps[cmod_lumps[jobs.order[j-1]].lump].filelen)
+				break;
+			t = jobs.order[j];
+			jobs.order[j] = jobs.order[j-1];
+			jobs.order[j-1] = t;
+		}
+	}
+
+	Com_ParallelJobs (NUM_CMOD_LUMPS, CMod_ConvertJob, &jobs);
+}
+
+
+
+/*
+==================
+CM_LoadMap
+
+Loads in the map and all submodels
+==================
+*/
+cmodel_t *CM_LoadMap (char *name, qboolean clientload, unsigned *checksum)
+{
+	unsigned		*buf;
+	int				i;
+	dheader_t		header;
+	lump_t			*l;
+	int				length;
+	static unsigned	last_checksum;
+	double			times[7];
+
+	map_noareas = Cvar_Get ("map_noareas", "0", 0);
+	cm_compiled = Cvar_Get ("cm_compiled", "1", 0);
+	cm_verify = Cvar_Get ("cm_verify", "0", 0);
+	cm_vismatrix = Cvar_Get ("cm_vismatrix", "8", 0);
+	cm_loadtimes = Cvar_Get ("cm_loadtimes", "0", 0);
+
+	if (  !strcmp (map_name, name) && (clientload || !Cvar_VariableValue ("flushmap")) )
+	{
+		*checksum = last_checksum;
+		if (!clientload)
+		{
+			memset (portalopen, 0, sizeof(portalopen));
+			FloodAreaConnections ();
+		}
+		return &map_cmodels[0];		// still have the right version
+	}
+
+	// free old stuff
+	CM_FreeVisMatrix ();
+	if (cmod_mapping)
+		FS_UnmapFile (cmod_mapping);
+	cmod_mapping = NULL;
+	cmod_viewed = qFalse;
+	map_visibility = map_visibilitybuf;
+	map_vis = (dvis_t *)map_visibility;
+	numplanes = 0;
+	numnodes = 0;
+	numleafs = 0;
+	numcmodels = 0;
+	numvisibility = 0;
+	numentitychars = 0;
+	map_entitystring[0] = 0;
+	map_name[0] = 0;
+
+	if (!name || !name[0])
 	{
 		numleafs = 1;
 		numclusters = 1;
@@ -588,9 +948,10 @@ cmodel_t *CM_LoadMap (char *name, qboolean clientload, unsigned *checksum)
 	//
 	// load the file
 	//
-	length = FS_LoadFile (name, (void **)&buf);
+	length = FS_MapFile (name, (void **)&buf);
 	if (!buf)
 		Com_Error (ERR_DROP, "Couldn't load %s", name);
+	cmod_mapping = (byte *)buf;
 
 	last_checksum = LittleLong (Com_BlockChecksum (buf, length));
 	*checksum = last_checksum;
@@ -606,31 +967,137 @@ cmodel_t *CM_LoadMap (char *name, qboolean clientload, unsigned *checksum)
 	cmod_base = (byte *)buf;
 
 	// load into heap
-	CMod_LoadSurfaces (&header.lumps[LUMP_TEXINFO]);
-	CMod_LoadLeafs (&header.lumps[LUMP_LEAFS]);
-	CMod_LoadLeafBrushes (&header.lumps[LUMP_LEAFBRUSHES]);
-	CMod_LoadPlanes (&header.lumps[LUMP_PLANES]);
-	CMod_LoadBrushes (&header.lumps[LUMP_BRUSHES]);
-	CMod_LoadBrushSides (&header.lumps[LUMP_BRUSHSIDES]);
-	CMod_LoadSubmodels (&header.lumps[LUMP_MODELS]);
-	CMod_LoadNodes (&header.lumps[LUMP_NODES]);
-	CMod_LoadAreas (&header.lumps[LUMP_AREAS]);
-	CMod_LoadAreaPortals (&header.lumps[LUMP_AREAPORTALS]);
-	CMod_LoadVisibility (&header.lumps[LUMP_VISIBILITY]);
-	CMod_LoadEntityString (&header.lumps[LUMP_ENTITIES]);
-
-	FS_FreeFile (buf);
+	times[0] = Sys_FloatTime ();
+	for (i=0 ; i<NUM_CMOD_LUMPS ; i++)
+	{
+		l = &header.lumps[cmod_lumps[i].lump];
+		if (l->fileofs < 0 || l->filelen < 0 || l->fileofs + l->filelen > length)
+			Com_Error (ERR_DROP, "CM_LoadMap: %s has a bad %s lump", name, cmod_lumps[i].name);
+		cmod_lumps[i].load (l);
+	}
+	times[1] = Sys_FloatTime ();
+	CMod_ConvertLumps (&header);
+	times[2] = Sys_FloatTime ();
+	CMod_CheckLumps ();
+	CMod_SetBrushBounds ();
+	times[3] = Sys_FloatTime ();
+
+	if (!cmod_viewed)
+	{	// everything was copied out
+		FS_UnmapFile (cmod_mapping);
+		cmod_mapping = NULL;
+	}
 
 	CM_InitBoxHull ();
 
+	CM_CompileCollision ();
+	times[4] = Sys_FloatTime ();
+
+	CM_BuildVisMatrix ();
+	times[5] = Sys_FloatTime ();
+
 	memset (portalopen, 0, sizeof(portalopen));
 	FloodAreaConnections ();
+	times[6] = Sys_FloatTime ();
 
 	strcpy (map_name, name);
 
+	if (cm_loadtimes->value)
+	{
+		Com_Printf ("%s load times in ms:\n", name);
+		Com_Printf ("%6.2f checking lumps\n", (times[1] - times[0]) * 1000);
+		Com_Printf ("%6.2f converting lumps, made of\n", (times[2] - times[1]) * 1000);
+		for (i=0 ; i<NUM_CMOD_LUMPS ; i++)
+			Com_Printf ("       %6.2f %s\n", cmod_lumps[i].time * 1000, cmod_lumps[i].name);
+		Com_Printf ("%6.2f checks and bounds\n", (times[3] - times[2]) * 1000);
+		Com_Printf ("%6.2f compiling collision\n", (times[4] - times[3]) * 1000);
+		Com_Printf ("%6.2f vis matrix\n", (times[5] - times[4]) * 1000);
+		Com_Printf ("%6.2f area flood\n", (times[6] - times[5]) * 1000);
+		Com_Printf ("%6.2f total\n", (times[6] - times[0]) * 1000);
+	}
+
 	return &map_cmodels[0];
 }
 
+/*
+=================
+CM_CompileCollision
+
+Builds a second copy of the collision data laid out for tracing: nodes in
+depth first order with their planes stored inline, and the planes of each
+brush's sides copied next to each other with the surfaces in a parallel
+array.  The box hull is not compiled, it changes with every box.
+=================
+*/
+void CM_CompileCollision (void)
+{
+	int			i, j, n;
+	static int	stack[MAX_MAP_NODES];
+	int			sp, count;
+	int			child;
+	cnode_t		*in;
+	ccnode_t	*out;
+
+	for (i=0 ; i<numnodes ; i++)
+		map_nodeorder[i] = -1;
+
+	// number the nodes of each model's tree depth first, front side
+	// first, so a node's front child usually follows it in memory
+	count = 0;
+	for (i=0 ; i<numcmodels+1 ; i++)
+	{
+		// extra pass catches any nodes no model reaches
+		n = i < numcmodels ? map_cmodels[i].headnode : 0;
+		if (n < 0 || n >= numnodes)
+			continue;
+
+		sp = 0;
+		stack[sp++] = n;
+		while (sp)
+		{
+			n = stack[--sp];
+			if (map_nodeorder[n] != -1)
+				continue;
+			map_nodeorder[n] = count++;
+
+			for (j=1 ; j>=0 ; j--)
+			{
+				child = map_nodes[n].children[j];
+				if (child >= 0 && map_nodeorder[child] == -1)
+				{
+					// only a node reached twice is pushed twice, and
+					// each pop numbers one, so a tree never gets here
+					if (sp == MAX_MAP_NODES)
+						Com_Error (ERR_DROP, "CM_CompileCollision: node stack overflow");
+					stack[sp++] = child;
+				}
+			}
+		}
+	}
+	for (i=0 ; i<numnodes ; i++)
+	{
+		if (map_nodeorder[i] == -1)
+			map_nodeorder[i] = count++;
+	}
+
+	for (i=0, in=map_nodes ; i<numnodes ; i++, in++)
+	{
+		out = &map_cnodes[map_nodeorder[i]];
+		out->plane = *in->plane;
+		for (j=0 ; j<2 ; j++)
+		{
+			child = in->children[j];
+			out->children[j] = child < 0 ? child : map_nodeorder[child];
+		}
+	}
+
+	for (i=0 ; i<numbrushsides ; i++)
+	{
+		map_sideplanes[i] = *map_brushsides[i].plane;
+		map_sidesurfaces[i] = map_brushsides[i].surface;
+	}
+}
+
 /*
 ==================
 CM_InlineModel
@@ -693,6 +1160,34 @@ int			box_headnode;
 cbrush_t	*box_brush;
 cleaf_t		*box_leaf;
 
+/*
+===================
+CM_InitBoxPlanes
+
+The normals of the box hull planes never change, only the distances
+===================
+*/
+static void CM_InitBoxPlanes (cplane_t *planes)
+{
+	int			i;
+	cplane_t	*p;
+
+	for (i=0 ; i<6 ; i++)
+	{
+		p = &planes[i*2];
+		p->type = i>>1;
+		p->signbits = 0;
+		VectorClear (p->normal);
+		p->normal[i>>1] = 1;
+
+		p = &planes[i*2+1];
+		p->type = 3 + (i>>1);
+		p->signbits = 0;
+		VectorClear (p->normal);
+		p->normal[i>>1] = -1;
+	}
+}
+
 /*
 ===================
 CM_InitBoxHull
@@ -706,7 +1201,6 @@ void CM_InitBoxHull (void)
 	int			i;
 	int			side;
 	cnode_t		*c;
-	cplane_t	*p;
 	cbrushside_t	*s;
 
 	box_headnode = numnodes;
@@ -722,11 +1216,16 @@ void CM_InitBoxHull (void)
 	box_brush->numsides = 6;
 	box_brush->firstbrushside = numbrushsides;
 	box_brush->contents = CONTENTS_MONSTER;
+	// the box changes with every trace, so it is never skipped by bounds
+	VectorSet (box_brush->mins, -BOUNDS_HUGE, -BOUNDS_HUGE, -BOUNDS_HUGE);
+	VectorSet (box_brush->maxs, BOUNDS_HUGE, BOUNDS_HUGE, BOUNDS_HUGE);
 
 	box_leaf = &map_leafs[numleafs];
 	box_leaf->contents = CONTENTS_MONSTER;
 	box_leaf->firstleafbrush = numleafbrushes;
 	box_leaf->numleafbrushes = 1;
+	VectorCopy (box_brush->mins, box_leaf->mins);
+	VectorCopy (box_brush->maxs, box_leaf->maxs);
 
 	map_leafbrushes[numleafbrushes] = numbrushes;
 
@@ -747,20 +1246,102 @@ void CM_InitBoxHull (void)
 			c->children[side^1] = box_headnode+i + 1;
 		else
 			c->children[side^1] = -1 - numleafs;
+	}
 
-		// planes
-		p = &box_planes[i*2];
-		p->type = i>>1;
-		p->signbits = 0;
-		VectorClear (p->normal);
-		p->normal[i>>1] = 1;
+	// the shared copy is only a template, each context
+	// sets the distances in its own planes
+	CM_InitBoxPlanes (box_planes);
+}
 
-		p = &box_planes[i*2+1];
-		p->type = 3 + (i>>1);
-		p->signbits = 0;
-		VectorClear (p->normal);
-		p->normal[i>>1] = -1;
-	}	
+
+/*
+===============================================================================
+
+COLLISION CONTEXTS
+
+Everything a trace or a box leaf query writes to lives in a context, so
+traces can run on several threads at once as long as each thread uses
+its own.  The map itself is only read while tracing.
+
+===============================================================================
+*/
+
+// the box hull planes are private to each context, nodes and brush sides
+// of the shared box hull are redirected to them
+#define	CM_CONTEXTPLANE(ctx,p)	((p) >= box_planes ? (ctx)->box_planes + ((p) - box_planes) : (p))
+
+#ifdef _MSC_VER
+#define	CM_THREADLOCAL	__declspec(thread)
+#else
+#define	CM_THREADLOCAL	__thread
+#endif
+
+static CM_THREADLOCAL cmcontext_t	*cm_threadcontext;
+
+/*
+==================
+CM_AllocContext
+==================
+*/
+static cmcontext_t *CM_AllocContext (void)
+{
+	cmcontext_t	*ctx;
+
+	// not Z_Malloc, contexts are created from any thread and outlive levels
+	ctx = malloc (sizeof(*ctx));
+	if (!ctx)
+		Sys_Error ("CM_AllocContext: out of memory");
+	memset (ctx, 0, sizeof(*ctx));
+
+	CM_InitBoxPlanes (ctx->box_planes);
+
+	return ctx;
+}
+
+/*
+==================
+CM_Context
+
+Returns the calling thread's context, creating it on first use
+==================
+*/
+static cmcontext_t *CM_Context (void)
+{
+	if (!cm_threadcontext)
+		cm_threadcontext = CM_AllocContext ();
+	return cm_threadcontext;
+}
+
+/*
+==================
+CM_FreeThreadContext
+
+Worker threads that traced should call this before they exit
+==================
+*/
+void CM_FreeThreadContext (void)
+{
+	if (!cm_threadcontext)
+		return;
+	free (cm_threadcontext);
+	cm_threadcontext = NULL;
+}
+
+/*
+==================
+CM_NewCheck
+
+Starts a new visited set for the brushes of a trace
+==================
+*/
+static void CM_NewCheck (cmcontext_t *ctx)
+{
+	ctx->checkcount++;
+	if (ctx->checkcount <= 0)
+	{	// wrapped around, old stamps could collide with new ones
+		memset (ctx->brushchecks, 0, sizeof(ctx->brushchecks));
+		ctx->checkcount = 1;
+	}
 }
 
 
@@ -774,18 +1355,22 @@ BSP trees instead of being compared directly.
 */
 int	CM_HeadnodeForBox (vec3_t mins, vec3_t maxs)
 {
-	box_planes[0].dist = maxs[0];
-	box_planes[1].dist = -maxs[0];
-	box_planes[2].dist = mins[0];
-	box_planes[3].dist = -mins[0];
-	box_planes[4].dist = maxs[1];
-	box_planes[5].dist = -maxs[1];
-	box_planes[6].dist = mins[1];
-	box_planes[7].dist = -mins[1];
-	box_planes[8].dist = maxs[2];
-	box_planes[9].dist = -maxs[2];
-	box_planes[10].dist = mins[2];
-	box_planes[11].dist = -mins[2];
+	cplane_t	*planes;
+
+	planes = CM_Context()->box_planes;
+
+	planes[0].dist = maxs[0];
+	planes[1].dist = -maxs[0];
+	planes[2].dist = mins[0];
+	planes[3].dist = -mins[0];
+	planes[4].dist = maxs[1];
+	planes[5].dist = -maxs[1];
+	planes[6].dist = mins[1];
+	planes[7].dist = -mins[1];
+	planes[8].dist = maxs[2];
+	planes[9].dist = -maxs[2];
+	planes[10].dist = mins[2];
+	planes[11].dist = -mins[2];
 
 	return box_headnode;
 }
@@ -797,7 +1382,7 @@ CM_PointLeafnum_r
 
 ==================
 */
-int CM_PointLeafnum_r (vec3_t p, int num)
+static int CM_PointLeafnum_r (cmcontext_t *ctx, vec3_t p, int num)
 {
 	float		d;
 	cnode_t		*node;
@@ -806,7 +1391,7 @@ int CM_PointLeafnum_r (vec3_t p, int num)
 	while (num >= 0)
 	{
 		node = map_nodes + num;
-		plane = node->plane;
+		plane = CM_CONTEXTPLANE(ctx, node->plane);
 		
 		if (plane->type < 3)
 			d = p[plane->type] - plane->dist;
@@ -827,7 +1412,7 @@ int CM_PointLeafnum (vec3_t p)
 {
 	if (!numplanes)
 		return 0;		// sound may call this without map loaded
-	return CM_PointLeafnum_r (p, 0);
+	return CM_PointLeafnum_r (CM_Context(), p, 0);
 }
 
 
@@ -839,12 +1424,7 @@ CM_BoxLeafnums
 Fills in a list of all the leafs touched
 =============
 */
-int		leaf_count, leaf_maxcount;
-int		*leaf_list;
-float	*leaf_mins, *leaf_maxs;
-int		leaf_topnode;
-
-void CM_BoxLeafnums_r (int nodenum)
+static void CM_BoxLeafnums_r (cmcontext_t *ctx, int nodenum)
 {
 	cplane_t	*plane;
 	cnode_t		*node;
@@ -854,55 +1434,55 @@ void CM_BoxLeafnums_r (int nodenum)
 	{
 		if (nodenum < 0)
 		{
-			if (leaf_count >= leaf_maxcount)
+			if (ctx->leaf_count >= ctx->leaf_maxcount)
 			{
 //				Com_Printf ("CM_BoxLeafnums_r: overflow\n");
 				return;
 			}
-			leaf_list[leaf_count++] = -1 - nodenum;
+			ctx->leaf_list[ctx->leaf_count++] = -1 - nodenum;
 			return;
 		}
 	
 		node = &map_nodes[nodenum];
-		plane = node->plane;
-//		s = BoxOnPlaneSide (leaf_mins, leaf_maxs, plane);
-		s = BOX_ON_PLANE_SIDE(leaf_mins, leaf_maxs, plane);
+		plane = CM_CONTEXTPLANE(ctx, node->plane);
+//		s = BoxOnPlaneSide (ctx->leaf_mins, ctx->leaf_maxs, plane);
+		s = BOX_ON_PLANE_SIDE(ctx->leaf_mins, ctx->leaf_maxs, plane);
 		if (s == 1)
 			nodenum = node->children[0];
 		else if (s == 2)
 			nodenum = node->children[1];
 		else
 		{	// go down both
-			if (leaf_topnode == -1)
-				leaf_topnode = nodenum;
-			CM_BoxLeafnums_r (node->children[0]);
+			if (ctx->leaf_topnode == -1)
+				ctx->leaf_topnode = nodenum;
+			CM_BoxLeafnums_r (ctx, node->children[0]);
 			nodenum = node->children[1];
 		}
 
 	}
 }
 
-int	CM_BoxLeafnums_headnode (vec3_t mins, vec3_t maxs, int *list, int listsize, int headnode, int *topnode)
+static int	CM_BoxLeafnums_headnode (cmcontext_t *ctx, vec3_t mins, vec3_t maxs, int *list, int listsize, int headnode, int *topnode)
 {
-	leaf_list = list;
-	leaf_count = 0;
-	leaf_maxcount = listsize;
-	leaf_mins = mins;
-	leaf_maxs = maxs;
+	ctx->leaf_list = list;
+	ctx->leaf_count = 0;
+	ctx->leaf_maxcount = listsize;
+	ctx->leaf_mins = mins;
+	ctx->leaf_maxs = maxs;
 
-	leaf_topnode = -1;
+	ctx->leaf_topnode = -1;
 
-	CM_BoxLeafnums_r (headnode);
+	CM_BoxLeafnums_r (ctx, headnode);
 
 	if (topnode)
-		*topnode = leaf_topnode;
+		*topnode = ctx->leaf_topnode;
 
-	return leaf_count;
+	return ctx->leaf_count;
 }
 
 int	CM_BoxLeafnums (vec3_t mins, vec3_t maxs, int *list, int listsize, int *topnode)
 {
-	return CM_BoxLeafnums_headnode (mins, maxs, list,
+	return CM_BoxLeafnums_headnode (CM_Context(), mins, maxs, list,
 		listsize, map_cmodels[0].headnode, topnode);
 }
 
@@ -921,7 +1501,7 @@ int CM_PointContents (vec3_t p, int headnode)
 	if (!numnodes)	// map not loaded
 		return 0;
 
-	l = CM_PointLeafnum_r (p, headnode);
+	l = CM_PointLeafnum_r (CM_Context(), p, headnode);
 
 	return map_leafs[l].contents;
 }
@@ -956,7 +1536,58 @@ int	CM_TransformedPointContents (vec3_t p, int headnode, vec3_t origin, vec3_t a
 		p_l[2] = DotProduct (temp, up);
 	}
 
-	l = CM_PointLeafnum_r (p_l, headnode);
+	l = CM_PointLeafnum_r (CM_Context(), p_l, headnode);
+
+	return map_leafs[l].contents;
+}
+
+/*
+==================
+CM_SetTransform
+
+Works out the axes CM_TransformedBoxTrace and CM_TransformedPointContents
+would for origin and angles
+==================
+*/
+void	CM_SetTransform (cmtransform_t *xf, vec3_t origin, vec3_t angles)
+{
+	vec3_t		a;
+
+	VectorCopy (origin, xf->origin);
+	VectorCopy (angles, xf->angles);
+
+	AngleVectors (angles, xf->forward, xf->right, xf->up);
+	VectorNegate (angles, a);
+	AngleVectors (a, xf->iforward, xf->iright, xf->iup);
+}
+
+/*
+==================
+CM_TransformedPointContentsCached
+
+CM_TransformedPointContents with the axes from CM_SetTransform
+==================
+*/
+int	CM_TransformedPointContentsCached (vec3_t p, int headnode, cmtransform_t *xf)
+{
+	vec3_t		p_l;
+	vec3_t		temp;
+	int			l;
+
+	// subtract origin offset
+	VectorSubtract (p, xf->origin, p_l);
+
+	// rotate start and end into the models frame of reference
+	if (headnode != box_headnode && 
+	(xf->angles[0] || xf->angles[1] || xf->angles[2]) )
+	{
+		VectorCopy (p_l, temp);
+		p_l[0] = DotProduct (temp, xf->forward);
+		p_l[1] = -DotProduct (temp, xf->right);
+		p_l[2] = DotProduct (temp, xf->up);
+	}
+
+	l = CM_PointLeafnum_r (CM_Context(), p_l, headnode);
 
 	return map_leafs[l].contents;
 }
@@ -973,25 +1604,37 @@ BOX TRACING
 // 1/32 epsilon to keep floating point happy
 #define	DIST_EPSILON	(0.03125)
 
-vec3_t	trace_start, trace_end;
-vec3_t	trace_mins, trace_maxs;
-vec3_t	trace_extents;
-
-trace_t	trace_trace;
-int		trace_contents;
-qboolean	trace_ispoint;		// optimized case
-
 /*
 ================
-CM_ClipBoxToBrush
+CM_SweepOutsideBounds
+
+True if the sweep of the current trace can't touch anything inside the bounds
 ================
 */
-void CM_ClipBoxToBrush (vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2,
-					  trace_t *trace, cbrush_t *brush)
+static qboolean CM_SweepOutsideBounds (cmcontext_t *ctx, vec3_t mins, vec3_t maxs)
 {
-	int			i, j;
-	cplane_t	*plane, *clipplane;
-	float		dist;
+	int		i;
+
+	for (i=0 ; i<3 ; i++)
+	{
+		if (ctx->absmins[i] > maxs[i] + BOUNDS_EPSILON
+			|| ctx->absmaxs[i] < mins[i] - BOUNDS_EPSILON)
+			return qTrue;
+	}
+	return qFalse;
+}
+
+/*
+================
+CM_ClipBoxToBrush
+================
+*/
+static void CM_ClipBoxToBrush (cmcontext_t *ctx, vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2,
+					  trace_t *trace, cbrush_t *brush)
+{
+	int			i, j;
+	cplane_t	*plane, *clipplane;
+	float		dist;
 	float		enterfrac, leavefrac;
 	vec3_t		ofs;
 	float		d1, d2;
@@ -1015,11 +1658,11 @@ void CM_ClipBoxToBrush (vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2,
 	for (i=0 ; i<brush->numsides ; i++)
 	{
 		side = &map_brushsides[brush->firstbrushside+i];
-		plane = side->plane;
+		plane = CM_CONTEXTPLANE(ctx, side->plane);
 
 		// FIXME: special case for axial
 
-		if (!trace_ispoint)
+		if (!ctx->ispoint)
 		{	// general box case
 
 			// push the plane out apropriately for mins/maxs
@@ -1100,7 +1743,7 @@ void CM_ClipBoxToBrush (vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2,
 CM_TestBoxInBrush
 ================
 */
-void CM_TestBoxInBrush (vec3_t mins, vec3_t maxs, vec3_t p1,
+static void CM_TestBoxInBrush (cmcontext_t *ctx, vec3_t mins, vec3_t maxs, vec3_t p1,
 					  trace_t *trace, cbrush_t *brush)
 {
 	int			i, j;
@@ -1116,7 +1759,7 @@ void CM_TestBoxInBrush (vec3_t mins, vec3_t maxs, vec3_t p1,
 	for (i=0 ; i<brush->numsides ; i++)
 	{
 		side = &map_brushsides[brush->firstbrushside+i];
-		plane = side->plane;
+		plane = CM_CONTEXTPLANE(ctx, side->plane);
 
 		// FIXME: special case for axial
 
@@ -1150,12 +1793,143 @@ void CM_TestBoxInBrush (vec3_t mins, vec3_t maxs, vec3_t p1,
 }
 
 
+/*
+================
+CM_ClipBoxToCompiledBrush
+
+Same as CM_ClipBoxToBrush, reading the planes from the compiled layout
+and pushing them out by the box corner picked with their signbits
+================
+*/
+static void CM_ClipBoxToCompiledBrush (cmcontext_t *ctx, vec3_t p1, vec3_t p2,
+					  trace_t *trace, cbrush_t *brush)
+{
+	int			i;
+	cplane_t	*plane, *clipplane;
+	float		dist;
+	float		enterfrac, leavefrac;
+	float		d1, d2;
+	qboolean	getout, startout;
+	float		f;
+	int			leadside;
+
+	enterfrac = -1;
+	leavefrac = 1;
+	clipplane = NULL;
+
+	if (!brush->numsides)
+		return;
+
+	c_brush_traces++;
+
+	getout = qFalse;
+	startout = qFalse;
+	leadside = 0;
+
+	plane = &map_sideplanes[brush->firstbrushside];
+	for (i=0 ; i<brush->numsides ; i++, plane++)
+	{
+		if (!ctx->ispoint)
+			dist = plane->dist - DotProduct (ctx->corners[plane->signbits], plane->normal);
+		else
+			dist = plane->dist;
+
+		d1 = DotProduct (p1, plane->normal) - dist;
+		d2 = DotProduct (p2, plane->normal) - dist;
+
+		if (d2 > 0)
+			getout = qTrue;	// endpoint is not in solid
+		if (d1 > 0)
+			startout = qTrue;
+
+		// if completely in front of face, no intersection
+		if (d1 > 0 && d2 >= d1)
+			return;
+
+		if (d1 <= 0 && d2 <= 0)
+			continue;
+
+		// crosses face
+		if (d1 > d2)
+		{	// enter
+			f = (d1-DIST_EPSILON) / (d1-d2);
+			if (f > enterfrac)
+			{
+				enterfrac = f;
+				clipplane = plane;
+				leadside = brush->firstbrushside + i;
+			}
+		}
+		else
+		{	// leave
+			f = (d1+DIST_EPSILON) / (d1-d2);
+			if (f < leavefrac)
+				leavefrac = f;
+		}
+	}
+
+	if (!startout)
+	{	// original point was inside brush
+		trace->startsolid = qTrue;
+		if (!getout)
+			trace->allsolid = qTrue;
+		return;
+	}
+	if (enterfrac < leavefrac)
+	{
+		if (enterfrac > -1 && enterfrac < trace->fraction)
+		{
+			if (enterfrac < 0)
+				enterfrac = 0;
+			trace->fraction = enterfrac;
+			trace->plane = *clipplane;
+			trace->surface = &(map_sidesurfaces[leadside]->c);
+			trace->contents = brush->contents;
+		}
+	}
+}
+
+/*
+================
+CM_TestBoxInCompiledBrush
+================
+*/
+static void CM_TestBoxInCompiledBrush (cmcontext_t *ctx, vec3_t p1,
+					  trace_t *trace, cbrush_t *brush)
+{
+	int			i;
+	cplane_t	*plane;
+	float		dist;
+	float		d1;
+
+	if (!brush->numsides)
+		return;
+
+	plane = &map_sideplanes[brush->firstbrushside];
+	for (i=0 ; i<brush->numsides ; i++, plane++)
+	{
+		dist = plane->dist - DotProduct (ctx->corners[plane->signbits], plane->normal);
+
+		d1 = DotProduct (p1, plane->normal) - dist;
+
+		// if completely in front of face, no intersection
+		if (d1 > 0)
+			return;
+	}
+
+	// inside this brush
+	trace->startsolid = trace->allsolid = qTrue;
+	trace->fraction = 0;
+	trace->contents = brush->contents;
+}
+
+
 /*
 ================
 CM_TraceToLeaf
 ================
 */
-void CM_TraceToLeaf (int leafnum)
+static void CM_TraceToLeaf (cmcontext_t *ctx, int leafnum)
 {
 	int			k;
 	int			brushnum;
@@ -1163,21 +1937,28 @@ void CM_TraceToLeaf (int leafnum)
 	cbrush_t	*b;
 
 	leaf = &map_leafs[leafnum];
-	if ( !(leaf->contents & trace_contents))
+	if ( !(leaf->contents & ctx->contents))
+		return;
+	if (CM_SweepOutsideBounds (ctx, leaf->mins, leaf->maxs))
 		return;
 	// trace line against all brushes in the leaf
 	for (k=0 ; k<leaf->numleafbrushes ; k++)
 	{
 		brushnum = map_leafbrushes[leaf->firstleafbrush+k];
-		b = &map_brushes[brushnum];
-		if (b->checkcount == checkcount)
+		if (ctx->brushchecks[brushnum] == ctx->checkcount)
 			continue;	// already checked this brush in another leaf
-		b->checkcount = checkcount;
+		ctx->brushchecks[brushnum] = ctx->checkcount;
 
-		if ( !(b->contents & trace_contents))
+		b = &map_brushes[brushnum];
+		if ( !(b->contents & ctx->contents))
 			continue;
-		CM_ClipBoxToBrush (trace_mins, trace_maxs, trace_start, trace_end, &trace_trace, b);
-		if (!trace_trace.fraction)
+		if (CM_SweepOutsideBounds (ctx, b->mins, b->maxs))
+			continue;
+		if (ctx->compiled && b != box_brush)
+			CM_ClipBoxToCompiledBrush (ctx, ctx->start, ctx->end, &ctx->trace, b);
+		else
+			CM_ClipBoxToBrush (ctx, ctx->mins, ctx->maxs, ctx->start, ctx->end, &ctx->trace, b);
+		if (!ctx->trace.fraction)
 			return;
 	}
 
@@ -1189,7 +1970,7 @@ void CM_TraceToLeaf (int leafnum)
 CM_TestInLeaf
 ================
 */
-void CM_TestInLeaf (int leafnum)
+static void CM_TestInLeaf (cmcontext_t *ctx, int leafnum)
 {
 	int			k;
 	int			brushnum;
@@ -1197,21 +1978,28 @@ void CM_TestInLeaf (int leafnum)
 	cbrush_t	*b;
 
 	leaf = &map_leafs[leafnum];
-	if ( !(leaf->contents & trace_contents))
+	if ( !(leaf->contents & ctx->contents))
+		return;
+	if (CM_SweepOutsideBounds (ctx, leaf->mins, leaf->maxs))
 		return;
 	// trace line against all brushes in the leaf
 	for (k=0 ; k<leaf->numleafbrushes ; k++)
 	{
 		brushnum = map_leafbrushes[leaf->firstleafbrush+k];
-		b = &map_brushes[brushnum];
-		if (b->checkcount == checkcount)
+		if (ctx->brushchecks[brushnum] == ctx->checkcount)
 			continue;	// already checked this brush in another leaf
-		b->checkcount = checkcount;
+		ctx->brushchecks[brushnum] = ctx->checkcount;
 
-		if ( !(b->contents & trace_contents))
+		b = &map_brushes[brushnum];
+		if ( !(b->contents & ctx->contents))
+			continue;
+		if (CM_SweepOutsideBounds (ctx, b->mins, b->maxs))
 			continue;
-		CM_TestBoxInBrush (trace_mins, trace_maxs, trace_start, &trace_trace, b);
-		if (!trace_trace.fraction)
+		if (ctx->compiled && b != box_brush)
+			CM_TestBoxInCompiledBrush (ctx, ctx->start, &ctx->trace, b);
+		else
+			CM_TestBoxInBrush (ctx, ctx->mins, ctx->maxs, ctx->start, &ctx->trace, b);
+		if (!ctx->trace.fraction)
 			return;
 	}
 
@@ -1224,10 +2012,11 @@ CM_RecursiveHullCheck
 
 ==================
 */
-void CM_RecursiveHullCheck (int num, float p1f, float p2f, vec3_t p1, vec3_t p2)
+static void CM_RecursiveHullCheck (cmcontext_t *ctx, int num, float p1f, float p2f, vec3_t p1, vec3_t p2)
 {
 	cnode_t		*node;
 	cplane_t	*plane;
+	int			*children;
 	float		t1, t2, offset;
 	float		frac, frac2;
 	float		idist;
@@ -1236,13 +2025,13 @@ void CM_RecursiveHullCheck (int num, float p1f, float p2f, vec3_t p1, vec3_t p2)
 	int			side;
 	float		midf;
 
-	if (trace_trace.fraction <= p1f)
+	if (ctx->trace.fraction <= p1f)
 		return;		// already hit something nearer
 
 	// if < 0, we are in a leaf node
 	if (num < 0)
 	{
-		CM_TraceToLeaf (-1-num);
+		CM_TraceToLeaf (ctx, -1-num);
 		return;
 	}
 
@@ -1250,43 +2039,54 @@ void CM_RecursiveHullCheck (int num, float p1f, float p2f, vec3_t p1, vec3_t p2)
 	// find the point distances to the seperating plane
 	// and the offset for the size of the box
 	//
-	node = map_nodes + num;
-	plane = node->plane;
+	// in the compiled layout num is a compiled node number, the box hull
+	// nodes come after the compiled ones with the same numbers in both
+	if (ctx->compiled && num < box_headnode)
+	{
+		plane = &map_cnodes[num].plane;
+		children = map_cnodes[num].children;
+	}
+	else
+	{
+		node = map_nodes + num;
+		plane = CM_CONTEXTPLANE(ctx, node->plane);
+		children = node->children;
+	}
 
 	if (plane->type < 3)
 	{
 		t1 = p1[plane->type] - plane->dist;
 		t2 = p2[plane->type] - plane->dist;
-		offset = trace_extents[plane->type];
+		offset = ctx->extents[plane->type];
 	}
 	else
 	{
 		t1 = DotProduct (plane->normal, p1) - plane->dist;
 		t2 = DotProduct (plane->normal, p2) - plane->dist;
-		if (trace_ispoint)
+		if (ctx->ispoint)
 			offset = 0;
 		else
-			offset = fabs(trace_extents[0]*plane->normal[0]) +
-				fabs(trace_extents[1]*plane->normal[1]) +
-				fabs(trace_extents[2]*plane->normal[2]);
+			offset = fabs(ctx->extents[0]*plane->normal[0]) +
+				fabs(ctx->extents[1]*plane->normal[1]) +
+				fabs(ctx->extents[2]*plane->normal[2]);
 	}
 
 
 #if 0
-CM_RecursiveHullCheck (node->children[0], p1f, p2f, p1, p2);
-CM_RecursiveHullCheck (node->children[1], p1f, p2f, p1, p2);
+CM_RecursiveHullCheck (ctx, children[0], p1f, p2f, p1, p2);
+CM_RecursiveHullCheck (ctx, children[1], p1f, p2f, p1, p2);
 return;
 #endif
 
 	// see which sides we need to consider
 	if (t1 >= offset && t2 >= offset)
 	{
-		CM_RecursiveHullCheck (node->children[0], p1f, p2f, p1, p2);
+		CM_RecursiveHullCheck (ctx, children[0], p1f, p2f, p1, p2);
 		return;
 	}
 	if (t1 < -offset && t2 < -offset)
 	{
-		CM_RecursiveHullCheck (node->children[1], p1f, p2f, p1, p2);
+		CM_RecursiveHullCheck (ctx, children[1], p1f, p2f, p1, p2);
 		return;
 	}
 
@@ -1322,7 +2122,7 @@ return;
 	for (i=0 ; i<3 ; i++)
 		mid[i] = p1[i] + frac*(p2[i] - p1[i]);
 
-	CM_RecursiveHullCheck (node->children[side], p1f, midf, p1, mid);
+	CM_RecursiveHullCheck (ctx, children[side], p1f, midf, p1, mid);
 
 
 	// go past the node
@@ -1335,7 +2135,7 @@ return;
 	for (i=0 ; i<3 ; i++)
 		mid[i] = p1[i] + frac2*(p2[i] - p1[i]);
 
-	CM_RecursiveHullCheck (node->children[side^1], midf, p2f, mid, p2);
+	CM_RecursiveHullCheck (ctx, children[side^1], midf, p2f, mid, p2);
 }
 
 
@@ -1344,32 +2144,112 @@ return;
 
 /*
 ==================
-CM_BoxTrace
+CM_InitBoxTrace
+
+Sets up the context for a new trace with a default result
 ==================
 */
-trace_t		CM_BoxTrace (vec3_t start, vec3_t end,
-						  vec3_t mins, vec3_t maxs,
-						  int headnode, int brushmask)
+static void CM_InitBoxTrace (cmcontext_t *ctx, vec3_t start, vec3_t end,
+						  vec3_t mins, vec3_t maxs, int brushmask)
 {
-	int		i;
+	int		i, j;
 
-	checkcount++;		// for multi-check avoidance
+	CM_NewCheck (ctx);	// for multi-check avoidance
 
 	c_traces++;			// for statistics, may be zeroed
 
 	// fill in a default trace
-	memset (&trace_trace, 0, sizeof(trace_trace));
-	trace_trace.fraction = 1;
-	trace_trace.surface = &(nullsurface.c);
+	memset (&ctx->trace, 0, sizeof(ctx->trace));
+	ctx->trace.fraction = 1;
+	ctx->trace.surface = &(nullsurface.c);
 
-	if (!numnodes)	// map not loaded
-		return trace_trace;
+	ctx->contents = brushmask;
+	VectorCopy (start, ctx->start);
+	VectorCopy (end, ctx->end);
+	VectorCopy (mins, ctx->mins);
+	VectorCopy (maxs, ctx->maxs);
+
+	//
+	// check for point special case
+	//
+	if (mins[0] == 0 && mins[1] == 0 && mins[2] == 0
+		&& maxs[0] == 0 && maxs[1] == 0 && maxs[2] == 0)
+	{
+		ctx->ispoint = qTrue;
+		VectorClear (ctx->extents);
+	}
+	else
+	{
+		ctx->ispoint = qFalse;
+		ctx->extents[0] = -mins[0] > maxs[0] ? -mins[0] : maxs[0];
+		ctx->extents[1] = -mins[1] > maxs[1] ? -mins[1] : maxs[1];
+		ctx->extents[2] = -mins[2] > maxs[2] ? -mins[2] : maxs[2];
+	}
+
+	for (i=0 ; i<3 ; i++)
+	{
+		if (start[i] < end[i])
+		{
+			ctx->absmins[i] = start[i] + mins[i];
+			ctx->absmaxs[i] = end[i] + maxs[i];
+		}
+		else
+		{
+			ctx->absmins[i] = end[i] + mins[i];
+			ctx->absmaxs[i] = start[i] + maxs[i];
+		}
+	}
+
+	if (ctx->compiled)
+	{
+		for (i=0 ; i<8 ; i++)
+		{
+			for (j=0 ; j<3 ; j++)
+				ctx->corners[i][j] = (i & (1<<j)) ? maxs[j] : mins[j];
+		}
+	}
+}
+
+/*
+==================
+CM_SweepBoxTrace
+
+Sweeps the box set up by CM_InitBoxTrace through the tree from num
+==================
+*/
+static void CM_SweepBoxTrace (cmcontext_t *ctx, int num, vec3_t start, vec3_t end)
+{
+	int		i;
+
+	if (ctx->compiled && num >= 0 && num < numnodes)
+		num = map_nodeorder[num];
 
-	trace_contents = brushmask;
-	VectorCopy (start, trace_start);
-	VectorCopy (end, trace_end);
-	VectorCopy (mins, trace_mins);
-	VectorCopy (maxs, trace_maxs);
+	CM_RecursiveHullCheck (ctx, num, 0, 1, start, end);
+
+	if (ctx->trace.fraction == 1)
+	{
+		VectorCopy (end, ctx->trace.endpos);
+	}
+	else
+	{
+		for (i=0 ; i<3 ; i++)
+			ctx->trace.endpos[i] = start[i] + ctx->trace.fraction * (end[i] - start[i]);
+	}
+}
+
+/*
+==================
+CM_ContextBoxTrace
+==================
+*/
+static trace_t	CM_ContextBoxTrace (cmcontext_t *ctx, vec3_t start, vec3_t end,
+						  vec3_t mins, vec3_t maxs,
+						  int headnode, int brushmask)
+{
+	CM_InitBoxTrace (ctx, start, end, mins, maxs, brushmask);
+
+	if (!numnodes)	// map not loaded
+		return ctx->trace;
 
 	//
 	// check for position test special case
@@ -1389,49 +2269,72 @@ trace_t		CM_BoxTrace (vec3_t start, vec3_t end,
 			c2[i] += 1;
 		}
 
-		numleafs = CM_BoxLeafnums_headnode (c1, c2, leafs, 1024, headnode, &topnode);
+		numleafs = CM_BoxLeafnums_headnode (ctx, c1, c2, leafs, 1024, headnode, &topnode);
 		for (i=0 ; i<numleafs ; i++)
 		{
-			CM_TestInLeaf (leafs[i]);
-			if (trace_trace.allsolid)
+			CM_TestInLeaf (ctx, leafs[i]);
+			if (ctx->trace.allsolid)
 				break;
 		}
-		VectorCopy (start, trace_trace.endpos);
-		return trace_trace;
-	}
-
-	//
-	// check for point special case
-	//
-	if (mins[0] == 0 && mins[1] == 0 && mins[2] == 0
-		&& maxs[0] == 0 && maxs[1] == 0 && maxs[2] == 0)
-	{
-		trace_ispoint = qTrue;
-		VectorClear (trace_extents);
-	}
-	else
-	{
-		trace_ispoint = qFalse;
-		trace_extents[0] = -mins[0] > maxs[0] ? -mins[0] : maxs[0];
-		trace_extents[1] = -mins[1] > maxs[1] ? -mins[1] : maxs[1];
-		trace_extents[2] = -mins[2] > maxs[2] ? -mins[2] : maxs[2];
+		VectorCopy (start, ctx->trace.endpos);
+		return ctx->trace;
 	}
 
 	//
 	// general sweeping through world
 	//
-	CM_RecursiveHullCheck (headnode, 0, 1, start, end);
+	CM_SweepBoxTrace (ctx, headnode, start, end);
 
-	if (trace_trace.fraction == 1)
-	{
-		VectorCopy (end, trace_trace.endpos);
-	}
-	else
-	{
-		for (i=0 ; i<3 ; i++)
-			trace_trace.endpos[i] = start[i] + trace_trace.fraction * (end[i] - start[i]);
+	return ctx->trace;
+}
+
+/*
+==================
+CM_TracesDiffer
+
+Field by field, the padding in a trace_t is never written
+==================
+*/
+static qboolean CM_TracesDiffer (trace_t *a, trace_t *b)
+{
+	return a->allsolid != b->allsolid
+		|| a->startsolid != b->startsolid
+		|| a->fraction != b->fraction
+		|| !VectorCompare (a->endpos, b->endpos)
+		|| !VectorCompare (a->plane.normal, b->plane.normal)
+		|| a->plane.dist != b->plane.dist
+		|| a->surface != b->surface
+		|| a->contents != b->contents
+		|| a->ent != b->ent;
+}
+
+/*
+==================
+CM_BoxTrace
+==================
+*/
+trace_t		CM_BoxTrace (vec3_t start, vec3_t end,
+						  vec3_t mins, vec3_t maxs,
+						  int headnode, int brushmask)
+{
+	cmcontext_t	*ctx;
+	trace_t		trace, check;
+
+	ctx = CM_Context ();
+	ctx->compiled = cm_compiled && cm_compiled->value;
+
+	trace = CM_ContextBoxTrace (ctx, start, end, mins, maxs, headnode, brushmask);
+
+	if (cm_verify && cm_verify->value)
+	{	// trace again with the other layout, they must match bit for bit
+		ctx->compiled = !ctx->compiled;
+		check = CM_ContextBoxTrace (ctx, start, end, mins, maxs, headnode, brushmask);
+		if (CM_TracesDiffer (&trace, &check))
+			Com_Printf ("CM_BoxTrace: layouts differ, fraction %f / %f (%s)\n",
+				trace.fraction, check.fraction, map_name);
 	}
-	return trace_trace;
+
+	return trace;
 }
 
 
@@ -1508,12 +2411,71 @@ trace_t		CM_TransformedBoxTrace (vec3_t start, vec3_t end,
 	return trace;
 }
 
-#ifdef _WIN32
-#pragma optimize( "", on )
-#endif
-
-
-
+/*
+==================
+CM_TransformedBoxTraceCached
+
+CM_TransformedBoxTrace with the axes from CM_SetTransform
+==================
+*/
+trace_t		CM_TransformedBoxTraceCached (vec3_t start, vec3_t end,
+						  vec3_t mins, vec3_t maxs,
+						  int headnode, int brushmask,
+						  cmtransform_t *xf)
+{
+	trace_t		trace;
+	vec3_t		start_l, end_l;
+	vec3_t		temp;
+	qboolean	rotated;
+
+	// subtract origin offset
+	VectorSubtract (start, xf->origin, start_l);
+	VectorSubtract (end, xf->origin, end_l);
+
+	// rotate start and end into the models frame of reference
+	if (headnode != box_headnode && 
+	(xf->angles[0] || xf->angles[1] || xf->angles[2]) )
+		rotated = qTrue;
+	else
+		rotated = qFalse;
+
+	if (rotated)
+	{
+		VectorCopy (start_l, temp);
+		start_l[0] = DotProduct (temp, xf->forward);
+		start_l[1] = -DotProduct (temp, xf->right);
+		start_l[2] = DotProduct (temp, xf->up);
+
+		VectorCopy (end_l, temp);
+		end_l[0] = DotProduct (temp, xf->forward);
+		end_l[1] = -DotProduct (temp, xf->right);
+		end_l[2] = DotProduct (temp, xf->up);
+	}
+
+	// sweep the box through the model
+	trace = CM_BoxTrace (start_l, end_l, mins, maxs, headnode, brushmask);
+
+	if (rotated && trace.fraction != 1.0)
+	{
+		VectorCopy (trace.plane.normal, temp);
+		trace.plane.normal[0] = DotProduct (temp, xf->iforward);
+		trace.plane.normal[1] = -DotProduct (temp, xf->iright);
+		trace.plane.normal[2] = DotProduct (temp, xf->iup);
+	}
+
+	trace.endpos[0] = start[0] + trace.fraction * (end[0] - start[0]);
+	trace.endpos[1] = start[1] + trace.fraction * (end[1] - start[1]);
+	trace.endpos[2] = start[2] + trace.fraction * (end[2] - start[2]);
+
+	return trace;
+}
+
+#ifdef _WIN32
+#pragma optimize( "", on )
+#endif
+
+
+
 /*
 ===============================================================================
 
@@ -1569,25 +2531,138 @@ void CM_DecompressVis (byte *in, byte *out)
 	} while (out_p - out < row);
 }
 
-byte	pvsrow[MAX_MAP_LEAFS/8];
-byte	phsrow[MAX_MAP_LEAFS/8];
+// rows handed out by CM_ClusterPVS / CM_ClusterPHS are padded to this,
+// so callers can work on them a whole vector at a time
+#define	VIS_ROWALIGN	32
+
+byte	nullrow[MAX_MAP_LEAFS/8];
+
+// every cluster's PVS and PHS decompressed once at load, if cm_vismatrix
+// allows the memory
+byte	*vis_matrix;		// as allocated
+byte	*map_pvs, *map_phs;	// VIS_ROWALIGN aligned rows
+
+/*
+===================
+CM_FreeVisMatrix
+===================
+*/
+void CM_FreeVisMatrix (void)
+{
+	if (vis_matrix)
+		Z_Free (vis_matrix);
+	vis_matrix = NULL;
+	map_pvs = map_phs = NULL;
+}
+
+/*
+===================
+CM_BuildVisMatrix
+
+Decompresses the PVS and PHS of every cluster into two bit matrices so
+CM_ClusterPVS and CM_ClusterPHS don't have to run the RLE decode on every
+call.  cm_vismatrix is the most memory to use for it in megabytes, maps
+that need more keep decompressing on demand.
+===================
+*/
+void CM_BuildVisMatrix (void)
+{
+	int		i;
+	int		size, rowbytes;
+
+	CM_FreeVisMatrix ();
+
+	rowbytes = CM_VisRowBytes ();
+	size = rowbytes * numclusters;
+	if (!size || size*2.0 > cm_vismatrix->value*1024*1024)
+	{
+		if (size && cm_vismatrix->value)
+			Com_DPrintf ("CM_BuildVisMatrix: %iK over budget, decompressing on demand\n", size*2/1024);
+		return;
+	}
+
+	vis_matrix = Z_Malloc (size*2 + VIS_ROWALIGN);
+	map_pvs = (byte *)(((size_t)vis_matrix + VIS_ROWALIGN-1) & ~(size_t)(VIS_ROWALIGN-1));
+	map_phs = map_pvs + size;
+
+	for (i=0 ; i<numclusters ; i++)
+	{
+		CM_DecompressVis (map_visibility + map_vis->bitofs[i][DVIS_PVS], map_pvs + i*rowbytes);
+		CM_DecompressVis (map_visibility + map_vis->bitofs[i][DVIS_PHS], map_phs + i*rowbytes);
+	}
+}
+
+/*
+===================
+CM_VisRowBytes
+
+Size of the rows returned by CM_ClusterPVS and CM_ClusterPHS
+===================
+*/
+int		CM_VisRowBytes (void)
+{
+	return (((numclusters+7)>>3) + VIS_ROWALIGN-1) & ~(VIS_ROWALIGN-1);
+}
 
+/*
+===================
+CM_OrVisRow
+
+dest |= src for a whole row, dest must hold CM_VisRowBytes
+===================
+*/
+void	CM_OrVisRow (byte *dest, byte *src)
+{
+	int		i, rowbytes;
+
+	rowbytes = CM_VisRowBytes ();
+#if CM_SSE2
+	for (i=0 ; i<rowbytes ; i+=16)
+	{
+		_mm_storeu_si128 ((__m128i *)(dest+i), _mm_or_si128 (
+			_mm_loadu_si128 ((__m128i *)(dest+i)), _mm_loadu_si128 ((__m128i *)(src+i))));
+	}
+#else
+	for (i=0 ; i<rowbytes ; i+=4)
+		*(unsigned *)(dest+i) |= *(unsigned *)(src+i);
+#endif
+}
+
+/*
+===================
+CM_ClusterPVS
+
+The returned row must not be modified.  Without the vis matrix it is
+decompressed into the calling thread's context, so it is only good until
+that thread's next call.
+===================
+*/
 byte	*CM_ClusterPVS (int cluster)
 {
+	byte	*row;
+
 	if (cluster == -1)
-		memset (pvsrow, 0, (numclusters+7)>>3);
-	else
-		CM_DecompressVis (map_visibility + map_vis->bitofs[cluster][DVIS_PVS], pvsrow);
-	return pvsrow;
+		return nullrow;
+	if (map_pvs)
+		return map_pvs + cluster*CM_VisRowBytes ();
+
+	row = CM_Context()->pvsrow;
+	CM_DecompressVis (map_visibility + map_vis->bitofs[cluster][DVIS_PVS], row);
+	return row;
 }
 
 byte	*CM_ClusterPHS (int cluster)
 {
+	byte	*row;
+
 	if (cluster == -1)
-		memset (phsrow, 0, (numclusters+7)>>3);
-	else
-		CM_DecompressVis (map_visibility + map_vis->bitofs[cluster][DVIS_PHS], phsrow);
-	return phsrow;
+		return nullrow;
+	if (map_phs)
+		return map_phs + cluster*CM_VisRowBytes ();
+
+	row = CM_Context()->phsrow;
+	CM_DecompressVis (map_visibility + map_vis->bitofs[cluster][DVIS_PHS], row);
+	return row;
 }
 
 
@@ -1599,64 +2674,262 @@ AREAPORTALS
 ===============================================================================
 */
 
-void FloodArea_r (carea_t *area, int floodnum)
+void FloodArea_r (int areanum, int floodnum, int *floods)
 {
 	int		i;
+	carea_t	*area;
 	dareaportal_t	*p;
 
-	if (area->floodvalid == floodvalid)
+	if (floods[areanum])
 	{
-		if (area->floodnum == floodnum)
+		if (floods[areanum] == floodnum)
 			return;
 		Com_Error (ERR_DROP, "FloodArea_r: reflooded");
 	}
 
-	area->floodnum = floodnum;
-	area->floodvalid = floodvalid;
+	floods[areanum] = floodnum;
+	area = &map_areas[areanum];
 	p = &map_areaportals[area->firstareaportal];
 	for (i=0 ; i<area->numareaportals ; i++, p++)
 	{
 		if (portalopen[p->portalnum])
-			FloodArea_r (&map_areas[p->otherarea], floodnum);
+			FloodArea_r (p->otherarea, floodnum, floods);
 	}
 }
 
 /*
 ====================
-FloodAreaConnections
-
+CM_FloodAreas
 
+Floods every area from scratch into floods[], returns the number of floods
 ====================
 */
-void	FloodAreaConnections (void)
+int		CM_FloodAreas (int *floods)
 {
 	int		i;
-	carea_t	*area;
 	int		floodnum;
 
-	// all current floods are now invalid
-	floodvalid++;
+	memset (floods, 0, numareas*sizeof(*floods));
 	floodnum = 0;
 
 	// area 0 is not used
 	for (i=1 ; i<numareas ; i++)
 	{
-		area = &map_areas[i];
-		if (area->floodvalid == floodvalid)
+		if (floods[i])
 			continue;		// already flooded into
 		floodnum++;
-		FloodArea_r (area, floodnum);
+		FloodArea_r (i, floodnum, floods);
 	}
 
+	return floodnum;
+}
+
+/*
+====================
+FloodAreaConnections
+
+Recalculates all of the area connections and the bookkeeping
+CM_SetAreaPortalState uses to keep them up to date
+====================
+*/
+void	FloodAreaConnections (void)
+{
+	int		i;
+	int		floods[MAX_MAP_AREAS];
+
+	CM_FloodAreas (floods);
+
+	memset (floodsize, 0, sizeof(floodsize));
+	for (i=0 ; i<numareas ; i++)
+	{
+		map_areas[i].floodnum = floods[i];
+		floodsize[floods[i]]++;
+	}
+
+	numfreefloods = 0;
+	for (i=MAX_MAP_AREAS ; i>=0 ; i--)
+	{
+		if (!floodsize[i])
+			freefloods[numfreefloods++] = i;
+	}
+}
+
+/*
+====================
+CM_MergeFloods
+
+A portal between two areas opened, so the smaller of their floods is
+relabeled into the larger one
+====================
+*/
+void	CM_MergeFloods (int area1, int area2)
+{
+	int		i, t;
+	int		from, to;
+	int		stack[MAX_MAP_AREAS], sp;
+	carea_t	*area;
+	dareaportal_t	*p;
+
+	if (floodsize[map_areas[area1].floodnum] > floodsize[map_areas[area2].floodnum])
+	{
+		t = area1;
+		area1 = area2;
+		area2 = t;
+	}
+	from = map_areas[area1].floodnum;
+	to = map_areas[area2].floodnum;
+	if (from == to)
+		return;		// already connected some other way
+
+	floodsize[to] += floodsize[from];
+	floodsize[from] = 0;
+	freefloods[numfreefloods++] = from;
+
+	map_areas[area1].floodnum = to;
+	stack[0] = area1;
+	sp = 1;
+	while (sp)
+	{
+		area = &map_areas[stack[--sp]];
+		p = &map_areaportals[area->firstareaportal];
+		for (i=0 ; i<area->numareaportals ; i++, p++)
+		{
+			if (!portalopen[p->portalnum] || map_areas[p->otherarea].floodnum != from)
+				continue;
+			map_areas[p->otherarea].floodnum = to;
+			stack[sp++] = p->otherarea;
+		}
+	}
+}
+
+/*
+====================
+CM_SplitFloods
+
+A portal between two areas closed.  Searches out from both sides a step
+at a time until they meet, in which case nothing changed, or until one
+side runs out of areas, which then become a flood of their own.  Either
+way the work is bounded by the smaller side.
+====================
+*/
+void	CM_SplitFloods (int area1, int area2)
+{
+	int		i, side, areanum;
+	int		floodnum, newflood, mark[2];
+	int		found[2][MAX_MAP_AREAS], numfound[2];	// also the search stacks
+	int		next[2];
+	carea_t	*area;
+	dareaportal_t	*p;
+
+	floodnum = map_areas[area1].floodnum;
+	if (map_areas[area2].floodnum != floodnum)
+		return;		// the floods already don't touch
+
+	floodmark += 2;
+	mark[0] = floodmark;
+	mark[1] = floodmark + 1;
+
+	found[0][0] = area1;
+	found[1][0] = area2;
+	map_areas[area1].floodmark = mark[0];
+	map_areas[area2].floodmark = mark[1];
+	numfound[0] = numfound[1] = 1;
+	next[0] = next[1] = 0;
+
+	while (1)
+	{
+		for (side=0 ; side<2 ; side++)
+		{
+			if (next[side] == numfound[side])
+			{	// this side is cut off from the other
+				if (!numfreefloods)
+					Com_Error (ERR_DROP, "CM_SplitFloods: out of floods");
+				newflood = freefloods[--numfreefloods];
+				for (i=0 ; i<numfound[side] ; i++)
+					map_areas[found[side][i]].floodnum = newflood;
+				floodsize[newflood] = numfound[side];
+				floodsize[floodnum] -= numfound[side];
+				return;
+			}
+
+			area = &map_areas[found[side][next[side]++]];
+			p = &map_areaportals[area->firstareaportal];
+			for (i=0 ; i<area->numareaportals ; i++, p++)
+			{
+				if (!portalopen[p->portalnum])
+					continue;
+				areanum = p->otherarea;
+				if (map_areas[areanum].floodmark == mark[side^1])
+					return;		// met the other side, still connected
+				if (map_areas[areanum].floodmark == mark[side])
+					continue;
+				map_areas[areanum].floodmark = mark[side];
+				found[side][numfound[side]++] = areanum;
+			}
+		}
+	}
+}
+
+/*
+====================
+CM_VerifyAreaConnections
+
+Checks the incrementally maintained floods against a full flood fill
+====================
+*/
+qboolean	CM_VerifyAreaConnections (void)
+{
+	int		i;
+	int		floods[MAX_MAP_AREAS];
+	int		toref[MAX_MAP_AREAS+1], fromref[MAX_MAP_AREAS+1];
+
+	CM_FloodAreas (floods);
+
+	// the two labelings have to be the same partition
+	memset (toref, -1, sizeof(toref));
+	memset (fromref, -1, sizeof(fromref));
+	for (i=1 ; i<numareas ; i++)
+	{
+		if (toref[map_areas[i].floodnum] == -1)
+			toref[map_areas[i].floodnum] = floods[i];
+		if (fromref[floods[i]] == -1)
+			fromref[floods[i]] = map_areas[i].floodnum;
+		if (toref[map_areas[i].floodnum] != floods[i]
+			|| fromref[floods[i]] != map_areas[i].floodnum)
+			return qFalse;
+	}
+	return qTrue;
 }
 
 void	CM_SetAreaPortalState (int portalnum, qboolean open)
 {
+	int		area1, area2;
+
 	if (portalnum > numareaportals)
 		Com_Error (ERR_DROP, "areaportal > numareaportals");
 
+	if (!portalopen[portalnum] == !open)
+	{
+		portalopen[portalnum] = open;
+		return;
+	}
 	portalopen[portalnum] = open;
-	FloodAreaConnections ();
+
+	area1 = portalareas[portalnum][0];
+	area2 = portalareas[portalnum][1];
+	if (area1 != area2)
+	{
+		if (open)
+			CM_MergeFloods (area1, area2);
+		else
+			CM_SplitFloods (area1, area2);
+	}
+
+	if (cm_verify && cm_verify->value && !CM_VerifyAreaConnections ())
+	{
+		Com_Printf ("CM_SetAreaPortalState: floods differ after portal %i\n", portalnum);
+		FloodAreaConnections ();
+	}
 }
 
 qboolean	CM_AreasConnected (int area1, int area2)
@@ -1672,6 +2945,47 @@ qboolean	CM_AreasConnected (int area1, int area2)
 	return qFalse;
 }
 
+/*
+====================
+CM_AreaPortalTest_f
+
+Toggles random portals on the current map, checking the area connections
+against a full flood after every change, then puts the portals back
+====================
+*/
+void	CM_AreaPortalTest_f (void)
+{
+	int		i, count, portalnum;
+	int		failed;
+	qboolean	saved[MAX_MAP_AREAPORTALS];
+
+	if (numareaportals < 1)
+	{
+		Com_Printf ("No area portals loaded.\n");
+		return;
+	}
+
+	count = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : 10000;
+
+	memcpy (saved, portalopen, sizeof(saved));
+	failed = 0;
+	for (i=0 ; i<count ; i++)
+	{
+		portalnum = map_areaportals[rand() % numareaportals].portalnum;
+		CM_SetAreaPortalState (portalnum, !portalopen[portalnum]);
+		if (!CM_VerifyAreaConnections ())
+		{
+			failed++;
+			FloodAreaConnections ();
+		}
+	}
+
+	memcpy (portalopen, saved, sizeof(portalopen));
+	FloodAreaConnections ();
+
+	Com_Printf ("%i portal changes, %i mismatches\n", count, failed);
+}
+
 
 /*
 =================
@@ -1768,3 +3082,186 @@ qboolean CM_HeadnodeVisible (int nodenum, byte *visbits)
 	return CM_HeadnodeVisible(node->children[1], visbits);
 }
 
+
+
+/*
+===============================================================================
+
+BENCHMARK
+
+===============================================================================
+*/
+
+static int CM_BenchCompare (const void *a, const void *b)
+{
+	float	fa, fb;
+
+	fa = *(const float *)a;
+	fb = *(const float *)b;
+	if (fa < fb)
+		return -1;
+	return fa > fb;
+}
+
+/*
+================
+CM_Bench_f
+
+cm_bench <logfile> [passes]
+
+Replays a collision log recorded with sv_tracelog against its map and
+prints the time per call and the brushes tested per call for each kind
+of call.  Runs without a server, so a dedicated server started with
++cm_bench measures collision alone.
+================
+*/
+void CM_Bench_f (void)
+{
+	static char	*typenames[CMLOG_NUMTYPES] =
+		{"box trace", "transformed trace", "point contents", "transformed point"};
+	byte		*buf;
+	int			len;
+	cmlogheader_t	*header;
+	cmlogentry_t	*entries, *e;
+	int			count, passes, pass;
+	int			i, type, n, headnode, brushes;
+	int			calls[CMLOG_NUMTYPES], typebrushes[CMLOG_NUMTYPES];
+	float		*times, *sorted;
+	double		start, overhead, total, sum;
+	unsigned	checksum;
+
+	if (Cmd_Argc() < 2)
+	{
+		Com_Printf ("usage: cm_bench <logfile> [passes]\n");
+		return;
+	}
+	if (Com_ServerState())
+	{
+		Com_Printf ("cm_bench can't run while a server is active.\n");
+		return;
+	}
+
+	len = FS_LoadFile (Cmd_Argv(1), (void **)&buf);
+	if (!buf)
+	{
+		Com_Printf ("Couldn't load %s\n", Cmd_Argv(1));
+		return;
+	}
+
+	header = (cmlogheader_t *)buf;
+	if (len < sizeof(*header) || header->ident != CMLOG_IDENT || header->version != CMLOG_VERSION)
+	{
+		Com_Printf ("%s is not a collision log\n", Cmd_Argv(1));
+		FS_FreeFile (buf);
+		return;
+	}
+	header->mapname[sizeof(header->mapname)-1] = 0;
+	entries = (cmlogentry_t *)(header + 1);
+	count = (len - sizeof(*header)) / sizeof(*entries);
+
+	passes = Cmd_Argc() > 2 ? atoi(Cmd_Argv(2)) : 1;
+	if (passes < 1)
+		passes = 1;
+
+	if (FS_LoadFile (header->mapname, NULL) == -1)
+	{
+		Com_Printf ("Couldn't find %s\n", header->mapname);
+		FS_FreeFile (buf);
+		return;
+	}
+	CM_LoadMap (header->mapname, qFalse, &checksum);
+	if (checksum != header->checksum)
+		Com_Printf ("WARNING: %s has changed since the log was recorded\n", header->mapname);
+
+	for (i=0, e=entries ; i<count ; i++, e++)
+	{
+		if (e->type < 0 || e->type >= CMLOG_NUMTYPES || e->headnode < -1 || e->headnode >= numnodes)
+		{
+			Com_Printf ("Bad call %i in %s\n", i, Cmd_Argv(1));
+			FS_FreeFile (buf);
+			return;
+		}
+	}
+
+	// a sample and a sorted copy for every call of every pass, in an int
+	if (count && passes > 0x7fffffff / (2 * sizeof(*times)) / count)
+	{
+		passes = 0x7fffffff / (2 * sizeof(*times)) / count;
+		Com_Printf ("cm_bench: only %i passes fit\n", passes);
+	}
+
+	times = Z_Malloc (count * passes * sizeof(*times) * 2);
+	sorted = times + count * passes;
+	memset (calls, 0, sizeof(calls));
+	memset (typebrushes, 0, sizeof(typebrushes));
+
+	// the cost of reading the clock, taken off every sample
+	start = Sys_FloatTime ();
+	for (i=0 ; i<1000 ; i++)
+		Sys_FloatTime ();
+	overhead = (Sys_FloatTime () - start) / 1001;
+
+	total = Sys_FloatTime ();
+	for (pass=0, n=0 ; pass<passes ; pass++)
+	{
+		for (i=0, e=entries ; i<count ; i++, e++, n++)
+		{
+			brushes = c_brush_traces;
+			start = Sys_FloatTime ();
+
+			headnode = e->headnode;
+			switch (e->type)
+			{
+			case CMLOG_BOXTRACE:
+				CM_BoxTrace (e->start, e->end, e->mins, e->maxs, headnode, e->brushmask);
+				break;
+			case CMLOG_TRANSFORMEDTRACE:
+				if (headnode == -1)
+					headnode = CM_HeadnodeForBox (e->boxmins, e->boxmaxs);
+				CM_TransformedBoxTrace (e->start, e->end, e->mins, e->maxs, headnode,
+					e->brushmask, e->origin, e->angles);
+				break;
+			case CMLOG_POINTCONTENTS:
+				CM_PointContents (e->start, headnode);
+				break;
+			case CMLOG_TRANSFORMEDPOINT:
+				if (headnode == -1)
+					headnode = CM_HeadnodeForBox (e->boxmins, e->boxmaxs);
+				CM_TransformedPointContents (e->start, headnode, e->origin, e->angles);
+				break;
+			}
+
+			times[n] = (Sys_FloatTime () - start - overhead) * 1e9;
+			if (times[n] < 0)
+				times[n] = 0;
+			calls[e->type]++;
+			typebrushes[e->type] += c_brush_traces - brushes;
+		}
+	}
+	total = Sys_FloatTime () - total;
+
+	Com_Printf ("%s: %i calls x %i passes in %4.3f seconds\n", header->mapname, count, passes, total);
+	Com_Printf ("%-18s %8s %7s %7s %7s %7s %8s %8s\n", "ns/call", "calls", "mean", "p50", "p90", "p99", "max", "brushes");
+	for (type=0 ; type<CMLOG_NUMTYPES ; type++)
+	{
+		if (!calls[type])
+			continue;
+
+		sum = 0;
+		for (i=0, n=0 ; i<count*passes ; i++)
+		{
+			if (entries[i % count].type != type)
+				continue;
+			sorted[n++] = times[i];
+			sum += times[i];
+		}
+		qsort (sorted, n, sizeof(*sorted), CM_BenchCompare);
+
+		Com_Printf ("%-18s %8i %7.0f %7.0f %7.0f %7.0f %8.0f %8.1f\n", typenames[type], n,
+			sum / n, sorted[n/2], sorted[n*9/10], sorted[n*99/100], sorted[n-1],
+			(float)typebrushes[type] / n);
+	}
+
+	Z_Free (times);
+	FS_FreeFile (buf);
+}
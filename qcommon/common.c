@@ -44,6 +44,7 @@ cvar_t	*fixedtime;
 cvar_t	*logfile_active;	// 1 = buffer log, 2 = flush after each print
 cvar_t	*showtrace;
 cvar_t	*dedicated;
+cvar_t	*com_threads;		// workers for Com_ParallelJobs, 0 = one per processor
 
 FILE	*logfile;
 
@@ -669,6 +670,244 @@ void MSG_WriteDeltaEntity (entity_state_t *from, entity_state_t *to, sizebuf_t *
 }
 
 
+/*
+==============================================================================
+
+			BIT PACKED DELTAS
+
+PROTOCOL_VERSION_BITS frames are written with these.  Bits go into each
+byte low bit first, and a run of bits always ends at a byte boundary as
+soon as anything else is written to the buffer, so bit packed sections can
+sit between ordinary MSG_Write* calls.
+==============================================================================
+*/
+
+void MSG_WriteBits (sizebuf_t *sb, int value, int bits)
+{
+	unsigned	v;
+	int			put;
+
+	v = value;
+	if (bits < 32)
+		v &= (1<<bits) - 1;
+
+	while (bits > 0)
+	{
+		if (!sb->writebits)
+			*(byte *)SZ_GetSpace (sb, 1) = 0;
+
+		put = 8 - sb->writebits;
+		if (put > bits)
+			put = bits;
+
+		sb->data[sb->cursize-1] |= (v & ((1<<put) - 1)) << sb->writebits;
+		sb->writebits = (sb->writebits + put) & 7;
+		v >>= put;
+		bits -= put;
+	}
+}
+
+/*
+==================
+MSG_WriteBitString
+
+Appends bits that were written with MSG_WriteBits from the start of
+another buffer, a straight copy when this one is at a byte boundary
+==================
+*/
+void MSG_WriteBitString (sizebuf_t *sb, byte *data, int bits)
+{
+	if (!sb->writebits)
+	{
+		memcpy (SZ_GetSpace (sb, (bits+7)>>3), data, (bits+7)>>3);
+		sb->writebits = bits & 7;
+		return;
+	}
+
+	for ( ; bits >= 8 ; bits -= 8)
+		MSG_WriteBits (sb, *data++, 8);
+	if (bits)
+		MSG_WriteBits (sb, *data, bits);
+}
+
+/*
+==================
+MSG_WriteDeltaBits
+
+Sends a 16 bit quantity relative to one the reader already has:
+0 unchanged, 10 + 6 bit delta, 110 + 10 bit delta, 111 + 16 bit value
+==================
+*/
+void MSG_WriteDeltaBits (sizebuf_t *sb, int from, int to)
+{
+	int		delta;
+
+	delta = (short)(to - from);
+
+	if (!delta)
+		MSG_WriteBits (sb, 0, 1);
+	else if (delta >= -32 && delta < 32)
+	{
+		MSG_WriteBits (sb, 1, 2);
+		MSG_WriteBits (sb, delta, 6);
+	}
+	else if (delta >= -512 && delta < 512)
+	{
+		MSG_WriteBits (sb, 3, 3);
+		MSG_WriteBits (sb, delta, 10);
+	}
+	else
+	{
+		MSG_WriteBits (sb, 7, 3);
+		MSG_WriteBits (sb, to, 16);
+	}
+}
+
+/*
+==================
+MSG_WriteVarBits
+
+0 + 8 bits, 10 + 16 bits, 11 + 32 bits
+==================
+*/
+void MSG_WriteVarBits (sizebuf_t *sb, int value)
+{
+	if ((unsigned)value < 256)
+	{
+		MSG_WriteBits (sb, 0, 1);
+		MSG_WriteBits (sb, value, 8);
+	}
+	else if ((unsigned)value < 0x10000)
+	{
+		MSG_WriteBits (sb, 1, 2);
+		MSG_WriteBits (sb, value, 16);
+	}
+	else
+	{
+		MSG_WriteBits (sb, 3, 2);
+		MSG_WriteBits (sb, value, 32);
+	}
+}
+
+/*
+==================
+MSG_WriteDeltaEntityBits
+
+The PROTOCOL_VERSION_BITS form of MSG_WriteDeltaEntity.  Fields are
+compared the way they go over the wire, so an entity that moved less than
+a coordinate step costs nothing, and the origins are sent as deltas from
+the state the client is delta'ing from.  The common fields come first,
+the rarely changing ones are behind a single bit.
+==================
+*/
+void MSG_WriteDeltaEntityBits (entity_state_t *from, entity_state_t *to, sizebuf_t *msg, qboolean force, qboolean newentity)
+{
+	int			fromcoord[3], tocoord[3];
+	int			fromangle[3], toangle[3];
+	qboolean	changed, oldorigin, more;
+	int			i;
+
+	if (!to->number)
+		Com_Error (ERR_FATAL, "Unset entity number");
+	if (to->number >= MAX_EDICTS)
+		Com_Error (ERR_FATAL, "Entity number >= MAX_EDICTS");
+
+	for (i=0 ; i<3 ; i++)
+	{
+		fromcoord[i] = COORD2SHORT(from->origin[i]);
+		tocoord[i] = COORD2SHORT(to->origin[i]);
+		fromangle[i] = (int)(from->angles[i]*256/360) & 255;
+		toangle[i] = (int)(to->angles[i]*256/360) & 255;
+	}
+
+	more = to->modelindex != from->modelindex
+		|| to->modelindex2 != from->modelindex2
+		|| to->modelindex3 != from->modelindex3
+		|| to->modelindex4 != from->modelindex4
+		|| to->skinnum != from->skinnum
+		|| to->effects != from->effects
+		|| to->renderfx != from->renderfx
+		|| to->solid != from->solid
+		|| to->sound != from->sound;
+
+	oldorigin = newentity || (to->renderfx & RF_BEAM);
+
+	changed = more || oldorigin || to->event || to->frame != from->frame;
+	for (i=0 ; i<3 ; i++)
+		if (tocoord[i] != fromcoord[i] || toangle[i] != fromangle[i])
+			changed = qTrue;
+
+	if (!changed && !force)
+		return;		// nothing to send!
+
+	MSG_WriteBits (msg, to->number, ENTITYNUM_BITS);
+	MSG_WriteBits (msg, 0, 1);		// not removed
+
+	for (i=0 ; i<3 ; i++)
+		MSG_WriteDeltaBits (msg, fromcoord[i], tocoord[i]);
+
+	for (i=0 ; i<3 ; i++)
+	{
+		MSG_WriteBits (msg, toangle[i] != fromangle[i], 1);
+		if (toangle[i] != fromangle[i])
+			MSG_WriteBits (msg, toangle[i], 8);
+	}
+
+	MSG_WriteBits (msg, to->frame != from->frame, 1);
+	if (to->frame != from->frame)
+	{
+		MSG_WriteBits (msg, to->frame == from->frame + 1, 1);
+		if (to->frame != from->frame + 1)
+			MSG_WriteVarBits (msg, to->frame);
+	}
+
+	// event is not delta compressed, just 0 compressed
+	MSG_WriteBits (msg, to->event != 0, 1);
+	if (to->event)
+		MSG_WriteBits (msg, to->event, 8);
+
+	// usually just behind the origin, so delta it from there
+	MSG_WriteBits (msg, oldorigin, 1);
+	if (oldorigin)
+		for (i=0 ; i<3 ; i++)
+			MSG_WriteDeltaBits (msg, tocoord[i], COORD2SHORT(to->old_origin[i]));
+
+	MSG_WriteBits (msg, more, 1);
+	if (!more)
+		return;
+
+	MSG_WriteBits (msg, to->modelindex != from->modelindex, 1);
+	if (to->modelindex != from->modelindex)
+		MSG_WriteBits (msg, to->modelindex, 8);
+	MSG_WriteBits (msg, to->modelindex2 != from->modelindex2, 1);
+	if (to->modelindex2 != from->modelindex2)
+		MSG_WriteBits (msg, to->modelindex2, 8);
+	MSG_WriteBits (msg, to->modelindex3 != from->modelindex3, 1);
+	if (to->modelindex3 != from->modelindex3)
+		MSG_WriteBits (msg, to->modelindex3, 8);
+	MSG_WriteBits (msg, to->modelindex4 != from->modelindex4, 1);
+	if (to->modelindex4 != from->modelindex4)
+		MSG_WriteBits (msg, to->modelindex4, 8);
+
+	MSG_WriteBits (msg, to->skinnum != from->skinnum, 1);
+	if (to->skinnum != from->skinnum)
+		MSG_WriteVarBits (msg, to->skinnum);
+	MSG_WriteBits (msg, to->effects != from->effects, 1);
+	if (to->effects != from->effects)
+		MSG_WriteVarBits (msg, to->effects);
+	MSG_WriteBits (msg, to->renderfx != from->renderfx, 1);
+	if (to->renderfx != from->renderfx)
+		MSG_WriteVarBits (msg, to->renderfx);
+
+	MSG_WriteBits (msg, to->solid != from->solid, 1);
+	if (to->solid != from->solid)
+		MSG_WriteBits (msg, to->solid, 16);
+	MSG_WriteBits (msg, to->sound != from->sound, 1);
+	if (to->sound != from->sound)
+		MSG_WriteBits (msg, to->sound, 8);
+}
+
+
 //============================================================
 
 //
@@ -678,6 +917,7 @@ void MSG_WriteDeltaEntity (entity_state_t *from, entity_state_t *to, sizebuf_t *
 void MSG_BeginReading (sizebuf_t *msg)
 {
 	msg->readcount = 0;
+	msg->readbits = 0;
 }
 
 // returns -1 if no more characters are available
@@ -764,26 +1004,80 @@ float MSG_ReadFloat (sizebuf_t *msg_read)
 	return dat.f;	
 }
 
+/*
+==================
+MSG_StringLength
+
+Length of the string at the read position, stopping at max.  A 0xff byte
+ends a string the same as a 0 does, it has always read back as -1.
+==================
+*/
+static int MSG_StringLength (sizebuf_t *msg_read, int max)
+{
+	byte	*start, *p, *stop;
+
+	if (msg_read->readcount >= msg_read->cursize)
+		return 0;
+
+	start = msg_read->data + msg_read->readcount;
+	stop = msg_read->data + msg_read->cursize;
+	if (stop - start > max)
+		stop = start + max;
+
+	for (p = start ; p < stop && *p && *p != 0xff ; p++)
+		;
+
+	return p - start;
+}
+
 char *MSG_ReadString (sizebuf_t *msg_read)
 {
 	static char	string[2048];
-	int		l,c;
-	
-	l = 0;
-	do
-	{
-		c = MSG_ReadChar (msg_read);
-		if (c == -1 || c == 0)
-			break;
-		string[l] = c;
-		l++;
-	} while (l < sizeof(string)-1);
-	
+	int		l;
+
+	l = MSG_StringLength (msg_read, sizeof(string)-1);
+	memcpy (string, msg_read->data + msg_read->readcount, l);
 	string[l] = 0;
-	
+
+	// the terminator is consumed unless the string was cut short
+	msg_read->readcount += l;
+	if (l < sizeof(string)-1)
+		msg_read->readcount++;
+
 	return string;
 }
 
+/*
+==================
+MSG_ReadStringView
+
+Returns the string in place in the message buffer instead of copying it
+out, so it is only good until the buffer is reused.  A string that runs
+off the end of the message leaves the message overrun and reads as "".
+One ended by a 0xff can't be handed back in place either, so it reads as
+"" with the 0xff consumed, keeping the reads after it where
+MSG_ReadString would have left them.
+==================
+*/
+char *MSG_ReadStringView (sizebuf_t *msg_read)
+{
+	char	*start;
+	int		l;
+
+	l = MSG_StringLength (msg_read, msg_read->cursize);
+	if (msg_read->readcount + l >= msg_read->cursize)
+	{
+		msg_read->readcount = msg_read->cursize + 1;
+		return "";
+	}
+
+	start = (char *)msg_read->data + msg_read->readcount;
+	msg_read->readcount += l + 1;
+	if (start[l] != 0)
+		return "";
+	return start;
+}
+
 char *MSG_ReadStringLine (sizebuf_t *msg_read)
 {
 	static char	string[2048];
@@ -811,9 +1105,21 @@ float MSG_ReadCoord (sizebuf_t *msg_read)
 
 void MSG_ReadPos (sizebuf_t *msg_read, vec3_t pos)
 {
-	pos[0] = MSG_ReadShort(msg_read) * (1.0/8);
-	pos[1] = MSG_ReadShort(msg_read) * (1.0/8);
-	pos[2] = MSG_ReadShort(msg_read) * (1.0/8);
+	byte	*b;
+
+	if (msg_read->readcount+6 > msg_read->cursize)
+	{	// let the short reads sort out how much of it is there
+		pos[0] = MSG_ReadShort(msg_read) * (1.0/8);
+		pos[1] = MSG_ReadShort(msg_read) * (1.0/8);
+		pos[2] = MSG_ReadShort(msg_read) * (1.0/8);
+		return;
+	}
+
+	b = msg_read->data + msg_read->readcount;
+	pos[0] = (short)(b[0] + (b[1]<<8)) * (1.0/8);
+	pos[1] = (short)(b[2] + (b[3]<<8)) * (1.0/8);
+	pos[2] = (short)(b[4] + (b[5]<<8)) * (1.0/8);
+	msg_read->readcount += 6;
 }
 
 float MSG_ReadAngle (sizebuf_t *msg_read)
@@ -826,51 +1132,185 @@ float MSG_ReadAngle16 (sizebuf_t *msg_read)
 	return SHORT2ANGLE(MSG_ReadShort(msg_read));
 }
 
+/*
+==================
+MSG_ReadDeltaUsercmd
+
+The bits give the size of the rest of the command, so it is bounds
+checked once and read straight out of the buffer.  A command cut short
+by the end of the message is left as from, with the message overrun.
+==================
+*/
 void MSG_ReadDeltaUsercmd (sizebuf_t *msg_read, usercmd_t *from, usercmd_t *move)
 {
-	int bits;
+	int		bits, size, i;
+	byte	*p;
 
 	memcpy (move, from, sizeof(*move));
 
 	bits = MSG_ReadByte (msg_read);
-		
+	if (bits == -1)
+	{
+		msg_read->readcount = msg_read->cursize + 1;
+		return;
+	}
+
+	size = 2;		// msec and light level
+	for (i=0 ; i<6 ; i++)
+		if (bits & (CM_ANGLE1<<i))
+			size += 2;	// angles and movement
+	if (bits & CM_BUTTONS)
+		size++;
+	if (bits & CM_IMPULSE)
+		size++;
+
+	p = MSG_ReadBlock (msg_read, size);
+	if (!p)
+		return;
+
 // read current angles
-	if (bits & CM_ANGLE1)
-		move->angles[0] = MSG_ReadShort (msg_read);
-	if (bits & CM_ANGLE2)
-		move->angles[1] = MSG_ReadShort (msg_read);
-	if (bits & CM_ANGLE3)
-		move->angles[2] = MSG_ReadShort (msg_read);
-		
+	for (i=0 ; i<3 ; i++)
+		if (bits & (CM_ANGLE1<<i))
+		{
+			move->angles[i] = (short)(p[0] + (p[1]<<8));
+			p += 2;
+		}
+
 // read movement
 	if (bits & CM_FORWARD)
-		move->forwardmove = MSG_ReadShort (msg_read);
+	{
+		move->forwardmove = (short)(p[0] + (p[1]<<8));
+		p += 2;
+	}
 	if (bits & CM_SIDE)
-		move->sidemove = MSG_ReadShort (msg_read);
+	{
+		move->sidemove = (short)(p[0] + (p[1]<<8));
+		p += 2;
+	}
 	if (bits & CM_UP)
-		move->upmove = MSG_ReadShort (msg_read);
-	
+	{
+		move->upmove = (short)(p[0] + (p[1]<<8));
+		p += 2;
+	}
+
 // read buttons
 	if (bits & CM_BUTTONS)
-		move->buttons = MSG_ReadByte (msg_read);
+		move->buttons = *p++;
 
 	if (bits & CM_IMPULSE)
-		move->impulse = MSG_ReadByte (msg_read);
+		move->impulse = *p++;
 
 // read time to run command
-	move->msec = MSG_ReadByte (msg_read);
+	move->msec = *p++;
 
 // read the light level
-	move->lightlevel = MSG_ReadByte (msg_read);
+	move->lightlevel = *p++;
 }
 
 
 void MSG_ReadData (sizebuf_t *msg_read, void *data, int len)
 {
-	int		i;
+	int		avail;
+
+	if (len <= 0)
+		return;
+
+	avail = msg_read->cursize - msg_read->readcount;
+	if (avail > len)
+		avail = len;
+	if (avail < 0)
+		avail = 0;
+
+	// past the end reads as -1, same as MSG_ReadByte
+	memcpy (data, msg_read->data + msg_read->readcount, avail);
+	memset ((byte *)data + avail, 0xff, len - avail);
+	msg_read->readcount += len;
+}
+
+/*
+==================
+MSG_ReadBlock
+
+Skips len bytes and returns where they are in the message buffer, or NULL
+if the message doesn't hold that many.  The message is left overrun in
+that case, the same as a short read would.
+==================
+*/
+byte *MSG_ReadBlock (sizebuf_t *msg_read, int len)
+{
+	byte	*start;
+
+	if (len < 0 || msg_read->readcount + len > msg_read->cursize)
+	{
+		msg_read->readcount = msg_read->cursize + 1;
+		return NULL;
+	}
+
+	start = msg_read->data + msg_read->readcount;
+	msg_read->readcount += len;
+	return start;
+}
+
+
+int MSG_ReadBits (sizebuf_t *msg_read, int bits)
+{
+	unsigned	value;
+	int			got, take;
+
+	value = 0;
+	for (got = 0 ; got < bits ; got += take)
+	{
+		if (msg_read->readbitsat != msg_read->readcount || !msg_read->readbits)
+		{	// start on a fresh byte
+			if (msg_read->readcount+1 > msg_read->cursize)
+			{
+				msg_read->readcount = msg_read->cursize+1;
+				return -1;
+			}
+			msg_read->readcount++;
+			msg_read->readbitsat = msg_read->readcount;
+			msg_read->readbits = 0;
+		}
+
+		take = 8 - msg_read->readbits;
+		if (take > bits - got)
+			take = bits - got;
+
+		value |= (unsigned)((msg_read->data[msg_read->readcount-1] >> msg_read->readbits) & ((1<<take) - 1)) << got;
+		msg_read->readbits = (msg_read->readbits + take) & 7;
+	}
+
+	return value;
+}
+
+static int MSG_ReadSignedBits (sizebuf_t *msg_read, int bits)
+{
+	int		value;
+
+	value = MSG_ReadBits (msg_read, bits);
+	if (value & (1<<(bits-1)))
+		value -= 1<<bits;
+	return value;
+}
+
+int MSG_ReadDeltaBits (sizebuf_t *msg_read, int from)
+{
+	if (!MSG_ReadBits (msg_read, 1))
+		return from;
+	if (!MSG_ReadBits (msg_read, 1))
+		return (short)(from + MSG_ReadSignedBits (msg_read, 6));
+	if (!MSG_ReadBits (msg_read, 1))
+		return (short)(from + MSG_ReadSignedBits (msg_read, 10));
+	return (short)MSG_ReadBits (msg_read, 16);
+}
 
-	for (i=0 ; i<len ; i++)
-		((byte *)data)[i] = MSG_ReadByte (msg_read);
+int MSG_ReadVarBits (sizebuf_t *msg_read)
+{
+	if (!MSG_ReadBits (msg_read, 1))
+		return MSG_ReadBits (msg_read, 8);
+	if (!MSG_ReadBits (msg_read, 1))
+		return MSG_ReadBits (msg_read, 16);
+	return MSG_ReadBits (msg_read, 32);
 }
 
 
@@ -886,6 +1326,7 @@ void SZ_Init (sizebuf_t *buf, byte *data, int length)
 void SZ_Clear (sizebuf_t *buf)
 {
 	buf->cursize = 0;
+	buf->writebits = 0;
 	buf->overflowed = qFalse;
 }
 
@@ -908,6 +1349,7 @@ void *SZ_GetSpace (sizebuf_t *buf, int length)
 
 	data = buf->data + buf->cursize;
 	buf->cursize += length;
+	buf->writebits = 0;		// MSG_WriteBits continues in a new byte
 	
 	return data;
 }
@@ -1089,24 +1531,153 @@ void Info_Print (char *s)
 
 						ZONE MEMORY ALLOCATION
 
-just cleared malloc with counters now...
+Each tag has an arena of its own.  Small blocks come out of 64k slabs that
+each hold one size class, so Z_FreeTags hands a tag's memory back a slab
+at a time instead of a block at a time.  Big blocks are plain mallocs
+chained to their arena.
+
+A slab that empties out stays on its list as the class's spare, so one
+block going back and forth doesn't malloc and free a whole slab each
+time.  Only a second empty slab in the same class is freed right away.
 
 ==============================================================================
 */
 
-#define	Z_MAGIC		0x1d1d
+#define	Z_MAGIC			0x1d1d
+#define	Z_SLABMAGIC		0x1d1e
+#define	Z_FREEMAGIC		0x1d1f		// a free block in a slab
+
+#define	Z_SLABSIZE		0x10000
+#define	Z_MAXSMALL		2048		// bigger blocks, header included, are malloced
+#define	Z_NUMCLASSES	13
 
+// about 1.5x apart, all multiples of 16
+static const int	z_classsizes[Z_NUMCLASSES] =
+	{32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048};
 
 typedef struct zhead_s
 {
-	struct zhead_s	*prev, *next;
+	union
+	{
+		struct zhead_s	*prev;		// a large block's neighbor in its arena
+		struct zslab_s	*slab;		// the slab a small block is in
+	} u;
+	struct zhead_s	*next;			// large blocks, and a slab's free list
 	short	magic;
 	short	tag;			// for group free
-	int		size;
+	int		size;			// as asked for, plus the header
 } zhead_t;
 
-zhead_t		z_chain;
-int		z_count, z_bytes;
+typedef struct zslab_s
+{
+	struct zslab_s	*prev, *next;	// slabs with free blocks are at the front
+	struct zarena_s	*arena;
+	int		sizeclass;
+	int		used;			// blocks handed out
+	int		carved;			// blocks ever handed out, the rest are untouched
+	int		numblocks;
+	zhead_t	*free;
+} zslab_t;
+
+// where a slab's blocks start, keeping them as aligned as malloc's
+#define	Z_SLABHEADER	((sizeof(zslab_t) + 15) & ~15)
+
+typedef struct zarena_s
+{
+	struct zarena_s	*next;
+	int		tag;
+	zslab_t	slabs[Z_NUMCLASSES];	// heads of the lists for each class
+	zslab_t	*spare[Z_NUMCLASSES];	// an empty slab kept on the list, or NULL
+	zhead_t	large;			// head of the chain of large blocks
+	int		count, bytes;	// blocks and bytes in use
+	int		numslabs;
+	int		largebytes;
+	int		highwater;		// most bytes ever in use
+} zarena_t;
+
+zarena_t	*z_arenas;
+zarena_t	*z_lastarena;		// most lookups are for the same tag
+byte		z_classforsize[Z_MAXSMALL/16+1];
+int			z_count, z_bytes;
+
+/*
+========================
+Z_FindArena
+========================
+*/
+zarena_t *Z_FindArena (int tag)
+{
+	zarena_t	*a;
+
+	if (z_lastarena && z_lastarena->tag == tag)
+		return z_lastarena;
+
+	for (a=z_arenas ; a ; a=a->next)
+		if (a->tag == tag)
+			return z_lastarena = a;
+
+	return NULL;
+}
+
+/*
+========================
+Z_Arena
+
+Finds or creates the tag's arena
+========================
+*/
+zarena_t *Z_Arena (int tag)
+{
+	zarena_t	*a;
+	int			i, c;
+
+	a = Z_FindArena (tag);
+	if (a)
+		return a;
+
+	// the first arena fills in the size class table
+	if (!z_arenas)
+	{
+		for (i=0, c=0 ; i<=Z_MAXSMALL/16 ; i++)
+		{
+			while (z_classsizes[c] < i*16)
+				c++;
+			z_classforsize[i] = c;
+		}
+	}
+
+	a = malloc (sizeof(*a));
+	if (!a)
+		Com_Error (ERR_FATAL, "Z_Arena: failed on allocation for tag %i", tag);
+	memset (a, 0, sizeof(*a));
+	a->tag = tag;
+	for (i=0 ; i<Z_NUMCLASSES ; i++)
+		a->slabs[i].next = a->slabs[i].prev = &a->slabs[i];
+	a->large.next = a->large.u.prev = &a->large;
+
+	a->next = z_arenas;
+	z_arenas = a;
+	return z_lastarena = a;
+}
+
+/*
+========================
+Z_LinkSlab
+========================
+*/
+void Z_LinkSlab (zslab_t *s, zslab_t *after)
+{
+	s->prev = after;
+	s->next = after->next;
+	after->next->prev = s;
+	after->next = s;
+}
+
+void Z_UnlinkSlab (zslab_t *s)
+{
+	s->prev->next = s->next;
+	s->next->prev = s->prev;
+}
 
 /*
 ========================
@@ -1115,19 +1686,61 @@ Z_Free
 */
 void Z_Free (void *ptr)
 {
-	zhead_t	*z;
+	zhead_t		*z;
+	zslab_t		*s;
+	zarena_t	*a;
 
 	z = ((zhead_t *)ptr) - 1;
 
-	if (z->magic != Z_MAGIC)
+	if (z->magic == Z_FREEMAGIC)
+		Com_Error (ERR_FATAL, "Z_Free: freed twice");
+	if (z->magic != Z_MAGIC && z->magic != Z_SLABMAGIC)
 		Com_Error (ERR_FATAL, "Z_Free: bad magic");
 
-	z->prev->next = z->next;
-	z->next->prev = z->prev;
-
 	z_count--;
 	z_bytes -= z->size;
-	free (z);
+
+	if (z->magic == Z_MAGIC)
+	{
+		a = Z_FindArena (z->tag);
+		a->count--;
+		a->bytes -= z->size;
+		a->largebytes -= z->size;
+
+		z->u.prev->next = z->next;
+		z->next->u.prev = z->u.prev;
+		free (z);
+		return;
+	}
+
+	s = z->u.slab;
+	a = s->arena;
+	a->count--;
+	a->bytes -= z->size;
+
+	// a full slab has room again, so goes to the front
+	if (s->used == s->numblocks)
+	{
+		Z_UnlinkSlab (s);
+		Z_LinkSlab (s, &a->slabs[s->sizeclass]);
+	}
+
+	z->magic = Z_FREEMAGIC;
+	z->next = s->free;
+	s->free = z;
+	s->used--;
+
+	if (!s->used)
+	{
+		if (!a->spare[s->sizeclass])
+		{
+			a->spare[s->sizeclass] = s;
+			return;
+		}
+		Z_UnlinkSlab (s);
+		a->numslabs--;
+		free (s);
+	}
 }
 
 
@@ -1138,24 +1751,62 @@ Z_Stats_f
 */
 void Z_Stats_f (void)
 {
+	zarena_t	*a;
+	int			held;
+
 	Com_Printf ("%i bytes in %i blocks\n", z_bytes, z_count);
+	Com_Printf ("  tag   blocks      bytes  highwater  slabs       held  frag\n");
+	for (a=z_arenas ; a ; a=a->next)
+	{
+		// fragmentation is what the arena holds beyond what is in use:
+		// slab space not handed out and blocks rounded up to their class
+		held = a->numslabs * Z_SLABSIZE + a->largebytes;
+		Com_Printf ("%5i %8i %10i %10i %6i %10i %4i%%\n", a->tag, a->count, a->bytes,
+			a->highwater, a->numslabs, held, held ? (int)(100.0 * (held - a->bytes) / held) : 0);
+	}
 }
 
 /*
 ========================
 Z_FreeTags
+
+Frees the arena's slabs and large blocks without visiting its small blocks
 ========================
 */
 void Z_FreeTags (int tag)
 {
-	zhead_t	*z, *next;
+	zarena_t	*a;
+	zslab_t		*s, *nexts;
+	zhead_t		*z, *next;
+	int			i;
+
+	a = Z_FindArena (tag);
+	if (!a)
+		return;
+
+	for (i=0 ; i<Z_NUMCLASSES ; i++)
+	{
+		for (s=a->slabs[i].next ; s != &a->slabs[i] ; s=nexts)
+		{
+			nexts = s->next;
+			free (s);
+		}
+		a->slabs[i].next = a->slabs[i].prev = &a->slabs[i];
+		a->spare[i] = NULL;
+	}
 
-	for (z=z_chain.next ; z != &z_chain ; z=next)
+	for (z=a->large.next ; z != &a->large ; z=next)
 	{
 		next = z->next;
-		if (z->tag == tag)
-			Z_Free ((void *)(z+1));
+		free (z);
 	}
+	a->large.next = a->large.u.prev = &a->large;
+
+	z_count -= a->count;
+	z_bytes -= a->bytes;
+	a->count = a->bytes = 0;
+	a->numslabs = 0;
+	a->largebytes = 0;
 }
 
 /*
@@ -1165,23 +1816,79 @@ Z_TagMalloc
 */
 void *Z_TagMalloc (int size, int tag)
 {
-	zhead_t	*z;
+	zarena_t	*a;
+	zslab_t		*s, *head;
+	zhead_t		*z;
+	int			c;
 	
 	size = size + sizeof(zhead_t);
-	z = malloc(size);
-	if (!z)
-		Com_Error (ERR_FATAL, "Z_Malloc: failed on allocation of %i bytes",size);
-	memset (z, 0, size);
-	z_count++;
-	z_bytes += size;
-	z->magic = Z_MAGIC;
+	a = Z_Arena (tag);
+
+	if (size > Z_MAXSMALL)
+	{
+		z = malloc(size);
+		if (!z)
+			Com_Error (ERR_FATAL, "Z_Malloc: failed on allocation of %i bytes",size);
+		memset (z, 0, size);
+		z->magic = Z_MAGIC;
+		a->largebytes += size;
+
+		z->next = a->large.next;
+		z->u.prev = &a->large;
+		a->large.next->u.prev = z;
+		a->large.next = z;
+	}
+	else
+	{
+		c = z_classforsize[(size + 15) >> 4];
+		head = &a->slabs[c];
+
+		// the first slab is the one with room, if any has
+		s = head->next;
+		if (s == head || s->used == s->numblocks)
+		{
+			s = malloc (Z_SLABSIZE);
+			if (!s)
+				Com_Error (ERR_FATAL, "Z_Malloc: failed on allocation of a slab for %i bytes",size);
+			memset (s, 0, sizeof(*s));
+			s->arena = a;
+			s->sizeclass = c;
+			s->numblocks = (Z_SLABSIZE - Z_SLABHEADER) / z_classsizes[c];
+			Z_LinkSlab (s, head);
+			a->numslabs++;
+		}
+		else if (s == a->spare[c])
+			a->spare[c] = NULL;		// not empty any more
+
+		if (s->free)
+		{
+			z = s->free;
+			s->free = z->next;
+		}
+		else
+			z = (zhead_t *)((byte *)s + Z_SLABHEADER + s->carved++ * z_classsizes[c]);
+
+		// a full slab goes to the back
+		if (++s->used == s->numblocks)
+		{
+			Z_UnlinkSlab (s);
+			Z_LinkSlab (s, head->prev);
+		}
+
+		memset (z, 0, size);
+		z->magic = Z_SLABMAGIC;
+		z->u.slab = s;
+	}
+
 	z->tag = tag;
 	z->size = size;
 
-	z->next = z_chain.next;
-	z->prev = &z_chain;
-	z_chain.next->prev = z;
-	z_chain.next = z;
+	z_count++;
+	z_bytes += size;
+	a->count++;
+	a->bytes += size;
+	if (a->bytes > a->highwater)
+		a->highwater = a->bytes;
 
 	return (void *)(z+1);
 }
@@ -1376,6 +2083,182 @@ float	crand(void)
 	return (rand()&32767)* (2.0/32767) - 1;
 }
 
+/*
+============================================================================
+
+PARALLEL JOBS
+
+The worker threads are started the first time they are needed and then
+sleep on a semaphore between batches, so a caller that runs jobs every
+frame doesn't pay for starting threads, and the collision context each
+worker makes when it first traces lasts as long as the worker does.  Only
+one batch at a time can have the workers.  A call that comes in while
+they are busy, from another thread or from inside a job, starts threads
+of its own for the batch the way it always did.
+
+============================================================================
+*/
+
+#define	MAX_JOB_THREADS		16
+
+typedef struct
+{
+	void	(*job) (int index, void *data);
+	void	*data;
+	int		count;
+	volatile int	next;		// claimed with Sys_AtomicIncrement
+} jobset_t;
+
+typedef struct
+{
+	volatile int	busy;		// claimed with Sys_AtomicIncrement, 1 = ours
+	void		*wake;			// posted once for each worker a batch wants
+	void		*done;			// posted by each worker when it runs out of jobs
+	int			numworkers;
+	jobset_t	*set;			// the batch being worked on
+} jobpool_t;
+
+jobpool_t	com_jobpool;
+
+/*
+=================
+Com_RunJobs
+
+Takes jobs until there are none left
+=================
+*/
+void Com_RunJobs (jobset_t *set)
+{
+	int		index;
+
+	while (1)
+	{
+		index = Sys_AtomicIncrement (&set->next) - 1;
+		if (index >= set->count)
+			break;
+		set->job (index, set->data);
+	}
+}
+
+void Com_JobThread (void *data)
+{
+	Com_RunJobs ((jobset_t *)data);
+	CM_FreeThreadContext ();		// in case the jobs traced
+}
+
+/*
+=================
+Com_WorkerThread
+
+A pool worker, it never exits
+=================
+*/
+void Com_WorkerThread (void *data)
+{
+	while (1)
+	{
+		Sys_WaitSemaphore (com_jobpool.wake);
+		Com_RunJobs (com_jobpool.set);
+		Sys_PostSemaphore (com_jobpool.done, 1);
+	}
+}
+
+/*
+=================
+Com_PoolJobs
+
+Runs the set on the caller and numworkers pool workers, starting more
+workers if there aren't enough yet.  False if the pool couldn't be used.
+=================
+*/
+qboolean Com_PoolJobs (jobset_t *set, int numworkers)
+{
+	int		i;
+
+	if (Sys_AtomicIncrement (&com_jobpool.busy) != 1)
+		return qFalse;		// the workers are on someone else's batch
+
+	if (!com_jobpool.wake)
+	{
+		com_jobpool.wake = Sys_CreateSemaphore ();
+		com_jobpool.done = Sys_CreateSemaphore ();
+	}
+	if (!com_jobpool.wake || !com_jobpool.done)
+	{
+		com_jobpool.busy = 0;
+		return qFalse;
+	}
+
+	while (com_jobpool.numworkers < numworkers)
+	{
+		if (!Sys_CreateThread (Com_WorkerThread, NULL))
+			break;
+		com_jobpool.numworkers++;
+	}
+	if (numworkers > com_jobpool.numworkers)
+		numworkers = com_jobpool.numworkers;
+
+	// the semaphores order the set against the workers' reads of it
+	com_jobpool.set = set;
+	Sys_PostSemaphore (com_jobpool.wake, numworkers);
+
+	Com_RunJobs (set);
+
+	for (i=0 ; i<numworkers ; i++)
+		Sys_WaitSemaphore (com_jobpool.done);
+
+	com_jobpool.set = NULL;
+	com_jobpool.busy = 0;
+	return qTrue;
+}
+
+/*
+=================
+Com_ParallelJobs
+=================
+*/
+void Com_ParallelJobs (int count, void (*job) (int index, void *data), void *data)
+{
+	jobset_t	set;
+	void		*threads[MAX_JOB_THREADS];
+	int			i, numthreads;
+
+	if (com_threads && com_threads->value)
+		numthreads = com_threads->value;
+	else
+		numthreads = Sys_NumProcessors ();
+	if (numthreads > MAX_JOB_THREADS)
+		numthreads = MAX_JOB_THREADS;
+	if (numthreads > count)
+		numthreads = count;
+
+	set.job = job;
+	set.data = data;
+	set.count = count;
+	set.next = 0;
+
+	if (numthreads <= 1)
+	{
+		Com_RunJobs (&set);
+		return;
+	}
+
+	// the calling thread is one of the workers
+	if (Com_PoolJobs (&set, numthreads-1))
+		return;
+
+	for (i=0 ; i<numthreads-1 ; i++)
+		threads[i] = Sys_CreateThread (Com_JobThread, &set);
+
+	Com_RunJobs (&set);
+
+	for (i=0 ; i<numthreads-1 ; i++)
+	{
+		if (threads[i])
+			Sys_WaitThread (threads[i]);
+	}
+}
+
 void Key_Init (void);
 void SCR_EndLoadingPlaque (void);
 
@@ -1405,8 +2288,6 @@ void Qcommon_Init (int argc, char **argv)
 	if (setjmp (abortframe) )
 		Sys_Error ("Error during initialization");
 
-	z_chain.next = z_chain.prev = &z_chain;
-
 	// prepare enough of the subsystems to handle
 	// cvar and command buffer management
 	COM_InitArgv (argc, argv);
@@ -1439,6 +2320,7 @@ void Qcommon_Init (int argc, char **argv)
 	//
     Cmd_AddCommand ("z_stats", Z_Stats_f);
     Cmd_AddCommand ("error", Com_Error_f);
+	Cmd_AddCommand ("crc_bench", CRC_Bench_f);
 
 	host_speeds = Cvar_Get ("host_speeds", "0", 0);
 	log_stats = Cvar_Get ("log_stats", "0", 0);
@@ -1447,6 +2329,7 @@ void Qcommon_Init (int argc, char **argv)
 	fixedtime = Cvar_Get ("fixedtime", "0", 0);
 	logfile_active = Cvar_Get ("logfile", "0", 0);
 	showtrace = Cvar_Get ("showtrace", "0", 0);
+	com_threads = Cvar_Get ("com_threads", "0", CVAR_ARCHIVE);
 #ifdef DEDICATED_ONLY
 	dedicated = Cvar_Get ("dedicated", "1", CVAR_NOSET);
 #else
@@ -23,6 +23,42 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 cvar_t	*cvar_vars;
 
+#define	CVAR_HASH_SIZE	256		// power of two
+
+static cvar_t	*cvar_hash[CVAR_HASH_SIZE];
+int				cvar_modifiedcount;
+
+/*
+============
+Cvar_HashName
+
+Names are case sensitive, like the strcmp in Cvar_FindVar
+============
+*/
+static unsigned Cvar_HashName (char *name)
+{
+	unsigned	hash;
+
+	hash = 0;
+	while (*name)
+		hash = hash * 31 + *name++;
+
+	return hash & (CVAR_HASH_SIZE-1);
+}
+
+/*
+============
+Cvar_Modified
+
+Bumps the generation count for any change that shows through
+Cvar_VariableValue, Cvar_VariableString or the info strings
+============
+*/
+static void Cvar_Modified (cvar_t *var)
+{
+	var->modifiedcount = ++cvar_modifiedcount;
+}
+
 /*
 ============
 Cvar_InfoValidate
@@ -48,7 +84,7 @@ static cvar_t *Cvar_FindVar (char *var_name)
 {
 	cvar_t	*var;
 	
-	for (var=cvar_vars ; var ; var=var->next)
+	for (var=cvar_hash[Cvar_HashName (var_name)] ; var ; var=var->hashnext)
 		if (!strcmp (var_name, var->name))
 			return var;
 
@@ -67,7 +103,7 @@ float Cvar_VariableValue (char *var_name)
 	var = Cvar_FindVar (var_name);
 	if (!var)
 		return 0;
-	return atof (var->string);
+	return var->value;		// parsed whenever the string is set
 }
 
 
@@ -103,9 +139,9 @@ char *Cvar_CompleteVariable (char *partial)
 		return NULL;
 		
 	// check exact match
-	for (cvar=cvar_vars ; cvar ; cvar=cvar->next)
-		if (!strcmp (partial,cvar->name))
-			return cvar->name;
+	cvar = Cvar_FindVar (partial);
+	if (cvar)
+		return cvar->name;
 
 	// check partial match
 	for (cvar=cvar_vars ; cvar ; cvar=cvar->next)
@@ -140,7 +176,11 @@ cvar_t *Cvar_Get (char *var_name, char *var_value, int flags)
 	var = Cvar_FindVar (var_name);
 	if (var)
 	{
-		var->flags |= flags;
+		if ((var->flags | flags) != var->flags)
+		{
+			var->flags |= flags;
+			Cvar_Modified (var);
+		}
 		return var;
 	}
 
@@ -165,8 +205,11 @@ cvar_t *Cvar_Get (char *var_name, char *var_value, int flags)
 	// link the variable in
 	var->next = cvar_vars;
 	cvar_vars = var;
+	var->hashnext = cvar_hash[Cvar_HashName (var_name)];
+	cvar_hash[Cvar_HashName (var_name)] = var;
 
 	var->flags = flags;
+	Cvar_Modified (var);
 
 	return var;
 }
@@ -226,6 +269,7 @@ cvar_t *Cvar_Set2 (char *var_name, char *value, qboolean force)
 			{
 				var->string = CopyString(value);
 				var->value = atof (var->string);
+				Cvar_Modified (var);
 				if (!strcmp(var->name, "game"))
 				{
 					FS_SetGamedir (var->string);
@@ -256,6 +300,7 @@ cvar_t *Cvar_Set2 (char *var_name, char *value, qboolean force)
 	
 	var->string = CopyString(value);
 	var->value = atof (var->string);
+	Cvar_Modified (var);
 
 	return var;
 }
@@ -305,6 +350,7 @@ cvar_t *Cvar_FullSet (char *var_name, char *value, int flags)
 	var->string = CopyString(value);
 	var->value = atof (var->string);
 	var->flags = flags;
+	Cvar_Modified (var);
 
 	return var;
 }
@@ -345,6 +391,7 @@ void Cvar_GetLatchedVars (void)
 		var->string = var->latched_string;
 		var->latched_string = NULL;
 		var->value = atof(var->string);
+		Cvar_Modified (var);
 		if (!strcmp(var->name, "game"))
 		{
 			FS_SetGamedir (var->string);
@@ -485,31 +532,44 @@ void Cvar_List_f (void)
 qboolean userinfo_modified;
 
 
-char	*Cvar_BitInfo (int bit)
+typedef struct
+{
+	char	info[MAX_INFO_STRING];
+	int		modifiedcount;		// cvar_modifiedcount info was built at
+} cvarinfo_t;
+
+static cvarinfo_t	cvar_userinfo, cvar_serverinfo;
+
+// status packets ask for the serverinfo at whatever rate remote hosts
+// like, so the string is only rebuilt after some cvar has changed
+static char *Cvar_BitInfo (int bit, cvarinfo_t *cache)
 {
-	static char	info[MAX_INFO_STRING];
 	cvar_t	*var;
 
-	info[0] = 0;
+	if (cache->modifiedcount == cvar_modifiedcount && cache->modifiedcount)
+		return cache->info;
+
+	cache->info[0] = 0;
+	cache->modifiedcount = cvar_modifiedcount;
 
 	for (var = cvar_vars ; var ; var = var->next)
 	{
 		if (var->flags & bit)
-			Info_SetValueForKey (info, var->name, var->string);
+			Info_SetValueForKey (cache->info, var->name, var->string);
 	}
-	return info;
+	return cache->info;
 }
 
 // returns an info string containing all the CVAR_USERINFO cvars
 char	*Cvar_Userinfo (void)
 {
-	return Cvar_BitInfo (CVAR_USERINFO);
+	return Cvar_BitInfo (CVAR_USERINFO, &cvar_userinfo);
 }
 
 // returns an info string containing all the CVAR_SERVERINFO cvars
 char	*Cvar_Serverinfo (void)
 {
-	return Cvar_BitInfo (CVAR_SERVERINFO);
+	return Cvar_BitInfo (CVAR_SERVERINFO, &cvar_serverinfo);
 }
 
 /*
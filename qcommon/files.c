@@ -48,6 +48,8 @@ typedef struct
 {
 	char	name[MAX_QPATH];
 	int		filepos, filelen;
+	int		disklen;		// differs from filelen in a .pkz
+	int		hashnext;		// next file in the same hash chain, -1 at the end
 } packfile_t;
 
 typedef struct pack_s
@@ -56,6 +58,9 @@ typedef struct pack_s
 	FILE	*handle;
 	int		numfiles;
 	packfile_t	*files;
+	qboolean	compressed;	// a .pkz
+	int		hashsize;		// power of two
+	int		*hashtable;		// first file of each chain, -1 if empty
 } pack_t;
 
 char	fs_gamedir[MAX_OSPATH];
@@ -115,6 +120,51 @@ int FS_filelength (FILE *f)
 }
 
 
+/*
+================
+FS_HashFileName
+
+Case insensitive, like the Q_strcasecmp used to compare the names
+================
+*/
+unsigned FS_HashFileName (char *name)
+{
+	unsigned	hash;
+	int			c;
+
+	hash = 0;
+	while (*name)
+	{
+		c = *name++;
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		hash = hash * 31 + c;
+	}
+
+	return hash;
+}
+
+/*
+================
+FS_FindPackFile
+
+Returns the first file in the pak with the name, NULL if there is none
+================
+*/
+packfile_t *FS_FindPackFile (pack_t *pak, char *filename)
+{
+	int		i;
+
+	for (i = pak->hashtable[FS_HashFileName (filename) & (pak->hashsize-1)] ; i != -1 ; i = pak->files[i].hashnext)
+	{
+		if (!Q_strcasecmp (pak->files[i].name, filename))
+			return &pak->files[i];
+	}
+
+	return NULL;
+}
+
+
 /*
 ============
 FS_CreatePath
@@ -193,25 +243,25 @@ int	Developer_searchpath (int who)
 
 /*
 ===========
-FS_FOpenFile
+FS_OpenFile
 
 Finds the file in the search path.
-returns filesize and an open FILE *
-Used for streaming data out of either a pak file or
-a seperate file.
+returns filesize and fills in file, which reads a pak entry through
+the handle its pak keeps open for the session
 ===========
 */
 int file_from_pak = 0;
 #ifndef NO_ADDONS
-int FS_FOpenFile (char *filename, FILE **file)
+int FS_OpenFile (char *filename, fsfile_t *file)
 {
 	searchpath_t	*search;
 	char			netpath[MAX_OSPATH];
 	pack_t			*pak;
-	int				i;
+	packfile_t		*pakfile;
 	filelink_t		*link;
 
 	file_from_pak = 0;
+	memset (file, 0, sizeof(*file));
 
 	// check for links first
 	for (link = fs_links ; link ; link=link->next)
@@ -219,11 +269,12 @@ int FS_FOpenFile (char *filename, FILE **file)
 		if (!strncmp (filename, link->from, link->fromlength))
 		{
 			Com_sprintf (netpath, sizeof(netpath), "%s%s",link->to, filename+link->fromlength);
-			*file = fopen (netpath, "rb");
-			if (*file)
+			file->handle = fopen (netpath, "rb");
+			if (file->handle)
 			{		
 				Com_DPrintf ("link file: %s\n",netpath);
-				return FS_filelength (*file);
+				file->length = file->disklen = FS_filelength (file->handle);
+				return file->length;
 			}
 			return -1;
 		}
@@ -237,20 +288,20 @@ int FS_FOpenFile (char *filename, FILE **file)
 	// is the element a pak file?
 		if (search->pack)
 		{
-		// look through all the pak file elements
+		// look the name up in the pak's directory
 			pak = search->pack;
-			for (i=0 ; i<pak->numfiles ; i++)
-				if (!Q_strcasecmp (pak->files[i].name, filename))
-				{	// found it!
-					file_from_pak = 1;
-					Com_DPrintf ("PackFile: %s : %s\n",pak->filename, filename);
-				// open a new file on the pakfile
-					*file = fopen (pak->filename, "rb");
-					if (!*file)
-						Com_Error (ERR_FATAL, "Couldn't reopen %s", pak->filename);	
-					fseek (*file, pak->files[i].filepos, SEEK_SET);
-					return pak->files[i].filelen;
-				}
+			pakfile = FS_FindPackFile (pak, filename);
+			if (pakfile)
+			{	// found it!
+				file_from_pak = 1;
+				Com_DPrintf ("PackFile: %s : %s\n",pak->filename, filename);
+				file->handle = pak->handle;
+				file->pack = pak;
+				file->offset = pakfile->filepos;
+				file->length = pakfile->filelen;
+				file->disklen = pakfile->disklen;
+				return file->length;
+			}
 		}
 		else
 		{		
@@ -258,20 +309,20 @@ int FS_FOpenFile (char *filename, FILE **file)
 			
 			Com_sprintf (netpath, sizeof(netpath), "%s/%s",search->filename, filename);
 			
-			*file = fopen (netpath, "rb");
-			if (!*file)
+			file->handle = fopen (netpath, "rb");
+			if (!file->handle)
 				continue;
 			
 			Com_DPrintf ("FindFile: %s\n",netpath);
 
-			return FS_filelength (*file);
+			file->length = file->disklen = FS_filelength (file->handle);
+			return file->length;
 		}
 		
 	}
 	
 	Com_DPrintf ("FindFile: can't find %s\n", filename);
 	
-	*file = NULL;
 	return -1;
 }
 
@@ -279,60 +330,852 @@ int FS_FOpenFile (char *filename, FILE **file)
 
 // this is just for demos to prevent add on hacking
 
-int FS_FOpenFile (char *filename, FILE **file)
+int FS_OpenFile (char *filename, fsfile_t *file)
 {
 	searchpath_t	*search;
 	char			netpath[MAX_OSPATH];
 	pack_t			*pak;
-	int				i;
+	packfile_t		*pakfile;
 
 	file_from_pak = 0;
+	memset (file, 0, sizeof(*file));
 
 	// get config from directory, everything else from pak
 	if (!strcmp(filename, "config.cfg") || !strncmp(filename, "players/", 8))
 	{
 		Com_sprintf (netpath, sizeof(netpath), "%s/%s",FS_Gamedir(), filename);
 		
-		*file = fopen (netpath, "rb");
-		if (!*file)
+		file->handle = fopen (netpath, "rb");
+		if (!file->handle)
 			return -1;
 		
 		Com_DPrintf ("FindFile: %s\n",netpath);
 
-		return FS_filelength (*file);
+		file->length = file->disklen = FS_filelength (file->handle);
+		return file->length;
 	}
 
 	for (search = fs_searchpaths ; search ; search = search->next)
 		if (search->pack)
 			break;
 	if (!search)
-	{
-		*file = NULL;
 		return -1;
-	}
 
 	pak = search->pack;
-	for (i=0 ; i<pak->numfiles ; i++)
-		if (!Q_strcasecmp (pak->files[i].name, filename))
-		{	// found it!
-			file_from_pak = 1;
-			Com_DPrintf ("PackFile: %s : %s\n",pak->filename, filename);
-		// open a new file on the pakfile
-			*file = fopen (pak->filename, "rb");
-			if (!*file)
-				Com_Error (ERR_FATAL, "Couldn't reopen %s", pak->filename);	
-			fseek (*file, pak->files[i].filepos, SEEK_SET);
-			return pak->files[i].filelen;
-		}
+	pakfile = FS_FindPackFile (pak, filename);
+	if (pakfile)
+	{	// found it!
+		file_from_pak = 1;
+		Com_DPrintf ("PackFile: %s : %s\n",pak->filename, filename);
+		file->handle = pak->handle;
+		file->pack = pak;
+		file->offset = pakfile->filepos;
+		file->length = pakfile->filelen;
+		file->disklen = pakfile->disklen;
+		return file->length;
+	}
 	
 	Com_DPrintf ("FindFile: can't find %s\n", filename);
 	
-	*file = NULL;
 	return -1;
 }
 
 #endif
 
+/*
+===========
+FS_FOpenFile
+
+Finds the file in the search path.
+returns filesize and an open FILE *
+Used for streaming data out of either a pak file or
+a seperate file.
+===========
+*/
+int FS_FOpenFile (char *filename, FILE **file)
+{
+	fsfile_t	f;
+	byte		*buf;
+
+	if (FS_OpenFile (filename, &f) == -1)
+	{
+		*file = NULL;
+		return -1;
+	}
+
+	if (!f.pack)
+	{
+		*file = f.handle;
+		return f.length;
+	}
+
+	// a compressed file is streamed from a temporary copy
+	if (f.pack->compressed)
+	{
+		buf = Z_Malloc (f.length + 1);
+		if (FS_ReadAt (&f, buf, f.length, 0) != f.length)
+			Com_Error (ERR_FATAL, "FS_FOpenFile: %s is corrupt in %s", filename, f.pack->filename);
+		*file = tmpfile ();
+		if (!*file)
+			Com_Error (ERR_FATAL, "FS_FOpenFile: couldn't create a temporary file");
+		fwrite (buf, 1, f.length, *file);
+		rewind (*file);
+		Z_Free (buf);
+		return f.length;
+	}
+
+	// a stream has a position of its own, so it can't share the pak's handle
+	*file = fopen (f.pack->filename, "rb");
+	if (!*file)
+		Com_Error (ERR_FATAL, "Couldn't reopen %s", f.pack->filename);	
+	fseek (*file, f.offset, SEEK_SET);
+	return f.length;
+}
+
+/*
+=============================================================================
+
+COMPRESSED PAKS
+
+=============================================================================
+*/
+
+#define	ZPAK_HASHBITS	14
+
+/*
+================
+FS_WriteSequence
+
+Returns the new output size, -1 if the sequence doesn't fit
+================
+*/
+static int FS_WriteSequence (byte *out, int outsize, int outmax, byte *literals, int numliterals, int offset, int matchlen)
+{
+	byte	*token;
+	int		len;
+
+	// token, literals, offset and up to 255 bytes of lengths each
+	if (outsize + 1 + numliterals + 2 + (numliterals + matchlen) / 255 + 2 > outmax)
+		return -1;
+
+	token = &out[outsize++];
+	*token = (numliterals < 15 ? numliterals : 15) << 4;
+	if (numliterals >= 15)
+	{
+		for (len = numliterals - 15 ; len >= 255 ; len -= 255)
+			out[outsize++] = 255;
+		out[outsize++] = len;
+	}
+	memcpy (out + outsize, literals, numliterals);
+	outsize += numliterals;
+
+	if (!matchlen)
+		return outsize;		// the last sequence
+
+	out[outsize++] = offset & 255;
+	out[outsize++] = offset >> 8;
+	matchlen -= ZPAK_MINMATCH;
+	*token |= matchlen < 15 ? matchlen : 15;
+	if (matchlen >= 15)
+	{
+		for (len = matchlen - 15 ; len >= 255 ; len -= 255)
+			out[outsize++] = 255;
+		out[outsize++] = len;
+	}
+
+	return outsize;
+}
+
+/*
+================
+FS_CompressChunk
+
+Greedy LZ77 over a hash of the next ZPAK_MINMATCH bytes.
+Returns the compressed size, -1 if it would be more than outmax.
+================
+*/
+int FS_CompressChunk (byte *in, int inlen, byte *out, int outmax)
+{
+	int			table[1<<ZPAK_HASHBITS];
+	int			ip, anchor, outsize;
+	int			ref, matchlen;
+	unsigned	seq;
+
+	memset (table, -1, sizeof(table));
+	ip = anchor = outsize = 0;
+
+	while (ip + ZPAK_MINMATCH <= inlen)
+	{
+		seq = in[ip] | (in[ip+1]<<8) | (in[ip+2]<<16) | (in[ip+3]<<24);
+		seq = (seq * 2654435761u) >> (32 - ZPAK_HASHBITS);
+		ref = table[seq];
+		table[seq] = ip;
+		if (ref < 0 || ip - ref > 0xffff || memcmp (in + ref, in + ip, ZPAK_MINMATCH))
+		{
+			ip++;
+			continue;
+		}
+
+		for (matchlen = ZPAK_MINMATCH ; ip + matchlen < inlen && in[ref+matchlen] == in[ip+matchlen] ; matchlen++)
+			;
+		outsize = FS_WriteSequence (out, outsize, outmax, in + anchor, ip - anchor, ip - ref, matchlen);
+		if (outsize < 0)
+			return -1;
+		ip += matchlen;
+		anchor = ip;
+	}
+
+	return FS_WriteSequence (out, outsize, outmax, in + anchor, inlen - anchor, 0, 0);
+}
+
+/*
+================
+FS_DecompressChunk
+
+The data comes from disk or a download, so every length and offset is
+checked.  Returns qFalse unless it decodes to exactly outlen bytes.
+================
+*/
+qboolean FS_DecompressChunk (byte *in, int inlen, byte *out, int outlen)
+{
+	int		ip, op;
+	int		token, len, offset, c;
+	byte	*match;
+
+	ip = op = 0;
+	while (ip < inlen)
+	{
+		token = in[ip++];
+
+		len = token >> 4;
+		if (len == 15)
+		{
+			do
+			{
+				if (ip == inlen)
+					return qFalse;
+				c = in[ip++];
+				len += c;
+			} while (c == 255);
+		}
+		if (len > inlen - ip || len > outlen - op)
+			return qFalse;
+		memcpy (out + op, in + ip, len);
+		ip += len;
+		op += len;
+
+		if (ip == inlen)
+			break;		// the last sequence has no match
+
+		if (inlen - ip < 2)
+			return qFalse;
+		offset = in[ip] | (in[ip+1]<<8);
+		ip += 2;
+		if (!offset || offset > op)
+			return qFalse;
+
+		len = (token & 15) + ZPAK_MINMATCH;
+		if ((token & 15) == 15)
+		{
+			do
+			{
+				if (ip == inlen)
+					return qFalse;
+				c = in[ip++];
+				len += c;
+			} while (c == 255);
+		}
+		if (len > outlen - op)
+			return qFalse;
+
+		// matches closer than their length repeat themselves
+		match = out + op - offset;
+		if (offset >= len)
+			memcpy (out + op, match, len);
+		else
+			for (c=0 ; c<len ; c++)
+				out[op+c] = match[c];
+		op += len;
+	}
+
+	return op == outlen;
+}
+
+typedef struct
+{
+	byte	*comp;			// the compressed chunks being read
+	int		*starts;		// of each chunk in comp, and the end of the last
+	int		firstchunk;
+	int		filelen;
+	byte	*out;			// receives [offset, offset+len) of the file
+	int		offset, len;
+	volatile int	failed;
+} inflatejob_t;
+
+/*
+================
+FS_InflateJob
+================
+*/
+void FS_InflateJob (int index, void *data)
+{
+	inflatejob_t	*job;
+	int				start, size, complen;
+	int				from, to;
+	byte			*comp, *dest, *temp;
+
+	job = (inflatejob_t *)data;
+
+	start = (job->firstchunk + index) * ZPAK_CHUNKSIZE;
+	size = job->filelen - start;
+	if (size > ZPAK_CHUNKSIZE)
+		size = ZPAK_CHUNKSIZE;
+	comp = job->comp + job->starts[index] - job->starts[0];
+	complen = job->starts[index+1] - job->starts[index];
+
+	// chunks the read only partly covers go through a buffer of their own
+	temp = NULL;
+	if (start >= job->offset && start + size <= job->offset + job->len)
+		dest = job->out + start - job->offset;
+	else
+		dest = temp = malloc (size);
+	if (!dest)
+	{
+		job->failed = qTrue;
+		return;
+	}
+
+	if (complen == size)
+		memcpy (dest, comp, size);
+	else if (complen > size || !FS_DecompressChunk (comp, complen, dest, size))
+		job->failed = qTrue;
+
+	if (temp)
+	{
+		from = start > job->offset ? start : job->offset;
+		to = start + size < job->offset + job->len ? start + size : job->offset + job->len;
+		memcpy (job->out + from - job->offset, temp + from - start, to - from);
+		free (temp);
+	}
+}
+
+/*
+================
+FS_ReadCompressed
+
+FS_ReadAt for a file in a .pkz.  Reads the chunks covering the range
+in one go and decompresses them in parallel.  Uses malloc rather than the
+zone, which isn't thread safe.
+================
+*/
+int FS_ReadCompressed (fsfile_t *file, void *buffer, int len, int offset)
+{
+	inflatejob_t	job;
+	int				numchunks, first, last, count;
+	int				i, read, tablelen, complen;
+
+	numchunks = (file->length + ZPAK_CHUNKSIZE - 1) / ZPAK_CHUNKSIZE;
+	tablelen = numchunks * sizeof(int);
+	first = offset / ZPAK_CHUNKSIZE;
+	last = (offset + len - 1) / ZPAK_CHUNKSIZE;
+	count = last - first + 1;
+
+	// the table holds the end of each chunk, so the one before the
+	// first chunk is where it starts
+	job.starts = malloc ((count + 1) * sizeof(int));
+	job.starts[0] = 0;
+	if (first)
+		read = Sys_ReadFileAt (file->handle, job.starts, (count + 1) * sizeof(int), file->offset + (first - 1) * sizeof(int));
+	else
+		read = Sys_ReadFileAt (file->handle, job.starts + 1, count * sizeof(int), file->offset) + sizeof(int);
+	if (read != (count + 1) * sizeof(int))
+	{
+		free (job.starts);
+		return 0;
+	}
+	for (i=first ? 0 : 1 ; i<=count ; i++)
+		job.starts[i] = LittleLong (job.starts[i]);
+	for (i=0 ; i<count ; i++)
+	{
+		if (job.starts[i] > job.starts[i+1])
+			break;
+	}
+	complen = job.starts[count] - job.starts[0];
+	if (i < count || job.starts[0] < 0 || tablelen + job.starts[count] > file->disklen)
+	{
+		free (job.starts);
+		return 0;
+	}
+
+	job.comp = malloc (complen ? complen : 1);
+	if (!job.comp)
+	{
+		free (job.starts);
+		return 0;
+	}
+	for (read = 0 ; read < complen ; )
+	{
+		i = Sys_ReadFileAt (file->handle, job.comp + read, complen - read, file->offset + tablelen + job.starts[0] + read);
+		if (i <= 0)
+			break;
+		read += i;
+	}
+
+	job.firstchunk = first;
+	job.filelen = file->length;
+	job.out = buffer;
+	job.offset = offset;
+	job.len = len;
+	job.failed = read != complen;
+
+	if (!job.failed)
+	{
+		if (count > 1)
+			Com_ParallelJobs (count, FS_InflateJob, &job);
+		else
+			FS_InflateJob (0, &job);
+	}
+
+	free (job.comp);
+	free (job.starts);
+
+	return job.failed ? 0 : len;
+}
+
+typedef struct
+{
+	byte	*data;
+	int		length;
+	byte	*out;			// ZPAK_CHUNKSIZE for each chunk
+	int		*outlens;
+} deflatejob_t;
+
+/*
+================
+FS_DeflateJob
+================
+*/
+void FS_DeflateJob (int index, void *data)
+{
+	deflatejob_t	*job;
+	int				start, size;
+
+	job = (deflatejob_t *)data;
+
+	start = index * ZPAK_CHUNKSIZE;
+	size = job->length - start;
+	if (size > ZPAK_CHUNKSIZE)
+		size = ZPAK_CHUNKSIZE;
+
+	// it has to come out smaller, or it is stored
+	job->outlens[index] = FS_CompressChunk (job->data + start, size, job->out + start, size - 1);
+	if (job->outlens[index] < 0)
+	{
+		memcpy (job->out + start, job->data + start, size);
+		job->outlens[index] = size;
+	}
+}
+
+/*
+================
+FS_CompressPak_f
+
+compresspak <pakfile>
+
+Writes a .pkz with the same contents next to the .pak
+================
+*/
+void FS_CompressPak_f (void)
+{
+	dpackheader_t	header;
+	dpackfile_t		*info;
+	dzpackfile_t	*zinfo;
+	deflatejob_t	job;
+	FILE			*in, *out;
+	char			name[MAX_OSPATH];
+	int				i, j, numfiles, numchunks, filepos;
+	int				total, totalcomp;
+
+	if (Cmd_Argc() != 2)
+	{
+		Com_Printf ("usage: compresspak <pakfile>\n");
+		return;
+	}
+
+	in = fopen (Cmd_Argv(1), "rb");
+	if (!in)
+	{
+		Com_Printf ("Couldn't open %s\n", Cmd_Argv(1));
+		return;
+	}
+	if (fread (&header, 1, sizeof(header), in) != sizeof(header) || LittleLong(header.ident) != IDPAKHEADER)
+	{
+		Com_Printf ("%s is not a packfile\n", Cmd_Argv(1));
+		fclose (in);
+		return;
+	}
+	header.dirofs = LittleLong (header.dirofs);
+	header.dirlen = LittleLong (header.dirlen);
+	numfiles = header.dirlen / sizeof(dpackfile_t);
+	if (numfiles < 0 || numfiles > MAX_FILES_IN_PACK)
+	{
+		Com_Printf ("%s has %i files\n", Cmd_Argv(1), numfiles);
+		fclose (in);
+		return;
+	}
+
+	COM_StripExtension (Cmd_Argv(1), name);
+	strcat (name, ".pkz");
+	out = fopen (name, "wb");
+	if (!out)
+	{
+		Com_Printf ("Couldn't write %s\n", name);
+		fclose (in);
+		return;
+	}
+
+	info = Z_Malloc (numfiles * sizeof(dpackfile_t) + 1);
+	zinfo = Z_Malloc (numfiles * sizeof(dzpackfile_t) + 1);
+	fseek (in, header.dirofs, SEEK_SET);
+	fread (info, 1, numfiles * sizeof(dpackfile_t), in);
+
+	// the header is rewritten once the directory's place is known
+	fwrite (&header, 1, sizeof(header), out);
+	filepos = sizeof(header);
+	total = totalcomp = 0;
+
+	for (i=0 ; i<numfiles ; i++)
+	{
+		memcpy (zinfo[i].name, info[i].name, sizeof(zinfo[i].name));
+		job.length = LittleLong (info[i].filelen);
+		numchunks = (job.length + ZPAK_CHUNKSIZE - 1) / ZPAK_CHUNKSIZE;
+
+		job.data = Z_Malloc (job.length + 1);
+		job.out = Z_Malloc (job.length + 1);
+		job.outlens = Z_Malloc (numchunks * sizeof(int) + 1);
+		fseek (in, LittleLong (info[i].filepos), SEEK_SET);
+		if (fread (job.data, 1, job.length, in) != job.length)
+			Com_Printf ("WARNING: %s is short\n", info[i].name);
+
+		Com_ParallelJobs (numchunks, FS_DeflateJob, &job);
+
+		// the chunk table, then the chunks
+		zinfo[i].filepos = LittleLong (filepos);
+		zinfo[i].filelen = LittleLong (job.length);
+		zinfo[i].disklen = numchunks * sizeof(int);
+		for (j=0 ; j<numchunks ; j++)
+		{
+			zinfo[i].disklen += job.outlens[j];
+			job.outlens[j] = LittleLong (zinfo[i].disklen - numchunks * sizeof(int));
+		}
+		fwrite (job.outlens, sizeof(int), numchunks, out);
+		for (j=0 ; j<numchunks ; j++)
+			fwrite (job.out + j * ZPAK_CHUNKSIZE, 1, LittleLong (job.outlens[j]) - (j ? LittleLong (job.outlens[j-1]) : 0), out);
+
+		filepos += zinfo[i].disklen;
+		total += job.length;
+		totalcomp += zinfo[i].disklen;
+		zinfo[i].disklen = LittleLong (zinfo[i].disklen);
+
+		Z_Free (job.data);
+		Z_Free (job.out);
+		Z_Free (job.outlens);
+	}
+
+	fwrite (zinfo, sizeof(dzpackfile_t), numfiles, out);
+	header.ident = LittleLong (IDZPAKHEADER);
+	header.dirofs = LittleLong (filepos);
+	header.dirlen = LittleLong (numfiles * sizeof(dzpackfile_t));
+	fseek (out, 0, SEEK_SET);
+	fwrite (&header, 1, sizeof(header), out);
+
+	fclose (out);
+	fclose (in);
+	Z_Free (info);
+	Z_Free (zinfo);
+
+	Com_Printf ("Wrote %s: %i files, %i bytes to %i\n", name, numfiles, total, totalcomp);
+}
+
+/*
+===========
+FS_ReadAt
+
+Reads len bytes from offset into the file without touching any stream
+position, so jobs on other threads can read from the same pak at once.
+Doesn't error, so it can be called from them; returns bytes read
+===========
+*/
+int FS_ReadAt (fsfile_t *file, void *buffer, int len, int offset)
+{
+	int		read, total;
+
+	if (offset < 0 || offset >= file->length)
+		return 0;
+	if (len > file->length - offset)
+		len = file->length - offset;
+	if (len <= 0)
+		return 0;
+
+	if (file->pack && file->pack->compressed)
+		return FS_ReadCompressed (file, buffer, len, offset);
+
+	for (total = 0 ; total < len ; total += read)
+	{
+		read = Sys_ReadFileAt (file->handle, (byte *)buffer + total, len - total, file->offset + offset + total);
+		if (read <= 0)
+			break;
+	}
+
+	return total;
+}
+
+/*
+===========
+FS_CloseFile
+===========
+*/
+void FS_CloseFile (fsfile_t *file)
+{
+	// the pak owns its handle
+	if (file->handle && !file->pack)
+		fclose (file->handle);
+	file->handle = NULL;
+}
+
+
+/*
+=============================================================================
+
+MAP PREFETCH
+
+While a map loads, the names of the files FS_LoadFile and FS_MapFile
+serve are recorded in order and saved as prefetch/<map>.txt in the game
+dir.  The next time that map loads, a thread reads the same files ahead
+of the main thread, so most of them are in the system's cache by the time
+the BSP has been parsed and the models and sounds are asked for.
+
+A listen server's load runs from SV_SpawnServer to the end of the
+client's CL_PrepRefresh, a dedicated server's to the end of SV_SpawnServer.
+
+=============================================================================
+*/
+
+#define	MAX_PREFETCH_FILES	2048
+#define	MAX_PREFETCH_LOOSE	32		// loose files hold a handle until the thread is done
+#define	PREFETCH_HASH		1024
+
+cvar_t	*fs_prefetch;
+
+// the load being recorded
+char	fs_loadmap[MAX_QPATH];		// "" when not recording
+int		fs_numloaded;
+char	*fs_loaded[MAX_PREFETCH_FILES];
+int		fs_loadednext[MAX_PREFETCH_FILES];
+int		fs_loadedhash[PREFETCH_HASH];
+
+// the files being read ahead
+void	*fs_prefetchthread;
+volatile int	fs_prefetchabort;
+int		fs_numprefetch;
+fsfile_t	fs_prefetchfiles[MAX_PREFETCH_FILES];
+
+/*
+================
+FS_PrefetchThread
+================
+*/
+void FS_PrefetchThread (void *data)
+{
+	static byte	buf[0x10000];
+	fsfile_t	*f;
+	int			i, ofs, read;
+
+	for (i=0, f=fs_prefetchfiles ; i<fs_numprefetch && !fs_prefetchabort ; i++, f++)
+	{
+		// the bytes on disk, which for a .pkz are still compressed
+		for (ofs=0 ; ofs<f->disklen && !fs_prefetchabort ; ofs+=read)
+		{
+			read = f->disklen - ofs;
+			if (read > sizeof(buf))
+				read = sizeof(buf);
+			read = Sys_ReadFileAt (f->handle, buf, read, f->offset + ofs);
+			if (read <= 0)
+				break;
+		}
+	}
+}
+
+/*
+================
+FS_StopPrefetch
+
+Must be called before the pak handles the files refer to are closed
+================
+*/
+void FS_StopPrefetch (void)
+{
+	int		i;
+
+	if (fs_prefetchthread)
+	{
+		fs_prefetchabort = qTrue;
+		Sys_WaitThread (fs_prefetchthread);
+		fs_prefetchthread = NULL;
+	}
+
+	for (i=0 ; i<fs_numprefetch ; i++)
+		FS_CloseFile (&fs_prefetchfiles[i]);
+	fs_numprefetch = 0;
+}
+
+/*
+================
+FS_StartPrefetch
+
+Reads the map's manifest and starts a thread on the files it lists
+================
+*/
+void FS_StartPrefetch (char *mapname)
+{
+	FILE	*f;
+	char	name[MAX_OSPATH];
+	char	line[MAX_OSPATH];
+	int		len, loose;
+
+	COM_FileBase (mapname, name);
+	f = fopen (va("%s/prefetch/%s.txt", FS_Gamedir(), name), "r");
+	if (!f)
+		return;
+
+	loose = 0;
+	while (fs_numprefetch < MAX_PREFETCH_FILES && fgets (line, sizeof(line), f))
+	{
+		len = strlen (line);
+		while (len && (line[len-1] == '\n' || line[len-1] == '\r'))
+			line[--len] = 0;
+		if (!len)
+			continue;
+
+		if (FS_OpenFile (line, &fs_prefetchfiles[fs_numprefetch]) == -1)
+			continue;
+		if (!fs_prefetchfiles[fs_numprefetch].pack && ++loose > MAX_PREFETCH_LOOSE)
+		{
+			FS_CloseFile (&fs_prefetchfiles[fs_numprefetch]);
+			continue;
+		}
+		fs_numprefetch++;
+	}
+	fclose (f);
+
+	if (!fs_numprefetch)
+		return;
+
+	Com_DPrintf ("Prefetching %i files for %s\n", fs_numprefetch, name);
+	fs_prefetchabort = qFalse;
+	fs_prefetchthread = Sys_CreateThread (FS_PrefetchThread, NULL);
+	if (!fs_prefetchthread)
+		FS_StopPrefetch ();
+}
+
+/*
+================
+FS_ClearLoadLog
+================
+*/
+void FS_ClearLoadLog (void)
+{
+	int		i;
+
+	for (i=0 ; i<fs_numloaded ; i++)
+		Z_Free (fs_loaded[i]);
+	fs_numloaded = 0;
+	memset (fs_loadedhash, -1, sizeof(fs_loadedhash));
+	fs_loadmap[0] = 0;
+}
+
+/*
+================
+FS_LogMapLoad
+
+Adds a file to the manifest being recorded, the first time it is loaded
+================
+*/
+void FS_LogMapLoad (char *path)
+{
+	int		i, hash;
+
+	if (!fs_loadmap[0] || fs_numloaded == MAX_PREFETCH_FILES)
+		return;
+
+	hash = FS_HashFileName (path) & (PREFETCH_HASH-1);
+	for (i = fs_loadedhash[hash] ; i != -1 ; i = fs_loadednext[i])
+		if (!Q_strcasecmp (fs_loaded[i], path))
+			return;
+
+	fs_loaded[fs_numloaded] = CopyString (path);
+	fs_loadednext[fs_numloaded] = fs_loadedhash[hash];
+	fs_loadedhash[hash] = fs_numloaded;
+	fs_numloaded++;
+}
+
+/*
+================
+FS_BeginMapLoad
+
+Called when the server or client starts loading a map.  The client half
+of a listen server's load carries on the recording the server started.
+================
+*/
+void FS_BeginMapLoad (char *mapname)
+{
+	if (fs_loadmap[0] && !Q_strcasecmp (fs_loadmap, mapname))
+		return;
+
+	FS_StopPrefetch ();
+	FS_ClearLoadLog ();
+
+	if (!fs_prefetch->value)
+		return;
+
+	strncpy (fs_loadmap, mapname, sizeof(fs_loadmap)-1);
+	fs_loadmap[sizeof(fs_loadmap)-1] = 0;
+	FS_StartPrefetch (mapname);
+}
+
+/*
+================
+FS_EndMapLoad
+
+Saves the files the load used as the map's manifest.  The prefetch thread,
+if any, is left to finish on its own.
+================
+*/
+void FS_EndMapLoad (void)
+{
+	FILE	*f;
+	char	name[MAX_OSPATH];
+	char	path[MAX_OSPATH];
+	int		i;
+
+	if (!fs_loadmap[0])
+		return;
+
+	COM_FileBase (fs_loadmap, name);
+	Com_sprintf (path, sizeof(path), "%s/prefetch/%s.txt", FS_Gamedir(), name);
+	FS_CreatePath (path);
+	f = fopen (path, "w");
+	if (f)
+	{
+		for (i=0 ; i<fs_numloaded ; i++)
+			fprintf (f, "%s\n", fs_loaded[i]);
+		fclose (f);
+	}
+	else
+		Com_DPrintf ("Couldn't write %s\n", path);
+
+	FS_ClearLoadLog ();
+}
 
 /*
 =================
@@ -393,15 +1236,13 @@ a null buffer will just return the file length without loading
 */
 int FS_LoadFile (char *path, void **buffer)
 {
-	FILE	*h;
+	fsfile_t	f;
 	byte	*buf;
-	int		len;
-
-	buf = NULL;	// quiet compiler warning
+	int		len, read;
 
 // look for it in the filesystem or pack files
-	len = FS_FOpenFile (path, &h);
-	if (!h)
+	len = FS_OpenFile (path, &f);
+	if (len == -1)
 	{
 		if (buffer)
 			*buffer = NULL;
@@ -410,16 +1251,21 @@ int FS_LoadFile (char *path, void **buffer)
 	
 	if (!buffer)
 	{
-		fclose (h);
+		FS_CloseFile (&f);
 		return len;
 	}
 
 	buf = Z_Malloc(len);
 	*buffer = buf;
 
-	FS_Read (buf, len, h);
+	read = FS_ReadAt (&f, buf, len, 0);
+
+	FS_CloseFile (&f);
 
-	fclose (h);
+	if (read != len)
+		Com_Error (ERR_FATAL, "FS_LoadFile: short read on %s", path);
+
+	FS_LogMapLoad (path);
 
 	return len;
 }
@@ -435,6 +1281,95 @@ void FS_FreeFile (void *buffer)
 	Z_Free (buffer);
 }
 
+
+#define	MAX_MAPPED_FILES	16
+
+typedef struct
+{
+	void	*buffer;		// NULL if the slot is free
+	int		offset;			// of the file in the pak or on disk
+	int		length;
+} mappedfile_t;
+
+mappedfile_t	fs_mappedfiles[MAX_MAPPED_FILES];
+
+/*
+============
+FS_MapFile
+
+Maps a loose file or a pak entry straight into memory, so reading it
+doesn't copy through a heap buffer.  Falls back to FS_LoadFile style
+loading when the system can't map it.  The buffer is read only either way.
+============
+*/
+int FS_MapFile (char *path, void **buffer)
+{
+	fsfile_t		f;
+	int				i, len, read;
+	mappedfile_t	*m;
+
+	len = FS_OpenFile (path, &f);
+	if (len == -1)
+	{
+		*buffer = NULL;
+		return -1;
+	}
+
+	for (i=0, m=fs_mappedfiles ; i<MAX_MAPPED_FILES ; i++, m++)
+		if (!m->buffer)
+			break;
+
+	// a compressed file can only be loaded
+	if (i < MAX_MAPPED_FILES && !(f.pack && f.pack->compressed))
+	{
+		m->offset = f.offset;
+		m->length = len;
+		m->buffer = Sys_MapFile (f.handle, m->offset, len);
+		if (m->buffer)
+		{
+			FS_CloseFile (&f);
+			FS_LogMapLoad (path);
+			*buffer = m->buffer;
+			return len;
+		}
+	}
+
+	*buffer = Z_Malloc (len);
+	read = FS_ReadAt (&f, *buffer, len, 0);
+	FS_CloseFile (&f);
+
+	if (read != len)
+		Com_Error (ERR_FATAL, "FS_MapFile: short read on %s", path);
+
+	FS_LogMapLoad (path);
+
+	return len;
+}
+
+/*
+=============
+FS_UnmapFile
+=============
+*/
+void FS_UnmapFile (void *buffer)
+{
+	int				i;
+	mappedfile_t	*m;
+
+	for (i=0, m=fs_mappedfiles ; i<MAX_MAPPED_FILES ; i++, m++)
+	{
+		if (m->buffer == buffer)
+		{
+			Sys_UnmapFile (m->buffer, m->offset, m->length);
+			m->buffer = NULL;
+			return;
+		}
+	}
+
+	// it was loaded instead
+	Z_Free (buffer);
+}
+
 /*
 =================
 FS_LoadPackFile
@@ -442,7 +1377,8 @@ FS_LoadPackFile
 Takes an explicit (not game tree related) path to a pak file.
 
 Loads the header and directory, adding the files at the beginning
-of the list so they override previous pack files.
+of the list so they override previous pack files.  Reads both .pak
+and .pkz files.
 =================
 */
 pack_t *FS_LoadPackFile (char *packfile)
@@ -453,22 +1389,30 @@ pack_t *FS_LoadPackFile (char *packfile)
 	int				numpackfiles;
 	pack_t			*pack;
 	FILE			*packhandle;
-	dpackfile_t		info[MAX_FILES_IN_PACK];
+	byte			info[MAX_FILES_IN_PACK*sizeof(dzpackfile_t)];
+	dpackfile_t		*in;
+	qboolean		compressed;
+	int				infosize;
 	unsigned		checksum;
+	unsigned		hash;
 
 	packhandle = fopen(packfile, "rb");
 	if (!packhandle)
 		return NULL;
 
 	fread (&header, 1, sizeof(header), packhandle);
-	if (LittleLong(header.ident) != IDPAKHEADER)
+	compressed = LittleLong(header.ident) == IDZPAKHEADER;
+	if (!compressed && LittleLong(header.ident) != IDPAKHEADER)
 		Com_Error (ERR_FATAL, "%s is not a packfile", packfile);
 	header.dirofs = LittleLong (header.dirofs);
 	header.dirlen = LittleLong (header.dirlen);
 
-	numpackfiles = header.dirlen / sizeof(dpackfile_t);
+	// the entries of a .pkz have the same start
+	infosize = compressed ? sizeof(dzpackfile_t) : sizeof(dpackfile_t);
+	numpackfiles = header.dirlen / infosize;
+	header.dirlen = numpackfiles * infosize;
 
-	if (numpackfiles > MAX_FILES_IN_PACK)
+	if (numpackfiles < 0 || numpackfiles > MAX_FILES_IN_PACK)
 		Com_Error (ERR_FATAL, "%s has %i files", packfile, numpackfiles);
 
 	newfiles = Z_Malloc (numpackfiles * sizeof(packfile_t));
@@ -486,9 +1430,16 @@ pack_t *FS_LoadPackFile (char *packfile)
 // parse the directory
 	for (i=0 ; i<numpackfiles ; i++)
 	{
-		strcpy (newfiles[i].name, info[i].name);
-		newfiles[i].filepos = LittleLong(info[i].filepos);
-		newfiles[i].filelen = LittleLong(info[i].filelen);
+		in = (dpackfile_t *)(info + i * infosize);
+		strcpy (newfiles[i].name, in->name);
+		newfiles[i].filepos = LittleLong(in->filepos);
+		newfiles[i].filelen = LittleLong(in->filelen);
+		if (compressed)
+			newfiles[i].disklen = LittleLong(((dzpackfile_t *)in)->disklen);
+		else
+			newfiles[i].disklen = newfiles[i].filelen;
+		if (newfiles[i].filepos < 0 || newfiles[i].filelen < 0 || newfiles[i].disklen < 0)
+			Com_Error (ERR_FATAL, "%s has a bad entry for %s", packfile, in->name);
 	}
 
 	pack = Z_Malloc (sizeof (pack_t));
@@ -496,6 +1447,20 @@ pack_t *FS_LoadPackFile (char *packfile)
 	pack->handle = packhandle;
 	pack->numfiles = numpackfiles;
 	pack->files = newfiles;
+	pack->compressed = compressed;
+
+// index the directory by name, chaining backwards so a lookup finds
+// the first of any duplicates, as the old linear search did
+	for (pack->hashsize = 1 ; pack->hashsize < numpackfiles ; pack->hashsize <<= 1)
+		;
+	pack->hashtable = Z_Malloc (pack->hashsize * sizeof(int));
+	memset (pack->hashtable, -1, pack->hashsize * sizeof(int));
+	for (i=numpackfiles-1 ; i>=0 ; i--)
+	{
+		hash = FS_HashFileName (newfiles[i].name) & (pack->hashsize-1);
+		newfiles[i].hashnext = pack->hashtable[hash];
+		pack->hashtable[hash] = i;
+	}
 	
 	Com_Printf ("Added packfile %s (%i files)\n", packfile, numpackfiles);
 	return pack;
@@ -529,10 +1494,11 @@ void FS_AddGameDirectory (char *dir)
 
 	//
 	// add any pak files in the format pak0.pak pak1.pak, ...
+	// a compressed pak0.pkz comes after pak0.pak, so overrides it
 	//
-	for (i=0; i<10; i++)
+	for (i=0; i<20; i++)
 	{
-		Com_sprintf (pakfile, sizeof(pakfile), "%s/pak%i.pak", dir, i);
+		Com_sprintf (pakfile, sizeof(pakfile), "%s/pak%i.%s", dir, i/2, (i&1) ? "pkz" : "pak");
 		pak = FS_LoadPackFile (pakfile);
 		if (!pak)
 			continue;
@@ -599,6 +1565,9 @@ void FS_SetGamedir (char *dir)
 		return;
 	}
 
+	// the prefetch thread reads through the paks about to be closed
+	FS_StopPrefetch ();
+
 	//
 	// free up any current game dir info
 	//
@@ -608,6 +1577,7 @@ void FS_SetGamedir (char *dir)
 		{
 			fclose (fs_searchpaths->pack->handle);
 			Z_Free (fs_searchpaths->pack->files);
+			Z_Free (fs_searchpaths->pack->hashtable);
 			Z_Free (fs_searchpaths->pack);
 		}
 		next = fs_searchpaths->next;
@@ -846,6 +1816,10 @@ void FS_InitFilesystem (void)
 	Cmd_AddCommand ("path", FS_Path_f);
 	Cmd_AddCommand ("link", FS_Link_f);
 	Cmd_AddCommand ("dir", FS_Dir_f );
+	Cmd_AddCommand ("compresspak", FS_CompressPak_f);
+
+	fs_prefetch = Cvar_Get ("fs_prefetch", "1", 0);
+	memset (fs_loadedhash, -1, sizeof(fs_loadedhash));
 
 	//
 	// basedir <path>
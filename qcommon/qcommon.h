@@ -80,6 +80,9 @@ typedef struct sizebuf_s
 	int		maxsize;
 	int		cursize;
 	int		readcount;
+	int		writebits;		// bits used in the last byte by MSG_WriteBits
+	int		readbits;		// bits consumed from data[readbitsat-1] by MSG_ReadBits
+	int		readbitsat;
 } sizebuf_t;
 
 void SZ_Init (sizebuf_t *buf, byte *data, int length);
@@ -107,6 +110,12 @@ void MSG_WriteDeltaUsercmd (sizebuf_t *sb, struct usercmd_s *from, struct usercm
 void MSG_WriteDeltaEntity (struct entity_state_s *from, struct entity_state_s *to, sizebuf_t *msg, qboolean force, qboolean newentity);
 void MSG_WriteDir (sizebuf_t *sb, vec3_t vector);
 
+void MSG_WriteBits (sizebuf_t *sb, int value, int bits);
+void MSG_WriteBitString (sizebuf_t *sb, byte *data, int bits);
+void MSG_WriteDeltaBits (sizebuf_t *sb, int from, int to);
+void MSG_WriteVarBits (sizebuf_t *sb, int value);
+void MSG_WriteDeltaEntityBits (struct entity_state_s *from, struct entity_state_s *to, sizebuf_t *msg, qboolean force, qboolean newentity);
+
 
 void	MSG_BeginReading (sizebuf_t *sb);
 
@@ -116,6 +125,7 @@ int		MSG_ReadShort (sizebuf_t *sb);
 int		MSG_ReadLong (sizebuf_t *sb);
 float	MSG_ReadFloat (sizebuf_t *sb);
 char	*MSG_ReadString (sizebuf_t *sb);
+char	*MSG_ReadStringView (sizebuf_t *sb);
 char	*MSG_ReadStringLine (sizebuf_t *sb);
 
 float	MSG_ReadCoord (sizebuf_t *sb);
@@ -127,6 +137,11 @@ void	MSG_ReadDeltaUsercmd (sizebuf_t *sb, struct usercmd_s *from, struct usercmd
 void	MSG_ReadDir (sizebuf_t *sb, vec3_t vector);
 
 void	MSG_ReadData (sizebuf_t *sb, void *buffer, int size);
+byte	*MSG_ReadBlock (sizebuf_t *sb, int size);
+
+int		MSG_ReadBits (sizebuf_t *sb, int bits);
+int		MSG_ReadDeltaBits (sizebuf_t *sb, int from);
+int		MSG_ReadVarBits (sizebuf_t *sb);
 
 //============================================================================
 
@@ -164,6 +179,7 @@ void CRC_Init(unsigned short *crcvalue);
 void CRC_ProcessByte(unsigned short *crcvalue, byte data);
 unsigned short CRC_Value(unsigned short crcvalue);
 unsigned short CRC_Block (byte *start, int count);
+void CRC_Bench_f (void);
 
 
 
@@ -179,6 +195,12 @@ PROTOCOL
 
 #define	PROTOCOL_VERSION	34
 
+// same messages, but the playerinfo and packetentities sections of a
+// frame are bit packed (MSG_WriteBits) with coordinate deltas against the
+// previous frame.  Offered as an extra connect argument, so servers that
+// don't know it just see a version 34 client.
+#define	PROTOCOL_VERSION_BITS	35
+
 //=========================================
 
 #define	PORT_MASTER	27900
@@ -329,6 +351,16 @@ enum clc_ops_e
 #define	U_SOUND		(1<<26)
 #define	U_SOLID		(1<<27)
 
+// PROTOCOL_VERSION_BITS entity records have no flag words.  Each starts
+// with a ENTITYNUM_BITS number (0 ends the list) and a remove bit, then
+// one presence bit per field in MSG_WriteDeltaEntityBits order
+#define	ENTITYNUM_BITS	10
+#define	PS_BITS			15		// PS_ flags in a bit packed playerinfo
+
+// the value MSG_WriteCoord puts on the wire, bit packed coordinate deltas
+// are taken between these so both sides round the same way
+#define	COORD2SHORT(x)	((short)(int)((x)*8))
+
 
 /*
 ==============================================================
@@ -512,6 +544,11 @@ extern	qboolean	userinfo_modified;
 // this is set each time a CVAR_USERINFO variable is changed
 // so that the client knows to send it to the server
 
+extern	int		cvar_modifiedcount;
+// bumped each time any cvar's value or flags change, and copied into that
+// cvar's modifiedcount.  Code that polls a cvar_t handle every frame can
+// keep the count it last saw instead of comparing strings.
+
 /*
 ==============================================================
 
@@ -647,8 +684,27 @@ trace_t		CM_TransformedBoxTrace (vec3_t start, vec3_t end,
 						  int headnode, int brushmask,
 						  vec3_t origin, vec3_t angles);
 
+// the axes of a placed bmodel worked out once, so repeated traces and
+// point tests against a rotated bmodel skip the AngleVectors calls
+typedef struct
+{
+	vec3_t		origin, angles;			// what it was built from
+	vec3_t		forward, right, up;		// into the model's frame
+	vec3_t		iforward, iright, iup;	// back out of it
+} cmtransform_t;
+
+void		CM_SetTransform (cmtransform_t *xf, vec3_t origin, vec3_t angles);
+int			CM_TransformedPointContentsCached (vec3_t p, int headnode, cmtransform_t *xf);
+trace_t		CM_TransformedBoxTraceCached (vec3_t start, vec3_t end,
+						  vec3_t mins, vec3_t maxs,
+						  int headnode, int brushmask,
+						  cmtransform_t *xf);
+
+// the rows are CM_VisRowBytes long and must not be modified
 byte		*CM_ClusterPVS (int cluster);
 byte		*CM_ClusterPHS (int cluster);
+int			CM_VisRowBytes (void);
+void		CM_OrVisRow (byte *dest, byte *src);
 
 int			CM_PointLeafnum (vec3_t p);
 
@@ -662,6 +718,7 @@ int			CM_LeafCluster (int leafnum);
 int			CM_LeafArea (int leafnum);
 
 void		CM_SetAreaPortalState (int portalnum, qboolean open);
+void		CM_AreaPortalTest_f (void);
 qboolean	CM_AreasConnected (int area1, int area2);
 
 int			CM_WriteAreaBits (byte *buffer, int area);
@@ -670,6 +727,47 @@ qboolean	CM_HeadnodeVisible (int headnode, byte *visbits);
 void		CM_WritePortalState (FILE *f);
 void		CM_ReadPortalState (FILE *f);
 
+// every thread gets its own collision context on first use, so traces,
+// point contents and box leaf queries can run on several threads at once
+// while the map stays loaded.  Threads other than the main one should
+// free theirs before exiting.
+typedef struct cmcontext_s cmcontext_t;
+
+void		CM_FreeThreadContext (void);
+
+// a log of collision calls, written by the server when sv_tracelog is set
+// and replayed by cm_bench.  Native byte order, it never leaves the
+// machine it was recorded on.
+#define	CMLOG_IDENT		(('G'<<24)+('L'<<16)+('M'<<8)+'C')	// little-endian "CMLG"
+#define	CMLOG_VERSION	1
+
+typedef struct
+{
+	int		ident;
+	int		version;
+	char	mapname[MAX_QPATH];		// as given to CM_LoadMap
+	unsigned	checksum;
+} cmlogheader_t;
+
+#define	CMLOG_BOXTRACE			0
+#define	CMLOG_TRANSFORMEDTRACE	1
+#define	CMLOG_POINTCONTENTS		2
+#define	CMLOG_TRANSFORMEDPOINT	3
+#define	CMLOG_NUMTYPES			4
+
+typedef struct
+{
+	int		type;					// CMLOG_*
+	int		headnode;				// -1 for CM_HeadnodeForBox (boxmins, boxmaxs)
+	int		brushmask;
+	vec3_t	start, end;				// start only for point contents
+	vec3_t	mins, maxs;
+	vec3_t	origin, angles;
+	vec3_t	boxmins, boxmaxs;
+} cmlogentry_t;
+
+void		CM_Bench_f (void);
+
 /*
 ==============================================================
 
@@ -700,6 +798,22 @@ void	FS_ExecAutoexec (void);
 
 int		FS_FOpenFile (char *filename, FILE **file);
 void	FS_FCloseFile (FILE *f);
+
+typedef struct
+{
+	FILE		*handle;	// the pak's own handle, or a loose file
+	struct pack_s	*pack;	// NULL for a loose file
+	int			offset;		// of the file's data in handle
+	int			length;
+	int			disklen;	// of the data in handle, compressed in a .pkz
+} fsfile_t;
+
+int		FS_OpenFile (char *filename, fsfile_t *file);
+// finds a file like FS_FOpenFile, but a pak entry shares the handle the
+// pak keeps open instead of reopening it.  returns the length, -1 if not found
+int		FS_ReadAt (fsfile_t *file, void *buffer, int len, int offset);
+// reads from offset into the file, safe from any thread.  returns bytes read
+void	FS_CloseFile (fsfile_t *file);
 // note: this can't be called from another DLL, due to MS libc issues
 
 int		FS_LoadFile (char *path, void **buffer);
@@ -711,8 +825,18 @@ void	FS_Read (void *buffer, int len, FILE *f);
 
 void	FS_FreeFile (void *buffer);
 
+int		FS_MapFile (char *path, void **buffer);
+// like FS_LoadFile, but the file is mapped in place when the system
+// can, so it must not be written to.  Release with FS_UnmapFile.
+void	FS_UnmapFile (void *buffer);
+
 void	FS_CreatePath (char *path);
 
+void	FS_BeginMapLoad (char *mapname);
+void	FS_EndMapLoad (void);
+// the files loaded in between are saved as the map's prefetch manifest,
+// and read ahead on a thread the next time the map begins loading
+
 
 /*
 ==============================================================
@@ -750,8 +874,14 @@ byte		COM_BlockSequenceCRCByte (byte *base, int length, int sequence);
 float	frand(void);	// 0 ti 1
 float	crand(void);	// -1 to 1
 
+void	Com_ParallelJobs (int count, void (*job) (int index, void *data), void *data);
+// runs job for every index below count on worker threads and the calling
+// thread, and returns when they are all done.  Jobs must not call
+// Com_Error or write anything another job reads.
+
 extern	cvar_t	*developer;
 extern	cvar_t	*dedicated;
+extern	cvar_t	*com_threads;
 extern	cvar_t	*host_speeds;
 extern	cvar_t	*log_stats;
 
@@ -803,6 +933,31 @@ void	Sys_Quit (void);
 char	*Sys_GetClipboardData( void );
 void	Sys_CopyProtect (void);
 
+double	Sys_FloatTime (void);
+// high resolution seconds since the first call, for profiling
+
+void	*Sys_MapFile (FILE *f, int offset, int length);
+void	Sys_UnmapFile (void *buffer, int offset, int length);
+// maps length bytes of f starting at offset read only, NULL if it can't
+
+int		Sys_ReadFileAt (FILE *f, void *buffer, int length, int offset);
+// reads from offset without using the stream position, so any number of
+// threads can read the same file at once.  returns bytes read, -1 on error
+
+void	*Sys_CreateThread (void (*func) (void *data), void *data);
+void	Sys_WaitThread (void *thread);
+// NULL if a thread couldn't be started, Sys_WaitThread joins and frees it
+void	*Sys_CreateSemaphore (void);
+void	Sys_PostSemaphore (void *sem, int count);
+void	Sys_WaitSemaphore (void *sem);
+// a counting semaphore starting at zero, NULL if it couldn't be made
+int		Sys_NumProcessors (void);
+int		Sys_AtomicIncrement (volatile int *value);
+// returns the incremented value
+int		Sys_AtomicLoad (volatile int *value);
+// reads value before any loads that follow it, to pair with a
+// Sys_AtomicIncrement that publishes data written before it
+
 /*
 ==============================================================
 
@@ -58,6 +58,40 @@ typedef struct
 #define	MAX_FILES_IN_PACK	4096
 
 
+/*
+========================================================================
+
+.PKZ files are .pak files with every file compressed
+
+Each file is cut into ZPAK_CHUNKSIZE pieces that are compressed on their
+own, so a large file can be decompressed by several threads at once.
+A file's data starts with a table holding the end of each compressed
+chunk, counted from the end of the table, and the chunks follow.  A chunk
+that is no smaller compressed is stored as is, which its size shows.
+
+Chunks are a series of LZ77 sequences: a token byte whose high nibble is
+the number of literals and low nibble the match length - ZPAK_MINMATCH,
+either of which continues in following bytes while they are 255 when the
+nibble is 15, the literals, then a two byte match offset and the extra
+match length bytes.  The last sequence stops after its literals.
+
+========================================================================
+*/
+
+#define IDZPAKHEADER	(('Z'<<24)+('K'<<16)+('A'<<8)+'P')
+		// header is a dpackheader_t
+
+#define	ZPAK_CHUNKSIZE	0x40000
+#define	ZPAK_MINMATCH	4
+
+typedef struct
+{
+	char	name[56];
+	int		filepos, filelen;	// filelen is the size decompressed
+	int		disklen;			// size of the chunk table and chunks
+} dzpackfile_t;
+
+
 /*
 ========================================================================
 
@@ -64,6 +64,11 @@ typedef struct
 	// demo server information
 	FILE		*demofile;
 	qboolean	timedemo;		// don't time sync
+
+	FILE		*tracelog;		// collision calls, while sv_tracelog is set
+
+	// rotated bmodel axes by entity number, see SV_EntityTransform
+	cmtransform_t	transforms[MAX_EDICTS];
 } server_t;
 
 #define EDICT_NUM(n) ((edict_t *)((byte *)ge->edicts + ge->edict_size*(n)))
@@ -87,6 +92,7 @@ typedef struct
 	int					num_entities;
 	int					first_entity;		// into the circular sv_packet_entities[]
 	int					senttime;			// for ping calculations
+	int					framenum;			// sv.framenum it was built in
 } client_frame_t;
 
 #define	LATENCY_COUNTS	16
@@ -130,10 +136,25 @@ typedef struct client_s
 	int				lastconnect;
 
 	int				challenge;			// challenge of this user, randomly generated
+	int				protocol;			// PROTOCOL_VERSION or PROTOCOL_VERSION_BITS
 
 	netchan_t		netchan;
 } client_t;
 
+// one spawned client's datagram while SV_SendClientMessages builds and
+// encodes the frames, possibly on several threads at once
+#define	MAX_FRAMEMSG	0x10000		// more than a frame of every edict encodes to
+
+typedef struct
+{
+	client_t		*client;
+	int				numentities;
+	short			entities[MAX_EDICTS];	// edict numbers going in the frame
+	byte			fatpvs[65536/8];		// 32767 is MAX_MAP_LEAFS
+	sizebuf_t		msg;
+	byte			msgbuf[MAX_FRAMEMSG];
+} clientsend_t;
+
 // a client can leave the server in one of four ways:
 // dropping properly by quiting or disconnecting
 // timing out if no valid messages are received for timeout.value seconds
@@ -169,6 +190,8 @@ typedef struct
 	int			num_client_entities;		// maxclients->value*UPDATE_BACKUP*MAX_PACKET_ENTITIES
 	int			next_client_entities;		// next client_entity to use
 	entity_state_t	*client_entities;		// [num_client_entities]
+	clientsend_t	*clientsends;			// [numclientsends], grown as needed
+	int			numclientsends;
 
 	int			last_heartbeat;
 
@@ -196,6 +219,10 @@ extern	cvar_t		*sv_noreload;			// don't reload level state when reentering
 extern	cvar_t		*sv_airaccelerate;		// don't reload level state when reentering
 											// development tool
 extern	cvar_t		*sv_enforcetime;
+extern	cvar_t		*sv_tracelog;			// record collision calls for cm_bench
+extern	cvar_t		*sv_bitprotocol;		// offer PROTOCOL_VERSION_BITS to clients
+extern	cvar_t		*sv_parallelsend;		// build client frames on worker threads
+extern	cvar_t		*sv_deltacache;			// share encoded entity deltas between clients
 
 extern	client_t	*sv_client;
 extern	edict_t		*sv_player;
@@ -224,6 +251,8 @@ void SV_UserinfoChanged (client_t *cl);
 void Master_Heartbeat (void);
 void Master_Packet (void);
 
+void SV_Profile_f (void);
+
 //
 // sv_init.c
 //
@@ -250,6 +279,8 @@ void SV_DemoCompleted (void);
 void SV_SendClientMessages (void);
 
 void SV_Multicast (vec3_t origin, multicast_t to);
+void SV_ClearMulticastIndex (void);
+void SV_MulticastBench_f (void);
 void SV_StartSound (vec3_t origin, edict_t *entity, int channel,
 					int soundindex, float volume,
 					float attenuation, float timeofs);
@@ -274,7 +305,11 @@ void SV_Status_f (void);
 //
 void SV_WriteFrameToClient (client_t *client, sizebuf_t *msg);
 void SV_RecordDemoMessage (void);
-void SV_BuildClientFrame (client_t *client);
+void SV_BuildClientFrame (client_t *client, clientsend_t *send);
+void SV_ReserveClientEntities (client_t *client, clientsend_t *send);
+void SV_CopyClientEntities (client_t *client, clientsend_t *send);
+void SV_ClearDeltaCache (qboolean active);
+void SV_DeltaBench_f (void);
 
 
 void SV_Error (char *error, ...);
@@ -318,11 +353,20 @@ int SV_AreaEdicts (vec3_t mins, vec3_t maxs, edict_t **list, int maxcount, int a
 // returns the number of pointers filled in
 // ??? does this always return the world?
 
+void SV_AreaBench_f (void);
+// times SV_AreaEdicts against the old areanode tree with a lot in flight
+
 //===================================================================
 
 //
 // functions that interact with everything apropriate
 //
+cmtransform_t *SV_EntityTransform (edict_t *ent);
+// the axes for tracing against a bmodel where it is now
+
+void SV_CloseTraceLog (void);
+// ends the collision log started by sv_tracelog
+
 int SV_PointContents (vec3_t p);
 // returns the CONTENTS_* value from the world at the given point.
 // Quake 2 extends this to also check entities, to allow moving liquids
@@ -1046,5 +1046,13 @@ void SV_InitOperatorCommands (void)
 	Cmd_AddCommand ("killserver", SV_KillServer_f);
 
 	Cmd_AddCommand ("sv", SV_ServerCommand_f);
+
+	Cmd_AddCommand ("areaportaltest", CM_AreaPortalTest_f);
+	Cmd_AddCommand ("cm_bench", CM_Bench_f);
+	Cmd_AddCommand ("area_bench", SV_AreaBench_f);
+	Cmd_AddCommand ("delta_bench", SV_DeltaBench_f);
+	Cmd_AddCommand ("multicast_bench", SV_MulticastBench_f);
+
+	Cmd_AddCommand ("sv_profile", SV_Profile_f);
 }
 
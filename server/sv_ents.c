@@ -115,6 +115,165 @@ void SV_EmitProjectileUpdate (sizebuf_t *msg)
 }
 #endif
 
+/*
+=============================================================================
+
+Encoded delta cache
+
+Most clients delta from the frame they all acked last, so the same entity
+going between the same two states gets encoded once per client.  Within
+a frame the states copied into any client's frame for an entity only
+differ in solid (SV_CopyClientEntities clears it for the client's own
+missiles), so an entity number, the frame delta'd from and the two solid
+values pin down both states.  The first client to need a delta encodes
+it into a slot and the rest copy it.  Slots are claimed with
+Sys_AtomicIncrement, so the cache works from the frame jobs as well.
+
+=============================================================================
+*/
+
+#define	DELTACACHE_SLOTS	8192	// power of two
+#define	DELTACACHE_PROBES	8
+#define	DELTACACHE_BYTES	64		// more than any one entity's delta
+
+typedef struct
+{
+	int		number;
+	int		fromframe;			// -1 for the baseline
+	int		fromsolid, tosolid;
+	int		flags;				// DC_* for the encoding options
+	int		bits;				// length of data
+	byte	data[DELTACACHE_BYTES];
+} deltacache_t;
+
+#define	DC_FORCE		1
+#define	DC_NEWENTITY	2
+#define	DC_BITS			4		// PROTOCOL_VERSION_BITS
+
+deltacache_t	sv_deltaslots[DELTACACHE_SLOTS];
+volatile int	sv_deltaclaims[DELTACACHE_SLOTS];	// nonzero once a thread took the slot
+volatile int	sv_deltaready[DELTACACHE_SLOTS];	// nonzero once the slot is filled in
+qboolean		sv_deltacacheactive;
+
+// delta_bench counts these from the main thread, nothing does on the frame jobs
+qboolean	sv_deltacounting;
+int			sv_deltahits, sv_deltamisses;
+
+/*
+=============
+SV_ClearDeltaCache
+
+Empties the cache for a new frame and turns it on or off
+=============
+*/
+void SV_ClearDeltaCache (qboolean active)
+{
+	if (sv_deltacacheactive)
+	{
+		memset ((void *)sv_deltaclaims, 0, sizeof(sv_deltaclaims));
+		memset ((void *)sv_deltaready, 0, sizeof(sv_deltaready));
+	}
+	sv_deltacacheactive = active;
+}
+
+/*
+=============
+SV_WriteDeltaEntity
+
+MSG_WriteDeltaEntity or MSG_WriteDeltaEntityBits for the client's
+protocol, through the cache while it is active.  fromframe is the frame
+from was copied in, or -1 when it is the baseline.
+=============
+*/
+void SV_WriteDeltaEntity (entity_state_t *from, int fromframe, entity_state_t *to,
+	sizebuf_t *msg, qboolean force, qboolean newentity, int protocol)
+{
+	deltacache_t	*dc;
+	sizebuf_t		buf;
+	unsigned		hash;
+	int				flags;
+	int				i, probe;
+
+	if (!sv_deltacacheactive)
+	{
+		if (protocol == PROTOCOL_VERSION_BITS)
+			MSG_WriteDeltaEntityBits (from, to, msg, force, newentity);
+		else
+			MSG_WriteDeltaEntity (from, to, msg, force, newentity);
+		return;
+	}
+
+	flags = 0;
+	if (force)
+		flags |= DC_FORCE;
+	if (newentity)
+		flags |= DC_NEWENTITY;
+	if (protocol == PROTOCOL_VERSION_BITS)
+		flags |= DC_BITS;
+
+	hash = to->number*0x9e3779b1 + fromframe*0x85ebca6b + flags*0xc2b2ae35
+		+ from->solid*31 + to->solid;
+	hash ^= hash >> 15;
+
+	for (probe=0 ; probe<DELTACACHE_PROBES ; probe++)
+	{
+		i = (hash + probe) & (DELTACACHE_SLOTS-1);
+		dc = &sv_deltaslots[i];
+
+		// the acquire keeps the slot's fields from being read before
+		// the flag that says they are filled in
+		if (Sys_AtomicLoad (&sv_deltaready[i]))
+		{
+			if (dc->number != to->number || dc->fromframe != fromframe
+				|| dc->flags != flags || dc->fromsolid != from->solid
+				|| dc->tosolid != to->solid)
+				continue;
+			if (sv_deltacounting)
+				sv_deltahits++;
+			break;
+		}
+
+		if (sv_deltaclaims[i])
+			continue;		// another thread is filling it in
+		if (Sys_AtomicIncrement (&sv_deltaclaims[i]) != 1)
+			continue;		// lost the race for it
+
+		dc->number = to->number;
+		dc->fromframe = fromframe;
+		dc->fromsolid = from->solid;
+		dc->tosolid = to->solid;
+		dc->flags = flags;
+
+		SZ_Init (&buf, dc->data, sizeof(dc->data));
+		if (flags & DC_BITS)
+			MSG_WriteDeltaEntityBits (from, to, &buf, force, newentity);
+		else
+			MSG_WriteDeltaEntity (from, to, &buf, force, newentity);
+		dc->bits = buf.cursize*8;
+		if (buf.writebits)
+			dc->bits -= 8 - buf.writebits;
+
+		Sys_AtomicIncrement (&sv_deltaready[i]);	// publishes the slot
+		if (sv_deltacounting)
+			sv_deltamisses++;
+		break;
+	}
+
+	if (probe == DELTACACHE_PROBES)
+	{	// too crowded here, just encode it
+		if (protocol == PROTOCOL_VERSION_BITS)
+			MSG_WriteDeltaEntityBits (from, to, msg, force, newentity);
+		else
+			MSG_WriteDeltaEntity (from, to, msg, force, newentity);
+		return;
+	}
+
+	if (flags & DC_BITS)
+		MSG_WriteBitString (msg, dc->data, dc->bits);
+	else
+		SZ_Write (msg, dc->data, dc->bits>>3);
+}
+
 /*
 =============
 SV_EmitPacketEntities
@@ -122,7 +281,7 @@ SV_EmitPacketEntities
 Writes a delta update of an entity_state_t list to the message.
 =============
 */
-void SV_EmitPacketEntities (client_frame_t *from, client_frame_t *to, sizebuf_t *msg)
+void SV_EmitPacketEntities (client_frame_t *from, client_frame_t *to, sizebuf_t *msg, int protocol)
 {
 	entity_state_t	*oldent, *newent;
 	int		oldindex, newindex;
@@ -168,7 +327,8 @@ void SV_EmitPacketEntities (client_frame_t *from, client_frame_t *to, sizebuf_t
 			// in any bytes being emited if the entity has not changed at all
 			// note that players are always 'newentities', this updates their oldorigin always
 			// and prevents warping
-			MSG_WriteDeltaEntity (oldent, newent, msg, qFalse, newent->number <= maxclients->value);
+			SV_WriteDeltaEntity (oldent, from->framenum, newent, msg, qFalse,
+				newent->number <= maxclients->value, protocol);
 			oldindex++;
 			newindex++;
 			continue;
@@ -176,13 +336,21 @@ void SV_EmitPacketEntities (client_frame_t *from, client_frame_t *to, sizebuf_t
 
 		if (newnum < oldnum)
 		{	// this is a new entity, send it from the baseline
-			MSG_WriteDeltaEntity (&sv.baselines[newnum], newent, msg, qTrue, qTrue);
+			SV_WriteDeltaEntity (&sv.baselines[newnum], -1, newent, msg, qTrue, qTrue, protocol);
 			newindex++;
 			continue;
 		}
 
 		if (newnum > oldnum)
 		{	// the old entity isn't present in the new message
+			if (protocol == PROTOCOL_VERSION_BITS)
+			{
+				MSG_WriteBits (msg, oldnum, ENTITYNUM_BITS);
+				MSG_WriteBits (msg, 1, 1);
+				oldindex++;
+				continue;
+			}
+
 			bits = U_REMOVE;
 			if (oldnum >= 256)
 				bits |= U_NUMBER16 | U_MOREBITS1;
@@ -201,7 +369,10 @@ void SV_EmitPacketEntities (client_frame_t *from, client_frame_t *to, sizebuf_t
 		}
 	}
 
-	MSG_WriteShort (msg, 0);	// end of packetentities
+	if (protocol == PROTOCOL_VERSION_BITS)
+		MSG_WriteBits (msg, 0, ENTITYNUM_BITS);
+	else
+		MSG_WriteShort (msg, 0);	// end of packetentities
 
 #if 0
 	if (numprojs)
@@ -211,13 +382,96 @@ void SV_EmitPacketEntities (client_frame_t *from, client_frame_t *to, sizebuf_t
 
 
 
+/*
+=============
+SV_WritePlayerstateBits
+
+The PROTOCOL_VERSION_BITS playerinfo.  The same flags pick the fields,
+but pmove origin, velocity and angles are sent as deltas, and each stat
+is delta'd on its own instead of behind a 32 bit mask.
+=============
+*/
+void SV_WritePlayerstateBits (player_state_t *ops, player_state_t *ps, int pflags, sizebuf_t *msg)
+{
+	int		i;
+
+	MSG_WriteBits (msg, pflags, PS_BITS);
+
+	if (pflags & PS_M_TYPE)
+		MSG_WriteBits (msg, ps->pmove.pm_type, 8);
+
+	if (pflags & PS_M_ORIGIN)
+		for (i=0 ; i<3 ; i++)
+			MSG_WriteDeltaBits (msg, ops->pmove.origin[i], ps->pmove.origin[i]);
+
+	if (pflags & PS_M_VELOCITY)
+		for (i=0 ; i<3 ; i++)
+			MSG_WriteDeltaBits (msg, ops->pmove.velocity[i], ps->pmove.velocity[i]);
+
+	if (pflags & PS_M_TIME)
+		MSG_WriteBits (msg, ps->pmove.pm_time, 8);
+
+	if (pflags & PS_M_FLAGS)
+		MSG_WriteBits (msg, ps->pmove.pm_flags, 8);
+
+	if (pflags & PS_M_GRAVITY)
+		MSG_WriteBits (msg, ps->pmove.gravity, 16);
+
+	if (pflags & PS_M_DELTA_ANGLES)
+		for (i=0 ; i<3 ; i++)
+			MSG_WriteDeltaBits (msg, ops->pmove.delta_angles[i], ps->pmove.delta_angles[i]);
+
+	if (pflags & PS_VIEWOFFSET)
+		for (i=0 ; i<3 ; i++)
+			MSG_WriteBits (msg, (int)(ps->viewoffset[i]*4), 8);
+
+	// the client's copy of an angle isn't exactly what was sent,
+	// so these go whole, but only the axes that moved
+	if (pflags & PS_VIEWANGLES)
+		for (i=0 ; i<3 ; i++)
+		{
+			MSG_WriteBits (msg, ps->viewangles[i] != ops->viewangles[i], 1);
+			if (ps->viewangles[i] != ops->viewangles[i])
+				MSG_WriteBits (msg, ANGLE2SHORT(ps->viewangles[i]), 16);
+		}
+
+	if (pflags & PS_KICKANGLES)
+		for (i=0 ; i<3 ; i++)
+			MSG_WriteBits (msg, (int)(ps->kick_angles[i]*4), 8);
+
+	if (pflags & PS_WEAPONINDEX)
+		MSG_WriteBits (msg, ps->gunindex, 8);
+
+	if (pflags & PS_WEAPONFRAME)
+	{
+		MSG_WriteBits (msg, ps->gunframe, 8);
+		for (i=0 ; i<3 ; i++)
+			MSG_WriteBits (msg, (int)(ps->gunoffset[i]*4), 8);
+		for (i=0 ; i<3 ; i++)
+			MSG_WriteBits (msg, (int)(ps->gunangles[i]*4), 8);
+	}
+
+	if (pflags & PS_BLEND)
+		for (i=0 ; i<4 ; i++)
+			MSG_WriteBits (msg, (int)(ps->blend[i]*255), 8);
+	if (pflags & PS_FOV)
+		MSG_WriteBits (msg, (int)ps->fov, 8);
+	if (pflags & PS_RDFLAGS)
+		MSG_WriteBits (msg, ps->rdflags, 8);
+
+	// send stats
+	for (i=0 ; i<MAX_STATS ; i++)
+		MSG_WriteDeltaBits (msg, ops->stats[i], ps->stats[i]);
+}
+
+
 /*
 =============
 SV_WritePlayerstateToClient
 
 =============
 */
-void SV_WritePlayerstateToClient (client_frame_t *from, client_frame_t *to, sizebuf_t *msg)
+void SV_WritePlayerstateToClient (client_frame_t *from, client_frame_t *to, sizebuf_t *msg, int protocol)
 {
 	int				i;
 	int				pflags;
@@ -303,6 +557,13 @@ void SV_WritePlayerstateToClient (client_frame_t *from, client_frame_t *to, size
 	// write it
 	//
 	MSG_WriteByte (msg, svc_playerinfo);
+
+	if (protocol == PROTOCOL_VERSION_BITS)
+	{
+		SV_WritePlayerstateBits (ops, ps, pflags, msg);
+		return;
+	}
+
 	MSG_WriteShort (msg, pflags);
 
 	//
@@ -430,6 +691,17 @@ void SV_WriteFrameToClient (client_t *client, sizebuf_t *msg)
 		oldframe = NULL;
 		lastframe = -1;
 	}
+	else if (client->frames[client->lastframe & UPDATE_MASK].first_entity
+		< svs.next_client_entities - svs.num_client_entities)
+	{	// the frame's entities have been handed out again in the ring.
+		// with sv_parallelsend another client's SV_CopyClientEntities
+		// could be writing them on another thread right now, so they
+		// can't even be read.  everything SV_ReserveClientEntities has
+		// handed out is below next_client_entities before any frame is
+		// written, so this catches every stretch being written.
+		oldframe = NULL;
+		lastframe = -1;
+	}
 	else
 	{	// we have a valid message to delta from
 		oldframe = &client->frames[client->lastframe & UPDATE_MASK];
@@ -447,10 +719,10 @@ void SV_WriteFrameToClient (client_t *client, sizebuf_t *msg)
 	SZ_Write (msg, frame->areabits, frame->areabytes);
 
 	// delta encode the playerstate
-	SV_WritePlayerstateToClient (oldframe, frame, msg);
+	SV_WritePlayerstateToClient (oldframe, frame, msg, client->protocol);
 
 	// delta encode the entities
-	SV_EmitPacketEntities (oldframe, frame, msg);
+	SV_EmitPacketEntities (oldframe, frame, msg, client->protocol);
 }
 
 
@@ -462,8 +734,6 @@ Build a client frame structure
 =============================================================================
 */
 
-byte		fatpvs[65536/8];	// 32767 is MAX_MAP_LEAFS
-
 /*
 ============
 SV_FatPVS
@@ -472,12 +742,10 @@ The client will interpolate the view position,
 so we can't use a single PVS point
 ===========
 */
-void SV_FatPVS (vec3_t org)
+void SV_FatPVS (vec3_t org, byte *fatpvs)
 {
 	int		leafs[64];
 	int		i, j, count;
-	int		longs;
-	byte	*src;
 	vec3_t	mins, maxs;
 
 	for (i=0 ; i<3 ; i++)
@@ -489,13 +757,12 @@ void SV_FatPVS (vec3_t org)
 	count = CM_BoxLeafnums (mins, maxs, leafs, 64, NULL);
 	if (count < 1)
 		Com_Error (ERR_FATAL, "SV_FatPVS: count < 1");
-	longs = (CM_NumClusters()+31)>>5;
 
 	// convert leafs to clusters
 	for (i=0 ; i<count ; i++)
 		leafs[i] = CM_LeafCluster(leafs[i]);
 
-	memcpy (fatpvs, CM_ClusterPVS(leafs[0]), longs<<2);
+	memcpy (fatpvs, CM_ClusterPVS(leafs[0]), CM_VisRowBytes());
 	// or in all the other leaf bits
 	for (i=1 ; i<count ; i++)
 	{
@@ -504,9 +771,7 @@ void SV_FatPVS (vec3_t org)
 				break;
 		if (j != i)
 			continue;		// already have the cluster we want
-		src = CM_ClusterPVS(leafs[i]);
-		for (j=0 ; j<longs ; j++)
-			((long *)fatpvs)[j] |= ((long *)src)[j];
+		CM_OrVisRow (fatpvs, CM_ClusterPVS(leafs[i]));
 	}
 }
 
@@ -516,17 +781,18 @@ void SV_FatPVS (vec3_t org)
 SV_BuildClientFrame
 
 Decides which entities are going to be visible to the client, and
-copies off the playerstat and areabits.
+copies off the playerstat and areabits.  The entities are only listed in
+send until SV_ReserveClientEntities makes room for them, so this can run
+for several clients at once.
 =============
 */
-void SV_BuildClientFrame (client_t *client)
+void SV_BuildClientFrame (client_t *client, clientsend_t *send)
 {
 	int		e, i;
 	vec3_t	org;
 	edict_t	*ent;
 	edict_t	*clent;
 	client_frame_t	*frame;
-	entity_state_t	*state;
 	int		l;
 	int		clientarea, clientcluster;
 	int		leafnum;
@@ -534,6 +800,8 @@ void SV_BuildClientFrame (client_t *client)
 	byte	*clientphs;
 	byte	*bitvector;
 
+	send->numentities = 0;
+
 	clent = client->edict;
 	if (!clent->client)
 		return;		// not in game yet
@@ -546,6 +814,7 @@ void SV_BuildClientFrame (client_t *client)
 	frame = &client->frames[sv.framenum & UPDATE_MASK];
 
 	frame->senttime = svs.realtime; // save it for ping calc later
+	frame->framenum = sv.framenum;
 
 	// find the client's PVS
 	for (i=0 ; i<3 ; i++)
@@ -562,12 +831,11 @@ void SV_BuildClientFrame (client_t *client)
 	frame->ps = clent->client->ps;
 
 
-	SV_FatPVS (org);
+	SV_FatPVS (org, send->fatpvs);
 	clientphs = CM_ClusterPHS (clientcluster);
 
 	// build up the list of visible entities
 	frame->num_entities = 0;
-	frame->first_entity = svs.next_client_entities;
 
 	c_fullsend = 0;
 
@@ -609,10 +877,10 @@ void SV_BuildClientFrame (client_t *client)
 				// in the PVS, only the PHS, clear the model
 				if (ent->s.sound)
 				{
-					bitvector = fatpvs;	//clientphs;
+					bitvector = send->fatpvs;	//clientphs;
 				}
 				else
-					bitvector = fatpvs;
+					bitvector = send->fatpvs;
 
 				if (ent->num_clusters == -1)
 				{	// too many leafs for individual check, go by headnode
@@ -650,21 +918,69 @@ void SV_BuildClientFrame (client_t *client)
 			continue; // added as a special projectile
 #endif
 
-		// add it to the circular client_entities array
-		state = &svs.client_entities[svs.next_client_entities%svs.num_client_entities];
-		if (ent->s.number != e)
+		send->entities[send->numentities++] = e;
+		frame->num_entities++;
+	}
+}
+
+/*
+=============
+SV_ReserveClientEntities
+
+Takes the next stretch of the circular client_entities array for the
+frame SV_BuildClientFrame listed.  Runs on the main thread, one client at
+a time in the same order the frames were always built in.
+=============
+*/
+void SV_ReserveClientEntities (client_t *client, clientsend_t *send)
+{
+	client_frame_t	*frame;
+	edict_t			*ent;
+	int				i;
+
+	if (!client->edict->client)
+		return;		// not in game yet, no frame was built
+
+	frame = &client->frames[sv.framenum & UPDATE_MASK];
+	frame->first_entity = svs.next_client_entities;
+	svs.next_client_entities += send->numentities;
+
+	for (i=0 ; i<send->numentities ; i++)
+	{
+		ent = EDICT_NUM(send->entities[i]);
+		if (ent->s.number != send->entities[i])
 		{
 			Com_DPrintf ("FIXING ENT->S.NUMBER!!!\n");
-			ent->s.number = e;
+			ent->s.number = send->entities[i];
 		}
+	}
+}
+
+/*
+=============
+SV_CopyClientEntities
+
+Fills the frame's stretch of client_entities from the edicts
+=============
+*/
+void SV_CopyClientEntities (client_t *client, clientsend_t *send)
+{
+	client_frame_t	*frame;
+	entity_state_t	*state;
+	edict_t			*ent;
+	int				i;
+
+	frame = &client->frames[sv.framenum & UPDATE_MASK];
+
+	for (i=0 ; i<send->numentities ; i++)
+	{
+		ent = EDICT_NUM(send->entities[i]);
+		state = &svs.client_entities[(frame->first_entity+i)%svs.num_client_entities];
 		*state = ent->s;
 
 		// don't mark players missiles as solid
 		if (ent->owner == client->edict)
 			state->solid = 0;
-
-		svs.next_client_entities++;
-		frame->num_entities++;
 	}
 }
 
@@ -725,3 +1041,136 @@ void SV_RecordDemoMessage (void)
 	fwrite (buf.data, buf.cursize, 1, svs.demofile);
 }
 
+/*
+=============
+SV_DeltaBenchPass
+
+Encodes every client's view of the bench frames one after another into
+msg.  Client c sees seven of every eight entities, and deltas from the
+older frame if it is one of every four that missed the last packet.
+=============
+*/
+static void SV_DeltaBenchPass (entity_state_t *states[3], int numstates, int numclients,
+	int protocol, sizebuf_t *msg, byte *out, int outsize)
+{
+	entity_state_t	*from, *to;
+	int				c, i, fromframe;
+
+	SZ_Init (msg, out, outsize);
+	for (c=0 ; c<numclients ; c++)
+	{
+		fromframe = (c & 3) == 3 ? 0 : 1;
+
+		for (i=0 ; i<numstates ; i++)
+		{
+			if (((i*7 + c) & 7) == 0)
+				continue;
+			from = &states[fromframe][i];
+			to = &states[2][i];
+			SV_WriteDeltaEntity (from, fromframe, to, msg, qFalse, to->number <= maxclients->value, protocol);
+		}
+	}
+}
+
+/*
+=============
+SV_DeltaBench_f
+
+delta_bench [iterations]
+
+Times the packet entity encoding for 16, 32 and 64 clients with and
+without the delta cache, from the current edicts moved along a little
+over two frames, and checks both ways write the same bytes
+=============
+*/
+void SV_DeltaBench_f (void)
+{
+	static int		clientcounts[] = {16, 32, 64};
+	static int		protocols[] = {PROTOCOL_VERSION, PROTOCOL_VERSION_BITS};
+	entity_state_t	*states[3];
+	edict_t			*ent;
+	sizebuf_t		plainmsg, cachedmsg;
+	byte			*plain, *cached;
+	int				numstates, iterations, outsize;
+	int				i, j, k, p, n, e;
+	double			start, plaintime, cachedtime;
+
+	if (sv.state != ss_game)
+	{
+		Com_Printf ("delta_bench: no map running\n");
+		return;
+	}
+
+	iterations = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : 100;
+	if (iterations < 1)
+		iterations = 1;
+
+	for (i=0 ; i<3 ; i++)
+		states[i] = Z_Malloc (ge->num_edicts * sizeof(entity_state_t));
+
+	// the current edicts are the newest frame, the two before have about
+	// half of them somewhere else
+	numstates = 0;
+	for (e=1 ; e<ge->num_edicts ; e++)
+	{
+		ent = EDICT_NUM(e);
+		if (!ent->inuse)
+			continue;
+
+		states[2][numstates] = ent->s;
+		states[2][numstates].number = e;
+		for (i=1 ; i>=0 ; i--)
+		{
+			states[i][numstates] = states[i+1][numstates];
+			if (rand() & 1)
+				continue;
+			for (j=0 ; j<3 ; j++)
+				states[i][numstates].origin[j] -= crand() * 32;
+			states[i][numstates].angles[YAW] -= crand() * 20;
+			states[i][numstates].frame--;
+		}
+		numstates++;
+	}
+
+	outsize = 64 * numstates * DELTACACHE_BYTES + 16;
+	plain = Z_Malloc (outsize);
+	cached = Z_Malloc (outsize);
+
+	for (p=0 ; p<2 ; p++)
+	{
+		for (k=0 ; k<sizeof(clientcounts)/sizeof(clientcounts[0]) ; k++)
+		{
+			n = clientcounts[k];
+
+			SV_ClearDeltaCache (qFalse);
+			start = Sys_FloatTime ();
+			for (i=0 ; i<iterations ; i++)
+				SV_DeltaBenchPass (states, numstates, n, protocols[p], &plainmsg, plain, outsize);
+			plaintime = Sys_FloatTime () - start;
+
+			sv_deltahits = sv_deltamisses = 0;
+			sv_deltacounting = qTrue;
+			start = Sys_FloatTime ();
+			for (i=0 ; i<iterations ; i++)
+			{
+				SV_ClearDeltaCache (qTrue);
+				SV_DeltaBenchPass (states, numstates, n, protocols[p], &cachedmsg, cached, outsize);
+			}
+			cachedtime = Sys_FloatTime () - start;
+			sv_deltacounting = qFalse;
+			SV_ClearDeltaCache (qFalse);
+
+			Com_Printf ("protocol %i, %2i clients, %i entities: plain %6.2f ms, cached %6.2f ms (%.2fx), %i%% hits\n",
+				protocols[p], n, numstates, plaintime * 1000 / iterations, cachedtime * 1000 / iterations,
+				plaintime / cachedtime, sv_deltahits * 100 / (sv_deltahits + sv_deltamisses + 1));
+			if (plainmsg.cursize != cachedmsg.cursize || plainmsg.writebits != cachedmsg.writebits
+				|| memcmp (plain, cached, plainmsg.cursize))
+				Com_Printf ("delta_bench: cached encoding differs\n");
+		}
+	}
+
+	Z_Free (cached);
+	Z_Free (plain);
+	for (i=0 ; i<3 ; i++)
+		Z_Free (states[i]);
+}
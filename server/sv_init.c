@@ -179,6 +179,7 @@ void SV_SpawnServer (char *server, char *spawnpoint, server_state_t serverstate,
 	Com_DPrintf ("SpawnServer: %s\n",server);
 	if (sv.demofile)
 		fclose (sv.demofile);
+	SV_CloseTraceLog ();
 
 	svs.spawncount++;		// any partially connected client will be
 							// restarted
@@ -230,6 +231,7 @@ void SV_SpawnServer (char *server, char *spawnpoint, server_state_t serverstate,
 	{
 		Com_sprintf (sv.configstrings[CS_MODELS+1],sizeof(sv.configstrings[CS_MODELS+1]),
 			"maps/%s.bsp", server);
+		FS_BeginMapLoad (sv.configstrings[CS_MODELS+1]);
 		sv.models[1] = CM_LoadMap (sv.configstrings[CS_MODELS+1], qFalse, &checksum);
 	}
 	Com_sprintf (sv.configstrings[CS_MAPCHECKSUM],sizeof(sv.configstrings[CS_MAPCHECKSUM]),
@@ -239,6 +241,7 @@ void SV_SpawnServer (char *server, char *spawnpoint, server_state_t serverstate,
 	// clear physics interaction links
 	//
 	SV_ClearWorld ();
+	SV_ClearMulticastIndex ();
 	
 	for (i=1 ; i< CM_NumInlineModels() ; i++)
 	{
@@ -276,6 +279,10 @@ void SV_SpawnServer (char *server, char *spawnpoint, server_state_t serverstate,
 	// set serverinfo variable
 	Cvar_FullSet ("mapname", sv.name, CVAR_SERVERINFO | CVAR_NOSET);
 
+	// a listen server's load goes on until its client has prepped
+	if (dedicated->value)
+		FS_EndMapLoad ();
+
 	Com_Printf ("-------------------------------------\n");
 }
 
@@ -28,6 +28,10 @@ cvar_t	*sv_paused;
 cvar_t	*sv_timedemo;
 
 cvar_t	*sv_enforcetime;
+cvar_t	*sv_tracelog;
+cvar_t	*sv_bitprotocol;
+cvar_t	*sv_parallelsend;
+cvar_t	*sv_deltacache;
 
 cvar_t	*timeout;				// seconds without any message
 cvar_t	*zombietime;			// seconds to sink messages after disconnect
@@ -333,6 +337,12 @@ void SVC_DirectConnect (void)
 	newcl = &temp;
 	memset (newcl, 0, sizeof(client_t));
 
+	// newer clients offer the bit packed frame encoding after the userinfo
+	if (sv_bitprotocol->value && atoi(Cmd_Argv(5)) == PROTOCOL_VERSION_BITS)
+		newcl->protocol = PROTOCOL_VERSION_BITS;
+	else
+		newcl->protocol = PROTOCOL_VERSION;
+
 	// if there is already a slot for this ip, reuse it
 	for (i=0,cl=svs.clients ; i<maxclients->value ; i++,cl++)
 	{
@@ -715,6 +725,282 @@ void SV_PrepWorldFrame (void)
 }
 
 
+/*
+==============================================================================
+
+FRAME PROFILE
+
+Every SV_Frame that runs the world leaves a sample in a ring of the last
+PROFILE_FRAMES, with where each phase started and how long it took.
+Only SV_Frame writes the ring.  It fills in the slot and then bumps the
+head, so a reader on another thread copies the samples it wants and
+looks at the head again to throw out any that were written over in the
+meantime.  Packets read by the calls that returned early to sleep are
+not counted.
+==============================================================================
+*/
+
+typedef enum
+{
+	PROF_READPACKETS,
+	PROF_CALCPINGS,
+	PROF_RUNFRAME,
+	PROF_SENDMESSAGES,
+	PROF_HEARTBEAT,
+	PROF_PREPWORLD,
+	PROF_NUMPHASES
+} profphase_t;
+
+static char	*sv_profnames[PROF_NUMPHASES] =
+{
+	"SV_ReadPackets",
+	"SV_CalcPings",
+	"ge->RunFrame",
+	"SV_SendClientMessages",
+	"Master_Heartbeat",
+	"SV_PrepWorldFrame"
+};
+
+#define	PROFILE_FRAMES		1024	// power of two
+#define	PROFILE_BUDGET		0.1		// seconds in a server frame
+
+typedef struct
+{
+	int		framenum;
+	double	start;						// Sys_FloatTime at the top of SV_Frame
+	float	begin[PROF_NUMPHASES];		// seconds after start
+	float	length[PROF_NUMPHASES];
+	float	total;
+} profsample_t;
+
+typedef struct
+{
+	volatile int	head;				// samples ever finished
+	profsample_t	samples[PROFILE_FRAMES];
+	profsample_t	current;			// the frame being run
+} profile_t;
+
+profile_t	sv_profile;
+
+/*
+=================
+SV_ProfileBegin
+
+Starts a new sample at the top of SV_Frame
+=================
+*/
+static void SV_ProfileBegin (void)
+{
+	memset (&sv_profile.current, 0, sizeof(sv_profile.current));
+	sv_profile.current.start = Sys_FloatTime ();
+}
+
+/*
+=================
+SV_ProfilePhase
+
+Records a phase of the current frame that started at begin
+=================
+*/
+static void SV_ProfilePhase (profphase_t phase, double begin)
+{
+	sv_profile.current.begin[phase] = begin - sv_profile.current.start;
+	sv_profile.current.length[phase] = Sys_FloatTime () - begin;
+}
+
+/*
+=================
+SV_ProfileEnd
+
+Puts the finished frame in the ring
+=================
+*/
+static void SV_ProfileEnd (void)
+{
+	int		head;
+
+	sv_profile.current.framenum = sv.framenum;
+	sv_profile.current.total = Sys_FloatTime () - sv_profile.current.start;
+
+	head = sv_profile.head;
+	sv_profile.samples[head & (PROFILE_FRAMES-1)] = sv_profile.current;
+	sv_profile.head = head + 1;		// volatile store, after the sample on x86
+}
+
+/*
+=================
+SV_ProfileSamples
+
+Copies the samples still in the ring to out, oldest first
+=================
+*/
+static int SV_ProfileSamples (profsample_t *out)
+{
+	int		head, count, drop, i;
+
+	head = sv_profile.head;
+	count = head < PROFILE_FRAMES ? head : PROFILE_FRAMES;
+	for (i=0 ; i<count ; i++)
+		out[i] = sv_profile.samples[(head - count + i) & (PROFILE_FRAMES-1)];
+
+	// the writer may have come around onto the oldest ones, and could be
+	// in the middle of the next slot
+	drop = sv_profile.head - head + 1 - (PROFILE_FRAMES - count);
+	if (drop > 0)
+	{
+		if (drop > count)
+			drop = count;
+		count -= drop;
+		memmove (out, out + drop, count * sizeof(*out));
+	}
+
+	return count;
+}
+
+static int SV_ProfileCompare (const void *a, const void *b)
+{
+	float	fa, fb;
+
+	fa = *(float *)a;
+	fb = *(float *)b;
+	if (fa < fb)
+		return -1;
+	if (fa > fb)
+		return 1;
+	return 0;
+}
+
+/*
+=================
+SV_ProfilePrintLine
+
+One row of the sv_profile table, values in seconds
+=================
+*/
+static void SV_ProfilePrintLine (char *name, float *values, int count)
+{
+	double	sum;
+	int		i;
+
+	sum = 0;
+	for (i=0 ; i<count ; i++)
+		sum += values[i];
+	qsort (values, count, sizeof(*values), SV_ProfileCompare);
+
+	Com_Printf ("%-22s %7.3f %7.3f %7.3f %7.3f %7.3f\n", name,
+		sum * 1000 / count,
+		values[count/2] * 1000,
+		values[count*9/10] * 1000,
+		values[count*99/100] * 1000,
+		values[count-1] * 1000);
+}
+
+/*
+=================
+SV_ProfileDump
+
+Writes the samples as Chrome trace events, each frame with its phases
+inside it, for chrome://tracing or Perfetto
+=================
+*/
+static void SV_ProfileDump (profsample_t *samples, int count, char *filename)
+{
+	char			name[MAX_OSPATH];
+	profsample_t	*s;
+	FILE			*f;
+	double			base, ts;
+	int				i, p;
+
+	Com_sprintf (name, sizeof(name), "%s/profiles/%s.json", FS_Gamedir(), filename);
+	FS_CreatePath (name);
+	f = fopen (name, "w");
+	if (!f)
+	{
+		Com_Printf ("ERROR: couldn't open %s.\n", name);
+		return;
+	}
+
+	fprintf (f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf (f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"SV_Frame\"}}");
+
+	base = samples[0].start;
+	for (i=0, s=samples ; i<count ; i++, s++)
+	{
+		ts = (s->start - base) * 1000000;
+		fprintf (f, ",\n{\"name\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.1f,\"dur\":%.1f,\"args\":{\"framenum\":%i}}",
+			ts, s->total * 1000000, s->framenum);
+
+		for (p=0 ; p<PROF_NUMPHASES ; p++)
+			fprintf (f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.1f,\"dur\":%.1f}",
+				sv_profnames[p], ts + s->begin[p] * 1000000, s->length[p] * 1000000);
+	}
+
+	fprintf (f, "\n]}\n");
+	fclose (f);
+
+	Com_Printf ("Wrote %i frames to %s.\n", count, name);
+}
+
+/*
+=================
+SV_Profile_f
+
+sv_profile [dump [name] | clear]
+
+Prints the mean and percentiles of each phase of the frames in the
+profile ring, or writes them out for a trace viewer
+=================
+*/
+void SV_Profile_f (void)
+{
+	profsample_t	*samples;
+	float			*values;
+	int				count, over, i, p;
+
+	if (Cmd_Argc() > 1 && !Q_stricmp (Cmd_Argv(1), "clear"))
+	{
+		sv_profile.head = 0;
+		return;
+	}
+
+	samples = Z_Malloc (PROFILE_FRAMES * sizeof(*samples));
+	values = Z_Malloc (PROFILE_FRAMES * sizeof(*values));
+
+	count = SV_ProfileSamples (samples);
+	if (!count)
+	{
+		Com_Printf ("sv_profile: no frames recorded\n");
+	}
+	else if (Cmd_Argc() > 1 && !Q_stricmp (Cmd_Argv(1), "dump"))
+	{
+		SV_ProfileDump (samples, count, Cmd_Argc() > 2 ? Cmd_Argv(2) : (sv.name[0] ? sv.name : "server"));
+	}
+	else
+	{
+		over = 0;
+		for (i=0 ; i<count ; i++)
+			if (samples[i].total > PROFILE_BUDGET)
+				over++;
+
+		Com_Printf ("%i frames, %i over %i ms\n", count, over, (int)(PROFILE_BUDGET * 1000));
+		Com_Printf ("%-22s %7s %7s %7s %7s %7s\n", "ms", "mean", "p50", "p90", "p99", "max");
+		for (p=0 ; p<PROF_NUMPHASES ; p++)
+		{
+			for (i=0 ; i<count ; i++)
+				values[i] = samples[i].length[p];
+			SV_ProfilePrintLine (sv_profnames[p], values, count);
+		}
+		for (i=0 ; i<count ; i++)
+			values[i] = samples[i].total;
+		SV_ProfilePrintLine ("frame", values, count);
+	}
+
+	Z_Free (values);
+	Z_Free (samples);
+}
+
+//============================================================================
+
 /*
 =================
 SV_RunGameFrame
@@ -722,6 +1008,8 @@ SV_RunGameFrame
 */
 void SV_RunGameFrame (void)
 {
+	double	prof;
+
 	if (host_speeds->value)
 		time_before_game = Sys_Milliseconds ();
 
@@ -735,7 +1023,9 @@ void SV_RunGameFrame (void)
 	// don't run if paused
 	if (!sv_paused->value || maxclients->value > 1)
 	{
+		prof = Sys_FloatTime ();
 		ge->RunFrame ();
+		SV_ProfilePhase (PROF_RUNFRAME, prof);
 
 		// never get more than one tic behind
 		if (sv.time < svs.realtime)
@@ -759,12 +1049,16 @@ SV_Frame
 */
 void SV_Frame (int msec)
 {
+	double	prof;
+
 	time_before_game = time_after_game = 0;
 
 	// if server is not active, do nothing
 	if (!svs.initialized)
 		return;
 
+	SV_ProfileBegin ();
+
     svs.realtime += msec;
 
 	// keep the random time dependent
@@ -774,7 +1068,9 @@ void SV_Frame (int msec)
 	SV_CheckTimeouts ();
 
 	// get packets from clients
+	prof = Sys_FloatTime ();
 	SV_ReadPackets ();
+	SV_ProfilePhase (PROF_READPACKETS, prof);
 
 	// move autonomous things around if enough time has passed
 	if (!sv_timedemo->value && svs.realtime < sv.time)
@@ -790,8 +1086,17 @@ void SV_Frame (int msec)
 		return;
 	}
 
+	// start or end the collision log
+	if (sv_tracelog->modified)
+	{
+		sv_tracelog->modified = qFalse;
+		SV_CloseTraceLog ();
+	}
+
 	// update ping based on the last known frame from all clients
+	prof = Sys_FloatTime ();
 	SV_CalcPings ();
+	SV_ProfilePhase (PROF_CALCPINGS, prof);
 
 	// give the clients some timeslices
 	SV_GiveMsec ();
@@ -800,17 +1105,24 @@ void SV_Frame (int msec)
 	SV_RunGameFrame ();
 
 	// send messages back to the clients that had packets read this frame
+	prof = Sys_FloatTime ();
 	SV_SendClientMessages ();
+	SV_ProfilePhase (PROF_SENDMESSAGES, prof);
 
 	// save the entire world state if recording a serverdemo
 	SV_RecordDemoMessage ();
 
 	// send a heartbeat to the master if needed
+	prof = Sys_FloatTime ();
 	Master_Heartbeat ();
+	SV_ProfilePhase (PROF_HEARTBEAT, prof);
 
 	// clear teleport flags, etc for next frame
+	prof = Sys_FloatTime ();
 	SV_PrepWorldFrame ();
+	SV_ProfilePhase (PROF_PREPWORLD, prof);
 
+	SV_ProfileEnd ();
 }
 
 //============================================================================
@@ -966,6 +1278,10 @@ void SV_Init (void)
 	sv_paused = Cvar_Get ("paused", "0", 0);
 	sv_timedemo = Cvar_Get ("timedemo", "0", 0);
 	sv_enforcetime = Cvar_Get ("sv_enforcetime", "0", 0);
+	sv_tracelog = Cvar_Get ("sv_tracelog", "0", 0);
+	sv_bitprotocol = Cvar_Get ("sv_bitprotocol", "1", 0);
+	sv_parallelsend = Cvar_Get ("sv_parallelsend", "1", 0);
+	sv_deltacache = Cvar_Get ("sv_deltacache", "1", 0);
 	allow_download = Cvar_Get ("allow_download", "1", CVAR_ARCHIVE);
 	allow_download_players  = Cvar_Get ("allow_download_players", "0", CVAR_ARCHIVE);
 	allow_download_models = Cvar_Get ("allow_download_models", "1", CVAR_ARCHIVE);
@@ -1043,6 +1359,7 @@ void SV_Shutdown (char *finalmsg, qboolean reconnect)
 	// free current level
 	if (sv.demofile)
 		fclose (sv.demofile);
+	SV_CloseTraceLog ();
 	memset (&sv, 0, sizeof(sv));
 	Com_SetServerState (sv.state);
 
@@ -1051,6 +1368,8 @@ void SV_Shutdown (char *finalmsg, qboolean reconnect)
 		Z_Free (svs.clients);
 	if (svs.client_entities)
 		Z_Free (svs.client_entities);
+	if (svs.clientsends)
+		Z_Free (svs.clientsends);
 	if (svs.demofile)
 		fclose (svs.demofile);
 	memset (&svs, 0, sizeof(svs));
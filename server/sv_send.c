@@ -146,24 +146,135 @@ void SV_BroadcastCommand (char *fmt, ...)
 }
 
 
+/*
+The multicast index keeps the cluster and area of the leaf each client
+was in when SV_Multicast last looked, with the clients grouped by
+cluster, so a PVS or PHS multicast tests each occupied cluster against
+the row once instead of finding the leaf of every client.  The game can
+move a client edict without telling the server, so every multicast still
+compares the client origins against the index before using it.
+*/
+typedef struct
+{
+	qboolean	valid;
+	vec3_t		origin;			// edict origin the leaf was found for
+	int			cluster;
+	int			area;
+} mcclient_t;
+
+typedef struct
+{
+	qboolean	regroup;		// a client changed cluster since the groups were made
+	mcclient_t	clients[MAX_CLIENTS];
+	int			numgroups;
+	int			groupclusters[MAX_CLIENTS];
+	int			groupfirst[MAX_CLIENTS+1];	// into groupclients
+	int			groupclients[MAX_CLIENTS];
+} mcindex_t;
+
+mcindex_t	sv_mcindex;
+
 /*
 =================
-SV_Multicast
+SV_ClearMulticastIndex
 
-Sends the contents of sv.multicast to a subset of the clients,
-then clears sv.multicast.
+Called after a new map is loaded, the leafs are different
+=================
+*/
+void SV_ClearMulticastIndex (void)
+{
+	memset (&sv_mcindex, 0, sizeof(sv_mcindex));
+}
 
-MULTICAST_ALL	same as broadcast (origin can be NULL)
-MULTICAST_PVS	send to clients potentially visible from org
-MULTICAST_PHS	send to clients potentially hearable from org
+/*
+=================
+SV_UpdateMulticastIndex
+
+Finds the leaf again for the clients that moved, and groups the
+clients by cluster again if any of them changed cluster
 =================
 */
-void SV_Multicast (vec3_t origin, multicast_t to)
+static void SV_UpdateMulticastIndex (mcindex_t *index, client_t *clients, int numclients)
+{
+	client_t	*client;
+	mcclient_t	*mc;
+	int			leafnum, cluster;
+	int			j, g;
+
+	for (j=0, client=clients ; j<numclients ; j++, client++)
+	{
+		if (client->state == cs_free || client->state == cs_zombie)
+			continue;
+
+		mc = &index->clients[j];
+		if (mc->valid && VectorCompare (mc->origin, client->edict->s.origin))
+			continue;
+
+		leafnum = CM_PointLeafnum (client->edict->s.origin);
+		cluster = CM_LeafCluster (leafnum);
+		if (!mc->valid || mc->cluster != cluster)
+			index->regroup = qTrue;
+
+		mc->valid = qTrue;
+		VectorCopy (client->edict->s.origin, mc->origin);
+		mc->cluster = cluster;
+		mc->area = CM_LeafArea (leafnum);
+	}
+
+	if (!index->regroup)
+		return;
+	index->regroup = qFalse;
+
+	// count the clients in each cluster, then hand out the slots
+	index->numgroups = 0;
+	memset (index->groupfirst, 0, sizeof(index->groupfirst));
+	for (j=0, mc=index->clients ; j<numclients ; j++, mc++)
+	{
+		if (!mc->valid)
+			continue;
+		for (g=0 ; g<index->numgroups ; g++)
+			if (index->groupclusters[g] == mc->cluster)
+				break;
+		if (g == index->numgroups)
+			index->groupclusters[index->numgroups++] = mc->cluster;
+		index->groupfirst[g+1]++;
+	}
+
+	for (g=0 ; g<index->numgroups ; g++)
+		index->groupfirst[g+1] += index->groupfirst[g];
+
+	for (j=0, mc=index->clients ; j<numclients ; j++, mc++)
+	{
+		if (!mc->valid)
+			continue;
+		for (g=0 ; g<index->numgroups ; g++)
+			if (index->groupclusters[g] == mc->cluster)
+				break;
+		// groupfirst[g] walks up to the start of the next group, and
+		// gets put back below
+		index->groupclients[index->groupfirst[g]++] = j;
+	}
+
+	for (g=index->numgroups ; g>0 ; g--)
+		index->groupfirst[g] = index->groupfirst[g-1];
+	index->groupfirst[0] = 0;
+}
+
+/*
+=================
+SV_MulticastClients
+
+Lists the clients a multicast to goes to, in no particular order.
+index is NULL to find every client's leaf the slow way.
+=================
+*/
+static int SV_MulticastClients (mcindex_t *index, client_t *clients, int numclients,
+	vec3_t origin, multicast_t to, client_t **list)
 {
 	client_t	*client;
 	byte		*mask;
 	int			leafnum, cluster;
-	int			j;
+	int			j, g, k, count;
 	qboolean	reliable;
 	int			area1, area2;
 
@@ -180,10 +291,6 @@ void SV_Multicast (vec3_t origin, multicast_t to)
 		area1 = 0;
 	}
 
-	// if doing a serverrecord, store everything
-	if (svs.demofile)
-		SZ_Write (&svs.demo_multicast, sv.multicast.data, sv.multicast.cursize);
-	
 	switch (to)
 	{
 	case MULTICAST_ALL_R:
@@ -196,7 +303,6 @@ void SV_Multicast (vec3_t origin, multicast_t to)
 	case MULTICAST_PHS_R:
 		reliable = qTrue;	// intentional fallthrough
 	case MULTICAST_PHS:
-		leafnum = CM_PointLeafnum (origin);
 		cluster = CM_LeafCluster (leafnum);
 		mask = CM_ClusterPHS (cluster);
 		break;
@@ -204,7 +310,6 @@ void SV_Multicast (vec3_t origin, multicast_t to)
 	case MULTICAST_PVS_R:
 		reliable = qTrue;	// intentional fallthrough
 	case MULTICAST_PVS:
-		leafnum = CM_PointLeafnum (origin);
 		cluster = CM_LeafCluster (leafnum);
 		mask = CM_ClusterPVS (cluster);
 		break;
@@ -214,8 +319,35 @@ void SV_Multicast (vec3_t origin, multicast_t to)
 		Com_Error (ERR_FATAL, "SV_Multicast: bad to:%i", to);
 	}
 
-	// send the data to all relevent clients
-	for (j = 0, client = svs.clients; j < maxclients->value; j++, client++)
+	count = 0;
+
+	if (mask && index)
+	{
+		SV_UpdateMulticastIndex (index, clients, numclients);
+
+		for (g=0 ; g<index->numgroups ; g++)
+		{
+			cluster = index->groupclusters[g];
+			if (!(mask[cluster>>3] & (1<<(cluster&7))))
+				continue;
+
+			for (k=index->groupfirst[g] ; k<index->groupfirst[g+1] ; k++)
+			{
+				j = index->groupclients[k];
+				client = &clients[j];
+				if (client->state == cs_free || client->state == cs_zombie)
+					continue;
+				if (client->state != cs_spawned && !reliable)
+					continue;
+				if (!CM_AreasConnected (area1, index->clients[j].area))
+					continue;
+				list[count++] = client;
+			}
+		}
+		return count;
+	}
+
+	for (j=0, client=clients ; j<numclients ; j++, client++)
 	{
 		if (client->state == cs_free || client->state == cs_zombie)
 			continue;
@@ -233,10 +365,44 @@ void SV_Multicast (vec3_t origin, multicast_t to)
 				continue;
 		}
 
+		list[count++] = client;
+	}
+
+	return count;
+}
+
+/*
+=================
+SV_Multicast
+
+Sends the contents of sv.multicast to a subset of the clients,
+then clears sv.multicast.
+
+MULTICAST_ALL	same as broadcast (origin can be NULL)
+MULTICAST_PVS	send to clients potentially visible from org
+MULTICAST_PHS	send to clients potentially hearable from org
+=================
+*/
+void SV_Multicast (vec3_t origin, multicast_t to)
+{
+	client_t	*list[MAX_CLIENTS];
+	int			i, count;
+	qboolean	reliable;
+
+	// if doing a serverrecord, store everything
+	if (svs.demofile)
+		SZ_Write (&svs.demo_multicast, sv.multicast.data, sv.multicast.cursize);
+
+	count = SV_MulticastClients (&sv_mcindex, svs.clients, maxclients->value, origin, to, list);
+
+	// send the data to all relevent clients
+	reliable = (to == MULTICAST_ALL_R || to == MULTICAST_PHS_R || to == MULTICAST_PVS_R);
+	for (i=0 ; i<count ; i++)
+	{
 		if (reliable)
-			SZ_Write (&client->netchan.message, sv.multicast.data, sv.multicast.cursize);
+			SZ_Write (&list[i]->netchan.message, sv.multicast.data, sv.multicast.cursize);
 		else
-			SZ_Write (&client->datagram, sv.multicast.data, sv.multicast.cursize);
+			SZ_Write (&list[i]->datagram, sv.multicast.data, sv.multicast.cursize);
 	}
 
 	SZ_Clear (&sv.multicast);
@@ -389,22 +555,51 @@ FRAME UPDATES
 
 /*
 =======================
-SV_SendClientDatagram
+SV_BuildFrameJob
+
 =======================
 */
-qboolean SV_SendClientDatagram (client_t *client)
+void SV_BuildFrameJob (int index, void *data)
 {
-	byte		msg_buf[MAX_MSGLEN];
-	sizebuf_t	msg;
+	clientsend_t	*send;
 
-	SV_BuildClientFrame (client);
+	send = (clientsend_t *)data + index;
+	SV_BuildClientFrame (send->client, send);
+}
+
+/*
+=======================
+SV_WriteFrameJob
+
+The frame goes in a buffer no frame can overflow, so nothing here has to
+print.  SV_SendClientDatagram does the MAX_MSGLEN check.
+=======================
+*/
+void SV_WriteFrameJob (int index, void *data)
+{
+	clientsend_t	*send;
 
-	SZ_Init (&msg, msg_buf, sizeof(msg_buf));
-	msg.allowoverflow = qTrue;
+	send = (clientsend_t *)data + index;
+	SV_CopyClientEntities (send->client, send);
 
 	// send over all the relevant entity_state_t
 	// and the player_state_t
-	SV_WriteFrameToClient (client, &msg);
+	SZ_Init (&send->msg, send->msgbuf, sizeof(send->msgbuf));
+	SV_WriteFrameToClient (send->client, &send->msg);
+}
+
+/*
+=======================
+SV_SendClientDatagram
+=======================
+*/
+qboolean SV_SendClientDatagram (clientsend_t *send)
+{
+	client_t	*client;
+	sizebuf_t	*msg;
+
+	client = send->client;
+	msg = &send->msg;
 
 	// copy the accumulated multicast datagram
 	// for this client out to the message
@@ -413,24 +608,98 @@ qboolean SV_SendClientDatagram (client_t *client)
 	if (client->datagram.overflowed)
 		Com_Printf ("WARNING: datagram overflowed for %s\n", client->name);
 	else
-		SZ_Write (&msg, client->datagram.data, client->datagram.cursize);
+		SZ_Write (msg, client->datagram.data, client->datagram.cursize);
 	SZ_Clear (&client->datagram);
 
-	if (msg.overflowed)
+	if (msg->cursize > MAX_MSGLEN)
 	{	// must have room left for the packet header
 		Com_Printf ("WARNING: msg overflowed for %s\n", client->name);
-		SZ_Clear (&msg);
+		SZ_Clear (msg);
 	}
 
 	// send the datagram
-	Netchan_Transmit (&client->netchan, msg.cursize, msg.data);
+	Netchan_Transmit (&client->netchan, msg->cursize, msg->data);
 
 	// record the size for rate estimation
-	client->message_size[sv.framenum % RATE_MESSAGES] = msg.cursize;
+	client->message_size[sv.framenum % RATE_MESSAGES] = msg->cursize;
 
 	return qTrue;
 }
 
+/*
+=======================
+SV_ClientSends
+
+Makes sure svs.clientsends holds at least count
+=======================
+*/
+static clientsend_t *SV_ClientSends (int count)
+{
+	if (svs.numclientsends < count)
+	{
+		if (svs.clientsends)
+			Z_Free (svs.clientsends);
+		svs.clientsends = Z_Malloc (count * sizeof(clientsend_t));
+		svs.numclientsends = count;
+	}
+	return svs.clientsends;
+}
+
+/*
+=======================
+SV_SendClientDatagrams
+
+Every client's frame depends only on the finished game frame, so with
+sv_parallelsend they are built and encoded on worker threads.  The
+shared client_entities ring is handed out in between, in client order,
+so the packets come out the same either way, unless the ring is so full
+that SV_WriteFrameToClient has to drop a delta.  Without it the clients
+go through one at a time and only need one clientsend_t.
+=======================
+*/
+void SV_SendClientDatagrams (client_t **clients, int count)
+{
+	clientsend_t	*sends;
+	int				i;
+
+	if (!count)
+		return;
+
+	// clients delta'ing from the same frame share encoded entities
+	SV_ClearDeltaCache (count > 1 && sv_deltacache->value);
+
+	if (!sv_parallelsend->value || count == 1)
+	{
+		sends = SV_ClientSends (1);
+		for (i=0 ; i<count ; i++)
+		{
+			sends->client = clients[i];
+			SV_BuildFrameJob (0, sends);
+			SV_ReserveClientEntities (sends->client, sends);
+			SV_WriteFrameJob (0, sends);
+			SV_SendClientDatagram (sends);
+		}
+		SV_ClearDeltaCache (qFalse);
+		return;
+	}
+
+	sends = SV_ClientSends (count);
+	for (i=0 ; i<count ; i++)
+		sends[i].client = clients[i];
+
+	Com_ParallelJobs (count, SV_BuildFrameJob, sends);
+
+	for (i=0 ; i<count ; i++)
+		SV_ReserveClientEntities (sends[i].client, &sends[i]);
+
+	Com_ParallelJobs (count, SV_WriteFrameJob, sends);
+
+	SV_ClearDeltaCache (qFalse);
+
+	for (i=0 ; i<count ; i++)
+		SV_SendClientDatagram (&sends[i]);
+}
+
 
 /*
 ==================
@@ -494,8 +763,11 @@ void SV_SendClientMessages (void)
 	int			msglen;
 	byte		msgbuf[MAX_MSGLEN];
 	int			r;
+	client_t	*sendclients[MAX_CLIENTS];
+	int			numsends;
 
 	msglen = 0;
+	numsends = 0;
 
 	// read the next demo message if needed
 	if (sv.state == ss_demo && sv.demofile)
@@ -554,7 +826,7 @@ void SV_SendClientMessages (void)
 			if (SV_RateDrop (c))
 				continue;
 
-			SV_SendClientDatagram (c);
+			sendclients[numsends++] = c;
 		}
 		else
 		{
@@ -563,5 +835,180 @@ void SV_SendClientMessages (void)
 				Netchan_Transmit (&c->netchan, 0, NULL);
 		}
 	}
+
+	SV_SendClientDatagrams (sendclients, numsends);
+}
+
+/*
+===============================================================================
+
+MULTICAST BENCHMARK
+
+===============================================================================
+*/
+
+/*
+=================
+SV_MulticastBenchPass
+
+Sends every event to the pretend clients, moving them to the next set of
+positions every sixteen events, and marks who each one went to in sets
+=================
+*/
+static double SV_MulticastBenchPass (mcindex_t *index, client_t *clients, int numclients,
+	vec3_t *positions, vec3_t *events, int numevents, byte *sets)
+{
+	static multicast_t	tos[4] = {MULTICAST_PVS, MULTICAST_PHS, MULTICAST_PVS_R, MULTICAST_PHS_R};
+	client_t	*list[MAX_CLIENTS];
+	byte		*set;
+	int			i, j, k, count;
+	double		start;
+
+	if (index)
+		memset (index, 0, sizeof(*index));
+	memset (sets, 0, numevents * MAX_CLIENTS/8);
+
+	start = Sys_FloatTime ();
+	for (i=0 ; i<numevents ; i++)
+	{
+		if (!(i & 15))
+		{
+			for (j=0 ; j<numclients ; j++)
+				VectorCopy (positions[(i>>4)*numclients + j], clients[j].edict->s.origin);
+		}
+
+		count = SV_MulticastClients (index, clients, numclients, events[i], tos[i&3], list);
+
+		set = sets + i*(MAX_CLIENTS/8);
+		for (j=0 ; j<count ; j++)
+		{
+			k = list[j] - clients;
+			set[k>>3] |= 1<<(k&7);
+		}
+	}
+	return Sys_FloatTime () - start;
 }
 
+/*
+=================
+SV_MulticastBenchSpot
+
+Somewhere near one of the edicts, or anywhere in the world without any
+=================
+*/
+static void SV_MulticastBenchSpot (vec3_t *spots, int numspots, vec3_t out)
+{
+	int		i;
+
+	if (!numspots)
+	{
+		for (i=0 ; i<3 ; i++)
+			out[i] = sv.models[1]->mins[i] + frand() * (sv.models[1]->maxs[i] - sv.models[1]->mins[i]);
+		return;
+	}
+
+	VectorCopy (spots[rand() % numspots], out);
+	for (i=0 ; i<3 ; i++)
+		out[i] += crand() * 64;
+}
+
+/*
+=================
+SV_MulticastBench_f
+
+multicast_bench [clients] [events]
+
+Sends PVS and PHS multicasts from around the current edicts to a crowd
+of pretend clients, a quarter of which move between each batch of
+sixteen events, and checks the multicast index picks the same clients
+as finding every client's leaf
+=================
+*/
+void SV_MulticastBench_f (void)
+{
+	client_t	*clients;
+	edict_t		*edicts;
+	mcindex_t	*index;
+	vec3_t		*spots, *positions, *events;
+	byte		*slowsets, *indexsets;
+	int			numclients, numevents, numbatches, numspots;
+	int			i, j, e, mismatched, reached;
+	double		slowtime, indextime;
+
+	if (sv.state != ss_game)
+	{
+		Com_Printf ("multicast_bench: no map running\n");
+		return;
+	}
+
+	numclients = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : 64;
+	numevents = Cmd_Argc() > 2 ? atoi(Cmd_Argv(2)) : 10000;
+	if (numclients < 1)
+		numclients = 1;
+	if (numclients > MAX_CLIENTS)
+		numclients = MAX_CLIENTS;
+	if (numevents < 1)
+		numevents = 1;
+	numbatches = (numevents + 15) >> 4;
+
+	clients = Z_Malloc (numclients * sizeof(*clients));
+	edicts = Z_Malloc (numclients * sizeof(*edicts));
+	index = Z_Malloc (sizeof(*index));
+	spots = Z_Malloc (ge->num_edicts * sizeof(*spots));
+	positions = Z_Malloc (numbatches * numclients * sizeof(*positions));
+	events = Z_Malloc (numevents * sizeof(*events));
+	slowsets = Z_Malloc (numevents * MAX_CLIENTS/8);
+	indexsets = Z_Malloc (numevents * MAX_CLIENTS/8);
+
+	numspots = 0;
+	for (e=1 ; e<ge->num_edicts ; e++)
+	{
+		if (EDICT_NUM(e)->inuse)
+			VectorCopy (EDICT_NUM(e)->s.origin, spots[numspots++]);
+	}
+
+	// every eighth client is still connecting and only gets the reliable ones
+	for (i=0 ; i<numclients ; i++)
+	{
+		clients[i].state = (i & 7) == 7 ? cs_connected : cs_spawned;
+		clients[i].edict = &edicts[i];
+		SV_MulticastBenchSpot (spots, numspots, positions[i]);
+	}
+	for (i=1 ; i<numbatches ; i++)
+	{
+		memcpy (positions[i*numclients], positions[(i-1)*numclients], numclients * sizeof(*positions));
+		for (j=0 ; j<numclients/4 ; j++)
+			SV_MulticastBenchSpot (spots, numspots, positions[i*numclients + rand() % numclients]);
+	}
+	for (i=0 ; i<numevents ; i++)
+		SV_MulticastBenchSpot (spots, numspots, events[i]);
+
+	slowtime = SV_MulticastBenchPass (NULL, clients, numclients, positions, events, numevents, slowsets);
+	indextime = SV_MulticastBenchPass (index, clients, numclients, positions, events, numevents, indexsets);
+
+	mismatched = reached = 0;
+	for (i=0 ; i<numevents ; i++)
+	{
+		if (memcmp (slowsets + i*(MAX_CLIENTS/8), indexsets + i*(MAX_CLIENTS/8), MAX_CLIENTS/8))
+			mismatched++;
+		for (j=0 ; j<numclients ; j++)
+			if (indexsets[i*(MAX_CLIENTS/8) + (j>>3)] & (1<<(j&7)))
+				reached++;
+	}
+
+	Com_Printf ("%i clients, %i events reaching %.1f clients each\n",
+		numclients, numevents, (float)reached / numevents);
+	Com_Printf ("leaf per client %7.2f ms, index %7.2f ms (%.2fx)\n",
+		slowtime * 1000, indextime * 1000, slowtime / indextime);
+	if (mismatched)
+		Com_Printf ("multicast_bench: %i events went to different clients\n", mismatched);
+
+	Z_Free (indexsets);
+	Z_Free (slowsets);
+	Z_Free (events);
+	Z_Free (positions);
+	Z_Free (spots);
+	Z_Free (index);
+	Z_Free (edicts);
+	Z_Free (clients);
+}
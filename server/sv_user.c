@@ -84,7 +84,7 @@ void SV_New_f (void)
 
 	// send the serverdata
 	MSG_WriteByte (&sv_client->netchan.message, svc_serverdata);
-	MSG_WriteLong (&sv_client->netchan.message, PROTOCOL_VERSION);
+	MSG_WriteLong (&sv_client->netchan.message, sv_client->protocol);
 	MSG_WriteLong (&sv_client->netchan.message, svs.spawncount);
 	MSG_WriteByte (&sv_client->netchan.message, sv.attractloop);
 	MSG_WriteString (&sv_client->netchan.message, gamedir);
@@ -543,6 +543,7 @@ void SV_ExecuteClientMessage (client_t *cl)
 	int		checksumIndex;
 	qboolean	move_issued;
 	int		lastframe;
+	byte	*header;
 
 	sv_client = cl;
 	sv_player = sv_client->edict;
@@ -575,7 +576,7 @@ void SV_ExecuteClientMessage (client_t *cl)
 			break;
 
 		case clc_userinfo:
-			strncpy (cl->userinfo, MSG_ReadString (&net_message), sizeof(cl->userinfo)-1);
+			strncpy (cl->userinfo, MSG_ReadStringView (&net_message), sizeof(cl->userinfo)-1);
 			SV_UserinfoChanged (cl);
 			break;
 
@@ -585,8 +586,11 @@ void SV_ExecuteClientMessage (client_t *cl)
 
 			move_issued = qTrue;
 			checksumIndex = net_message.readcount;
-			checksum = MSG_ReadByte (&net_message);
-			lastframe = MSG_ReadLong (&net_message);
+			header = MSG_ReadBlock (&net_message, 5);
+			if (!header)
+				break;		// overrun, dropped at the top of the loop
+			checksum = header[0];
+			lastframe = header[1] + (header[2]<<8) + (header[3]<<16) + (header[4]<<24);
 			if (lastframe != cl->lastframe) {
 				cl->lastframe = lastframe;
 				if (cl->lastframe > 0) {
@@ -649,7 +653,7 @@ void SV_ExecuteClientMessage (client_t *cl)
 			break;
 
 		case clc_stringcmd:	
-			s = MSG_ReadString (&net_message);
+			s = MSG_ReadStringView (&net_message);
 
 			// malicious users may try using too many string commands
 			if (++stringCmdCount < MAX_STRINGCMDS)
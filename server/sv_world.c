@@ -37,25 +37,49 @@ FIXME: this use of "area" is different from the bsp file use
 
 #define	EDICT_FROM_AREA(l) STRUCT_FROM_LINK(l,edict_t,area)
 
-typedef struct areanode_s
+/*
+The area grid is a loose grid over the world's x and y, kept at several
+cell sizes that double from one level to the next.  An entity goes in the
+first level whose cells are bigger than it is, in the cell holding its
+mins, so it can only reach into the next cell up in each direction and is
+on exactly one list.  A query looks at the cells its box covers on each
+level plus one more row and column below, which finds everything touching
+it without walking lists of entities somewhere else on the map.
+
+The cells give back entities in an order that depends on where they are
+and when they were linked, which the game can see: SV_ClipMoveToEntities
+keeps the first of two entities hit at the same fraction, and
+G_TouchTriggers touches them in list order.  So every query is sorted
+into entity number order, which doesn't change as entities move.
+*/
+#define	AREA_GRID		64		// most cells across the finest level
+#define	AREA_MINCELL	64		// smallest cell size in units
+#define	AREA_LEVELS		8
+#define	AREA_CELLS		(AREA_GRID*AREA_GRID*4/3 + AREA_LEVELS)
+
+typedef struct
 {
-	int		axis;		// -1 = leaf node
-	float	dist;
-	struct areanode_s	*children[2];
 	link_t	trigger_edicts;
 	link_t	solid_edicts;
-} areanode_t;
+} areacell_t;
 
-#define	AREA_DEPTH	4
-#define	AREA_NODES	32
+typedef struct
+{
+	float		cellsize;
+	float		scale;			// 1 / cellsize
+	int			width, height;
+	areacell_t	*cells;
+} arealevel_t;
 
-areanode_t	sv_areanodes[AREA_NODES];
-int			sv_numareanodes;
+typedef struct
+{
+	float		origin[2];
+	int			numlevels;		// the last is a single cell
+	arealevel_t	levels[AREA_LEVELS];
+	areacell_t	cells[AREA_CELLS];
+} areagrid_t;
 
-float	*area_mins, *area_maxs;
-edict_t	**area_list;
-int		area_count, area_maxcount;
-int		area_type;
+areagrid_t	sv_areagrid;
 
 int SV_HullForEntity (edict_t *ent);
 
@@ -82,48 +106,114 @@ void InsertLinkBefore (link_t *l, link_t *before)
 
 /*
 ===============
-SV_CreateAreaNode
+SV_CreateAreaGrid
 
-Builds a uniformly subdivided tree for the given world size
+Sizes the levels so the finest has no more than AREA_GRID cells across
+the given world, and the coarsest holds it in one
 ===============
 */
-areanode_t *SV_CreateAreaNode (int depth, vec3_t mins, vec3_t maxs)
+static void SV_CreateAreaGrid (areagrid_t *grid, vec3_t mins, vec3_t maxs)
 {
-	areanode_t	*anode;
-	vec3_t		size;
-	vec3_t		mins1, maxs1, mins2, maxs2;
+	arealevel_t	*level;
+	areacell_t	*cell;
+	float		size, cellsize;
+	int			i;
 
-	anode = &sv_areanodes[sv_numareanodes];
-	sv_numareanodes++;
+	grid->origin[0] = mins[0];
+	grid->origin[1] = mins[1];
 
-	ClearLink (&anode->trigger_edicts);
-	ClearLink (&anode->solid_edicts);
-	
-	if (depth == AREA_DEPTH)
+	size = maxs[0] - mins[0];
+	if (maxs[1] - mins[1] > size)
+		size = maxs[1] - mins[1];
+
+	cellsize = AREA_MINCELL;
+	while (cellsize * AREA_GRID < size)
+		cellsize *= 2;
+
+	cell = grid->cells;
+	for (grid->numlevels = 0 ; grid->numlevels < AREA_LEVELS ; grid->numlevels++)
 	{
-		anode->axis = -1;
-		anode->children[0] = anode->children[1] = NULL;
-		return anode;
+		level = &grid->levels[grid->numlevels];
+		level->cellsize = cellsize;
+		level->scale = 1.0 / cellsize;
+		level->width = (int)ceil((maxs[0] - mins[0]) / cellsize);
+		level->height = (int)ceil((maxs[1] - mins[1]) / cellsize);
+		if (level->width < 1)
+			level->width = 1;
+		if (level->height < 1)
+			level->height = 1;
+
+		level->cells = cell;
+		for (i=0 ; i<level->width*level->height ; i++, cell++)
+		{
+			ClearLink (&cell->trigger_edicts);
+			ClearLink (&cell->solid_edicts);
+		}
+
+		if (level->width == 1 && level->height == 1)
+			break;
+		cellsize *= 2;
 	}
-	
-	VectorSubtract (maxs, mins, size);
-	if (size[0] > size[1])
-		anode->axis = 0;
-	else
-		anode->axis = 1;
-	
-	anode->dist = 0.5 * (maxs[anode->axis] + mins[anode->axis]);
-	VectorCopy (mins, mins1);	
-	VectorCopy (mins, mins2);	
-	VectorCopy (maxs, maxs1);	
-	VectorCopy (maxs, maxs2);	
-	
-	maxs1[anode->axis] = mins2[anode->axis] = anode->dist;
-	
-	anode->children[0] = SV_CreateAreaNode (depth+1, mins2, maxs2);
-	anode->children[1] = SV_CreateAreaNode (depth+1, mins1, maxs1);
+	grid->numlevels++;
 
-	return anode;
+	if (grid->levels[grid->numlevels-1].width != 1 || grid->levels[grid->numlevels-1].height != 1)
+		Com_Error (ERR_DROP, "SV_CreateAreaGrid: world too large");
+}
+
+/*
+===============
+SV_AreaCell
+
+Which column or row v falls in, clamped to the grid.  Clamping keeps the
+order, so anything off the edge of the world still lands in the cell a
+query from the same side will look at.
+===============
+*/
+static int SV_AreaCell (arealevel_t *level, float v, float origin, int count)
+{
+	float	f;
+
+	f = (float)floor ((v - origin) * level->scale);
+	if (f < 0)
+		return 0;
+	if (f >= count)
+		return count - 1;
+	return (int)f;
+}
+
+/*
+===============
+SV_AreaLink
+
+Puts a linked entity's abs box on its list in the grid
+===============
+*/
+static void SV_AreaLink (areagrid_t *grid, edict_t *ent)
+{
+	arealevel_t	*level;
+	areacell_t	*cell;
+	float		size;
+	int			i;
+
+	size = ent->absmax[0] - ent->absmin[0];
+	if (ent->absmax[1] - ent->absmin[1] > size)
+		size = ent->absmax[1] - ent->absmin[1];
+
+	// a unit of slack so rounding in SV_AreaCell can't push the box
+	// more than one cell past its mins
+	for (i=0 ; i<grid->numlevels-1 ; i++)
+		if (size + 1 < grid->levels[i].cellsize)
+			break;
+	level = &grid->levels[i];
+
+	cell = level->cells
+		+ SV_AreaCell (level, ent->absmin[1], grid->origin[1], level->height) * level->width
+		+ SV_AreaCell (level, ent->absmin[0], grid->origin[0], level->width);
+
+	if (ent->solid == SOLID_TRIGGER)
+		InsertLinkBefore (&ent->area, &cell->trigger_edicts);
+	else
+		InsertLinkBefore (&ent->area, &cell->solid_edicts);
 }
 
 /*
@@ -134,9 +224,7 @@ SV_ClearWorld
 */
 void SV_ClearWorld (void)
 {
-	memset (sv_areanodes, 0, sizeof(sv_areanodes));
-	sv_numareanodes = 0;
-	SV_CreateAreaNode (0, sv.models[1]->mins, sv.models[1]->maxs);
+	SV_CreateAreaGrid (&sv_areagrid, sv.models[1]->mins, sv.models[1]->maxs);
 }
 
 
@@ -164,7 +252,6 @@ SV_LinkEdict
 #define MAX_TOTAL_ENT_LEAFS		128
 void SV_LinkEdict (edict_t *ent)
 {
-	areanode_t	*node;
 	int			leafs[MAX_TOTAL_ENT_LEAFS];
 	int			clusters[MAX_TOTAL_ENT_LEAFS];
 	int			num_leafs;
@@ -212,6 +299,10 @@ void SV_LinkEdict (edict_t *ent)
 	else if (ent->solid == SOLID_BSP)
 	{
 		ent->s.solid = 31;		// a solid_bbox will never create this value
+
+		// work out the rotation once for all the traces against it
+		if (ent->s.angles[0] || ent->s.angles[1] || ent->s.angles[2])
+			SV_EntityTransform (ent);
 	}
 	else
 		ent->s.solid = 0;
@@ -322,8 +413,221 @@ void SV_LinkEdict (edict_t *ent)
 	if (ent->solid == SOLID_NOT)
 		return;
 
-// find the first node that the ent's box crosses
-	node = sv_areanodes;
+// link it in
+	SV_AreaLink (&sv_areagrid, ent);
+}
+
+
+/*
+====================
+SV_EdictCompare
+====================
+*/
+static int SV_EdictCompare (const void *a, const void *b)
+{
+	edict_t	*e1, *e2;
+
+	e1 = *(edict_t **)a;
+	e2 = *(edict_t **)b;
+	if (e1 < e2)
+		return -1;
+	return e1 > e2;
+}
+
+/*
+====================
+SV_SortEdicts
+
+Puts a list of edicts in entity number order, which is their order in
+memory since they are all in one array
+====================
+*/
+static void SV_SortEdicts (edict_t **list, int count)
+{
+	edict_t	*check;
+	int		i, j;
+
+	if (count > 16)
+	{
+		qsort (list, count, sizeof(*list), SV_EdictCompare);
+		return;
+	}
+
+	// most queries find a handful
+	for (i=1 ; i<count ; i++)
+	{
+		check = list[i];
+		for (j=i ; j>0 && list[j-1] > check ; j--)
+			list[j] = list[j-1];
+		list[j] = check;
+	}
+}
+
+/*
+====================
+SV_AreaQuery
+
+Finds the entities touching the box in entity number order.  If there
+are more than maxcount, the list gets the lowest numbered ones.
+====================
+*/
+static int SV_AreaQuery (areagrid_t *grid, vec3_t mins, vec3_t maxs, edict_t **list,
+	int maxcount, int areatype)
+{
+	arealevel_t	*level;
+	areacell_t	*row;
+	link_t		*l, *next, *start;
+	edict_t		*check;
+	edict_t		*found[MAX_EDICTS];
+	edict_t		**out;
+	int			x, y, x0, y0, x1, y1;
+	int			i, count;
+
+	// an entity is on one list and each cell is looked at once, so
+	// nothing is found twice and MAX_EDICTS always holds them all
+	out = maxcount >= MAX_EDICTS ? list : found;
+	count = 0;
+
+	for (i=0 ; i<grid->numlevels ; i++)
+	{
+		level = &grid->levels[i];
+
+		// anything touching the box has its mins no more than one
+		// cell below the box's
+		x0 = SV_AreaCell (level, mins[0], grid->origin[0], level->width) - 1;
+		y0 = SV_AreaCell (level, mins[1], grid->origin[1], level->height) - 1;
+		x1 = SV_AreaCell (level, maxs[0], grid->origin[0], level->width);
+		y1 = SV_AreaCell (level, maxs[1], grid->origin[1], level->height);
+		if (x0 < 0)
+			x0 = 0;
+		if (y0 < 0)
+			y0 = 0;
+
+		for (y=y0 ; y<=y1 ; y++)
+		{
+			row = level->cells + y*level->width;
+			for (x=x0 ; x<=x1 ; x++)
+			{
+				// touch linked edicts
+				if (areatype == AREA_SOLID)
+					start = &row[x].solid_edicts;
+				else
+					start = &row[x].trigger_edicts;
+
+				for (l=start->next ; l != start ; l = next)
+				{
+					next = l->next;
+					check = EDICT_FROM_AREA(l);
+
+					if (check->solid == SOLID_NOT)
+						continue;		// deactivated
+					if (check->absmin[0] > maxs[0]
+					|| check->absmin[1] > maxs[1]
+					|| check->absmin[2] > maxs[2]
+					|| check->absmax[0] < mins[0]
+					|| check->absmax[1] < mins[1]
+					|| check->absmax[2] < mins[2])
+						continue;		// not touching
+
+					out[count] = check;
+					count++;
+				}
+			}
+		}
+	}
+
+	SV_SortEdicts (out, count);
+
+	if (out != list)
+	{
+		if (count > maxcount)
+		{
+			Com_Printf ("SV_AreaEdicts: MAXCOUNT\n");
+			count = maxcount;
+		}
+		memcpy (list, out, count * sizeof(*list));
+	}
+
+	return count;
+}
+
+/*
+================
+SV_AreaEdicts
+================
+*/
+int SV_AreaEdicts (vec3_t mins, vec3_t maxs, edict_t **list,
+	int maxcount, int areatype)
+{
+	return SV_AreaQuery (&sv_areagrid, mins, maxs, list, maxcount, areatype);
+}
+
+//===========================================================================
+
+/*
+The fixed depth areanode tree the grid replaced, kept for area_bench to
+measure against and check its results with.
+*/
+#define	AREA_DEPTH	4
+#define	AREA_NODES	32
+
+typedef struct areanode_s
+{
+	int		axis;		// -1 = leaf node
+	float	dist;
+	struct areanode_s	*children[2];
+	link_t	trigger_edicts;
+	link_t	solid_edicts;
+} areanode_t;
+
+static areanode_t	bench_areanodes[AREA_NODES];
+static int			bench_numareanodes;
+
+static areanode_t *SV_BenchCreateAreaNode (int depth, vec3_t mins, vec3_t maxs)
+{
+	areanode_t	*anode;
+	vec3_t		size;
+	vec3_t		mins1, maxs1, mins2, maxs2;
+
+	anode = &bench_areanodes[bench_numareanodes];
+	bench_numareanodes++;
+
+	ClearLink (&anode->trigger_edicts);
+	ClearLink (&anode->solid_edicts);
+
+	if (depth == AREA_DEPTH)
+	{
+		anode->axis = -1;
+		anode->children[0] = anode->children[1] = NULL;
+		return anode;
+	}
+
+	VectorSubtract (maxs, mins, size);
+	if (size[0] > size[1])
+		anode->axis = 0;
+	else
+		anode->axis = 1;
+
+	anode->dist = 0.5 * (maxs[anode->axis] + mins[anode->axis]);
+	VectorCopy (mins, mins1);
+	VectorCopy (mins, mins2);
+	VectorCopy (maxs, maxs1);
+	VectorCopy (maxs, maxs2);
+
+	maxs1[anode->axis] = mins2[anode->axis] = anode->dist;
+
+	anode->children[0] = SV_BenchCreateAreaNode (depth+1, mins2, maxs2);
+	anode->children[1] = SV_BenchCreateAreaNode (depth+1, mins1, maxs1);
+
+	return anode;
+}
+
+static void SV_BenchAreaNodeLink (edict_t *ent)
+{
+	areanode_t	*node;
+
+	// find the first node that the ent's box crosses
+	node = bench_areanodes;
 	while (1)
 	{
 		if (node->axis == -1)
@@ -335,92 +639,465 @@ void SV_LinkEdict (edict_t *ent)
 		else
 			break;		// crosses the node
 	}
-	
-	// link it in	
+
 	if (ent->solid == SOLID_TRIGGER)
 		InsertLinkBefore (&ent->area, &node->trigger_edicts);
 	else
 		InsertLinkBefore (&ent->area, &node->solid_edicts);
-
 }
 
-
-/*
-====================
-SV_AreaEdicts_r
-
-====================
-*/
-void SV_AreaEdicts_r (areanode_t *node)
+static int SV_BenchAreaNodeEdicts_r (areanode_t *node, vec3_t mins, vec3_t maxs,
+	edict_t **list, int count, int maxcount, int areatype)
 {
-	link_t		*l, *next, *start;
+	link_t		*l, *start;
 	edict_t		*check;
-	int			count;
 
-	count = 0;
-
-	// touch linked edicts
-	if (area_type == AREA_SOLID)
+	if (areatype == AREA_SOLID)
 		start = &node->solid_edicts;
 	else
 		start = &node->trigger_edicts;
 
-	for (l=start->next  ; l != start ; l = next)
+	for (l=start->next ; l != start ; l = l->next)
 	{
-		next = l->next;
 		check = EDICT_FROM_AREA(l);
 
 		if (check->solid == SOLID_NOT)
-			continue;		// deactivated
-		if (check->absmin[0] > area_maxs[0]
-		|| check->absmin[1] > area_maxs[1]
-		|| check->absmin[2] > area_maxs[2]
-		|| check->absmax[0] < area_mins[0]
-		|| check->absmax[1] < area_mins[1]
-		|| check->absmax[2] < area_mins[2])
-			continue;		// not touching
-
-		if (area_count == area_maxcount)
+			continue;
+		if (check->absmin[0] > maxs[0]
+		|| check->absmin[1] > maxs[1]
+		|| check->absmin[2] > maxs[2]
+		|| check->absmax[0] < mins[0]
+		|| check->absmax[1] < mins[1]
+		|| check->absmax[2] < mins[2])
+			continue;
+
+		if (count == maxcount)
+			return count;
+		list[count++] = check;
+	}
+
+	if (node->axis == -1)
+		return count;
+
+	if (maxs[node->axis] > node->dist)
+		count = SV_BenchAreaNodeEdicts_r (node->children[0], mins, maxs, list, count, maxcount, areatype);
+	if (mins[node->axis] < node->dist)
+		count = SV_BenchAreaNodeEdicts_r (node->children[1], mins, maxs, list, count, maxcount, areatype);
+
+	return count;
+}
+
+typedef struct
+{
+	edict_t		ent;
+	vec3_t		velocity;
+	vec3_t		startorigin, startvelocity;
+	float		gravity;
+} benchent_t;
+
+/*
+================
+SV_AreaBenchRecord
+
+Keeps the count and a hash of the entities a query found, in the order
+it found them.  The tree's lists are put in entity number order first,
+which is the order the grid has to give them in.  Returns the time
+taken, which the pass leaves out.
+================
+*/
+static double SV_AreaBenchRecord (edict_t **list, int count, qboolean sort,
+	int **counts, unsigned **hashes)
+{
+	double		start;
+	unsigned	h;
+	int			i;
+
+	start = Sys_FloatTime ();
+
+	if (sort)
+		SV_SortEdicts (list, count);
+
+	h = 0;
+	for (i=0 ; i<count ; i++)
+	{
+		h = (h ^ list[i]->s.number) * 0x01000193;
+		h ^= h >> 15;
+	}
+
+	*(*counts)++ = count;
+	*(*hashes)++ = h;
+
+	return Sys_FloatTime () - start;
+}
+
+/*
+================
+SV_AreaBenchPass
+
+Flies the entities around the world for frames tenths of a second,
+relinking each one every frame and querying the box it swept for solids
+the way SV_Trace does, and for triggers when it is player sized.  The
+number found by each query goes in counts, and a hash of which ones and
+their order in hashes.
+================
+*/
+static double SV_AreaBenchPass (benchent_t *ents, int numents, int frames,
+	areagrid_t *grid, int *counts, unsigned *hashes, edict_t **list)
+{
+	benchent_t	*b;
+	edict_t		*ent;
+	vec3_t		origin;
+	vec3_t		mins, maxs;
+	vec_t		*worldmins, *worldmaxs;
+	double		start, recordtime;
+	int			i, j, frame, count;
+
+	worldmins = sv.models[1]->mins;
+	worldmaxs = sv.models[1]->maxs;
+
+	if (grid)
+		SV_CreateAreaGrid (grid, worldmins, worldmaxs);
+	else
+	{
+		bench_numareanodes = 0;
+		SV_BenchCreateAreaNode (0, worldmins, worldmaxs);
+	}
+
+	for (i=0, b=ents ; i<numents ; i++, b++)
+	{
+		ent = &b->ent;
+		VectorCopy (b->startorigin, ent->s.origin);
+		VectorCopy (b->startvelocity, b->velocity);
+		VectorAdd (ent->s.origin, ent->mins, ent->absmin);
+		VectorAdd (ent->s.origin, ent->maxs, ent->absmax);
+		for (j=0 ; j<3 ; j++)
 		{
-			Com_Printf ("SV_AreaEdicts: MAXCOUNT\n");
-			return;
+			ent->absmin[j] -= 1;
+			ent->absmax[j] += 1;
 		}
+		if (grid)
+			SV_AreaLink (grid, ent);
+		else
+			SV_BenchAreaNodeLink (ent);
+	}
+
+	recordtime = 0;
+	start = Sys_FloatTime ();
 
-		area_list[area_count] = check;
-		area_count++;
+	for (frame=0 ; frame<frames ; frame++)
+	{
+		for (i=0, b=ents ; i<numents ; i++, b++)
+		{
+			ent = &b->ent;
+			if (ent->solid == SOLID_TRIGGER)
+				continue;
+
+			b->velocity[2] -= b->gravity * 0.1;
+			VectorMA (ent->s.origin, 0.1, b->velocity, origin);
+			for (j=0 ; j<3 ; j++)
+			{	// bounce off the edges of the world
+				if (origin[j] < worldmins[j] || origin[j] > worldmaxs[j])
+				{
+					b->velocity[j] = -b->velocity[j];
+					origin[j] = ent->s.origin[j];
+				}
+			}
+
+			for (j=0 ; j<3 ; j++)
+			{
+				mins[j] = (origin[j] < ent->s.origin[j] ? origin[j] : ent->s.origin[j]) + ent->mins[j] - 1;
+				maxs[j] = (origin[j] > ent->s.origin[j] ? origin[j] : ent->s.origin[j]) + ent->maxs[j] + 1;
+			}
+
+			RemoveLink (&ent->area);
+			VectorCopy (origin, ent->s.origin);
+			VectorAdd (ent->s.origin, ent->mins, ent->absmin);
+			VectorAdd (ent->s.origin, ent->maxs, ent->absmax);
+			for (j=0 ; j<3 ; j++)
+			{
+				ent->absmin[j] -= 1;
+				ent->absmax[j] += 1;
+			}
+
+			if (grid)
+			{
+				SV_AreaLink (grid, ent);
+				count = SV_AreaQuery (grid, mins, maxs, list, MAX_EDICTS, AREA_SOLID);
+				recordtime += SV_AreaBenchRecord (list, count, qFalse, &counts, &hashes);
+				if (ent->mins[0] <= -16)
+				{
+					count = SV_AreaQuery (grid, ent->absmin, ent->absmax, list, MAX_EDICTS, AREA_TRIGGERS);
+					recordtime += SV_AreaBenchRecord (list, count, qFalse, &counts, &hashes);
+				}
+			}
+			else
+			{
+				SV_BenchAreaNodeLink (ent);
+				count = SV_BenchAreaNodeEdicts_r (bench_areanodes, mins, maxs, list, 0, MAX_EDICTS, AREA_SOLID);
+				recordtime += SV_AreaBenchRecord (list, count, qTrue, &counts, &hashes);
+				if (ent->mins[0] <= -16)
+				{
+					count = SV_BenchAreaNodeEdicts_r (bench_areanodes, ent->absmin, ent->absmax, list, 0, MAX_EDICTS, AREA_TRIGGERS);
+					recordtime += SV_AreaBenchRecord (list, count, qTrue, &counts, &hashes);
+				}
+			}
+		}
 	}
-	
-	if (node->axis == -1)
-		return;		// terminal node
 
-	// recurse down both sides
-	if ( area_maxs[node->axis] > node->dist )
-		SV_AreaEdicts_r ( node->children[0] );
-	if ( area_mins[node->axis] < node->dist )
-		SV_AreaEdicts_r ( node->children[1] );
+	return Sys_FloatTime () - start - recordtime;
 }
 
 /*
 ================
-SV_AreaEdicts
+SV_AreaBench_f
+
+area_bench [entities] [frames]
+
+Runs the same flock of players, rockets and gibs through the areanode
+tree and the area grid over the current map's bounds, and checks that
+every query found the same entities in both, in entity number order
 ================
 */
-int SV_AreaEdicts (vec3_t mins, vec3_t maxs, edict_t **list,
-	int maxcount, int areatype)
+void SV_AreaBench_f (void)
 {
-	area_mins = mins;
-	area_maxs = maxs;
-	area_list = list;
-	area_count = 0;
-	area_maxcount = maxcount;
-	area_type = areatype;
+	static vec3_t	sizes[4] = {{16, 16, 32}, {4, 4, 4}, {8, 8, 8}, {32, 32, 32}};
+	vec3_t		fights[8];
+	benchent_t	*ents, *b;
+	areagrid_t	*grid;
+	edict_t		**list;
+	int			*treecounts, *gridcounts;
+	unsigned	*treehashes, *gridhashes;
+	int			numents, frames, numqueries;
+	int			i, j, kind, mismatched, found;
+	double		treetime, gridtime;
+
+	if (sv.state != ss_game)
+	{
+		Com_Printf ("area_bench: no map running\n");
+		return;
+	}
+
+	numents = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : 512;
+	frames = Cmd_Argc() > 2 ? atoi(Cmd_Argv(2)) : 100;
+	if (numents < 1)
+		numents = 1;
+	if (numents > MAX_EDICTS)
+		numents = MAX_EDICTS;
+	if (frames < 1)
+		frames = 1;
+
+	ents = Z_Malloc (numents * sizeof(*ents));
+	grid = Z_Malloc (sizeof(*grid));
+	list = Z_Malloc (MAX_EDICTS * sizeof(*list));
+	treecounts = Z_Malloc (numents * frames * 2 * sizeof(int));
+	gridcounts = Z_Malloc (numents * frames * 2 * sizeof(int));
+	treehashes = Z_Malloc (numents * frames * 2 * sizeof(unsigned));
+	gridhashes = Z_Malloc (numents * frames * 2 * sizeof(unsigned));
+
+	// they start out around a few fights
+	for (i=0 ; i<8 ; i++)
+		for (j=0 ; j<3 ; j++)
+			fights[i][j] = sv.models[1]->mins[j] + frand() * (sv.models[1]->maxs[j] - sv.models[1]->mins[j]);
+
+	// a quarter players, a quarter rockets, the rest gibs, with every
+	// sixteenth one a trigger that sits still
+	for (i=0, b=ents ; i<numents ; i++, b++)
+	{
+		b->ent.inuse = qTrue;
+		b->ent.s.number = i;
+		if ((i & 15) == 15)
+		{
+			b->ent.solid = SOLID_TRIGGER;
+			kind = 3;
+		}
+		else
+		{
+			b->ent.solid = SOLID_BBOX;
+			kind = i & 3;
+			if (kind == 3)
+				kind = 2;
+		}
+		VectorScale (sizes[kind], -1, b->ent.mins);
+		VectorCopy (sizes[kind], b->ent.maxs);
+
+		VectorCopy (fights[i & 7], b->startorigin);
+		for (j=0 ; j<3 ; j++)
+		{
+			b->startorigin[j] += crand() * 512;
+			if (b->startorigin[j] < sv.models[1]->mins[j])
+				b->startorigin[j] = sv.models[1]->mins[j];
+			if (b->startorigin[j] > sv.models[1]->maxs[j])
+				b->startorigin[j] = sv.models[1]->maxs[j];
+		}
+
+		switch (kind)
+		{
+		case 3:		// triggers sit still
+			break;
+		case 0:		// running about
+			b->startvelocity[0] = crand() * 300;
+			b->startvelocity[1] = crand() * 300;
+			b->startvelocity[2] = 0;
+			b->gravity = 0;
+			break;
+		case 1:		// rockets
+			b->startvelocity[0] = crand();
+			b->startvelocity[1] = crand();
+			b->startvelocity[2] = crand() * 0.5;
+			VectorNormalize (b->startvelocity);
+			VectorScale (b->startvelocity, 650, b->startvelocity);
+			b->gravity = 0;
+			break;
+		default:	// gibs
+			b->startvelocity[0] = crand() * 300;
+			b->startvelocity[1] = crand() * 300;
+			b->startvelocity[2] = 200 + frand() * 400;
+			b->gravity = 800;
+			break;
+		}
+	}
 
-	SV_AreaEdicts_r (sv_areanodes);
+	treetime = SV_AreaBenchPass (ents, numents, frames, NULL, treecounts, treehashes, list);
+	gridtime = SV_AreaBenchPass (ents, numents, frames, grid, gridcounts, gridhashes, list);
+
+	numqueries = 0;
+	for (i=0, b=ents ; i<numents ; i++, b++)
+	{
+		if (b->ent.solid != SOLID_TRIGGER)
+			numqueries += b->ent.mins[0] <= -16 ? 2 : 1;
+	}
+	numqueries *= frames;
 
-	return area_count;
+	mismatched = found = 0;
+	for (i=0 ; i<numqueries ; i++)
+	{
+		if (treecounts[i] != gridcounts[i] || treehashes[i] != gridhashes[i])
+			mismatched++;
+		found += gridcounts[i];
+	}
+
+	Com_Printf ("%i entities, %i frames, %i queries finding %.1f each\n",
+		numents, frames, numqueries, (float)found / numqueries);
+	Com_Printf ("areanodes %7.1f ms, grid %7.1f ms (%.2fx)\n",
+		treetime * 1000, gridtime * 1000, treetime / gridtime);
+	if (mismatched)
+		Com_Printf ("area_bench: %i queries differed in entities or order\n", mismatched);
+
+	Z_Free (gridhashes);
+	Z_Free (treehashes);
+	Z_Free (gridcounts);
+	Z_Free (treecounts);
+	Z_Free (list);
+	Z_Free (grid);
+	Z_Free (ents);
 }
 
 
+//===========================================================================
+
+/*
+===============
+SV_EntityTransform
+
+Returns the cached axes for a bmodel, rebuilding them if the entity
+was turned since it was last linked.  Moving it only needs the origin.
+===============
+*/
+cmtransform_t *SV_EntityTransform (edict_t *ent)
+{
+	cmtransform_t	*xf;
+
+	xf = &sv.transforms[NUM_FOR_EDICT(ent)];
+	if (!VectorCompare (xf->angles, ent->s.angles))
+		CM_SetTransform (xf, ent->s.origin, ent->s.angles);
+	else
+		VectorCopy (ent->s.origin, xf->origin);
+
+	return xf;
+}
+
+/*
+===============
+SV_CloseTraceLog
+
+===============
+*/
+void SV_CloseTraceLog (void)
+{
+	if (!sv.tracelog)
+		return;
+
+	fclose (sv.tracelog);
+	sv.tracelog = NULL;
+}
+
+/*
+===============
+SV_LogCollision
+
+Appends one collision call to the log for cm_bench, opening it on the
+first call of a level.  ent is the entity clipped against, or NULL for
+the world.
+===============
+*/
+void SV_LogCollision (int type, vec3_t start, vec3_t end, vec3_t mins, vec3_t maxs,
+	int brushmask, edict_t *ent, vec3_t angles)
+{
+	cmlogheader_t	header;
+	cmlogentry_t	entry;
+	char			name[MAX_OSPATH];
+
+	if (!sv.tracelog)
+	{
+		if (sv.state != ss_game)
+			return;
+
+		Com_sprintf (name, sizeof(name), "%s/tracelogs/%s.cml", FS_Gamedir(), sv.name);
+		FS_CreatePath (name);
+		sv.tracelog = fopen (name, "wb");
+		if (!sv.tracelog)
+		{
+			Com_Printf ("ERROR: couldn't open %s.\n", name);
+			Cvar_Set ("sv_tracelog", "0");
+			return;
+		}
+		Com_Printf ("Recording collision calls to %s.\n", name);
+
+		memset (&header, 0, sizeof(header));
+		header.ident = CMLOG_IDENT;
+		header.version = CMLOG_VERSION;
+		strncpy (header.mapname, sv.configstrings[CS_MODELS+1], sizeof(header.mapname)-1);
+		header.checksum = atoi (sv.configstrings[CS_MAPCHECKSUM]);
+		fwrite (&header, sizeof(header), 1, sv.tracelog);
+	}
+
+	memset (&entry, 0, sizeof(entry));
+	entry.type = type;
+	entry.brushmask = brushmask;
+	VectorCopy (start, entry.start);
+	VectorCopy (end, entry.end);
+	VectorCopy (mins, entry.mins);
+	VectorCopy (maxs, entry.maxs);
+	VectorCopy (angles, entry.angles);
+
+	if (!ent)
+		entry.headnode = sv.models[1]->headnode;
+	else
+	{
+		VectorCopy (ent->s.origin, entry.origin);
+		if (ent->solid == SOLID_BSP)
+			entry.headnode = sv.models[ent->s.modelindex]->headnode;
+		else
+		{	// SV_HullForEntity made a box hull
+			entry.headnode = -1;
+			VectorCopy (ent->mins, entry.boxmins);
+			VectorCopy (ent->maxs, entry.boxmaxs);
+		}
+	}
+
+	fwrite (&entry, sizeof(entry), 1, sv.tracelog);
+}
+
 //===========================================================================
 
 /*
@@ -439,6 +1116,9 @@ int SV_PointContents (vec3_t p)
 	// get base contents from world
 	contents = CM_PointContents (p, sv.models[1]->headnode);
 
+	if (sv_tracelog->value)
+		SV_LogCollision (CMLOG_POINTCONTENTS, p, p, vec3_origin, vec3_origin, 0, NULL, vec3_origin);
+
 	// or in contents from all the other entities
 	num = SV_AreaEdicts (p, p, touch, MAX_EDICTS, AREA_SOLID);
 
@@ -452,7 +1132,12 @@ int SV_PointContents (vec3_t p)
 		if (hit->solid != SOLID_BSP)
 			angles = vec3_origin;	// boxes don't rotate
 
-		c2 = CM_TransformedPointContents (p, headnode, hit->s.origin, hit->s.angles);
+		if (hit->solid == SOLID_BSP)
+			c2 = CM_TransformedPointContentsCached (p, headnode, SV_EntityTransform (hit));
+		else
+			c2 = CM_TransformedPointContents (p, headnode, hit->s.origin, hit->s.angles);
+		if (sv_tracelog->value)
+			SV_LogCollision (CMLOG_TRANSFORMEDPOINT, p, p, vec3_origin, vec3_origin, 0, hit, hit->s.angles);
 
 		contents |= c2;
 	}
@@ -521,6 +1206,7 @@ void SV_ClipMoveToEntities ( moveclip_t *clip )
 	trace_t		trace;
 	int			headnode;
 	float		*angles;
+	float		*mins, *maxs;
 
 	num = SV_AreaEdicts (clip->boxmins, clip->boxmaxs, touchlist
 		, MAX_EDICTS, AREA_SOLID);
@@ -555,13 +1241,27 @@ void SV_ClipMoveToEntities ( moveclip_t *clip )
 			angles = vec3_origin;	// boxes don't rotate
 
 		if (touch->svflags & SVF_MONSTER)
-			trace = CM_TransformedBoxTrace (clip->start, clip->end,
-				clip->mins2, clip->maxs2, headnode, clip->contentmask,
-				touch->s.origin, angles);
+		{
+			mins = clip->mins2;
+			maxs = clip->maxs2;
+		}
+		else
+		{
+			mins = clip->mins;
+			maxs = clip->maxs;
+		}
+
+		if (touch->solid == SOLID_BSP)
+			trace = CM_TransformedBoxTraceCached (clip->start, clip->end,
+				mins, maxs, headnode, clip->contentmask,
+				SV_EntityTransform (touch));
 		else
 			trace = CM_TransformedBoxTrace (clip->start, clip->end,
-				clip->mins, clip->maxs, headnode,  clip->contentmask,
+				mins, maxs, headnode, clip->contentmask,
 				touch->s.origin, angles);
+		if (sv_tracelog->value)
+			SV_LogCollision (CMLOG_TRANSFORMEDTRACE, clip->start, clip->end,
+				mins, maxs, clip->contentmask, touch, angles);
 
 		if (trace.allsolid || trace.startsolid ||
 		trace.fraction < clip->trace.fraction)
@@ -634,6 +1334,8 @@ trace_t SV_Trace (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, edict_t *p
 
 	// clip to world
 	clip.trace = CM_BoxTrace (start, end, mins, maxs, 0, contentmask);
+	if (sv_tracelog->value)
+		SV_LogCollision (CMLOG_BOXTRACE, start, end, mins, maxs, contentmask, NULL, vec3_origin);
 	clip.trace.ent = ge->edicts;
 	if (clip.trace.fraction == 0)
 		return clip.trace;		// blocked by the world
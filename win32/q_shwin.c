@@ -108,6 +108,159 @@ void Hunk_Free (void *base)
 	hunkcount--;
 }
 
+/*
+================
+Sys_MapFile
+================
+*/
+static int MapGranularity (void)
+{
+	static int	granularity;
+	SYSTEM_INFO	info;
+
+	if (!granularity)
+	{
+		GetSystemInfo (&info);
+		granularity = info.dwAllocationGranularity;
+	}
+	return granularity;
+}
+
+void *Sys_MapFile (FILE *f, int offset, int length)
+{
+	HANDLE	mapping;
+	byte	*view;
+	int		base;
+
+	if (length <= 0)
+		return NULL;
+
+	mapping = CreateFileMapping ((HANDLE)_get_osfhandle (_fileno (f)), NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mapping)
+		return NULL;
+
+	// views have to start on the allocation granularity
+	base = offset - offset % MapGranularity ();
+	view = MapViewOfFile (mapping, FILE_MAP_READ, 0, base, offset - base + length);
+	CloseHandle (mapping);		// the view keeps it open
+	if (!view)
+		return NULL;
+
+	return view + offset - base;
+}
+
+void Sys_UnmapFile (void *buffer, int offset, int length)
+{
+	UnmapViewOfFile ((byte *)buffer - offset % MapGranularity ());
+}
+
+/*
+================
+Sys_ReadFileAt
+================
+*/
+int Sys_ReadFileAt (FILE *f, void *buffer, int length, int offset)
+{
+	OVERLAPPED	ov;
+	DWORD		read;
+
+	// an offset in the OVERLAPPED makes ReadFile positional, so no
+	// shared seek pointer is involved
+	memset (&ov, 0, sizeof(ov));
+	ov.Offset = offset;
+	if (!ReadFile ((HANDLE)_get_osfhandle (_fileno (f)), buffer, length, &read, &ov))
+		return GetLastError () == ERROR_HANDLE_EOF ? 0 : -1;
+
+	return read;
+}
+
+/*
+================
+Sys_CreateThread
+================
+*/
+typedef struct
+{
+	void	(*func) (void *data);
+	void	*data;
+} threadstart_t;
+
+static DWORD WINAPI ThreadStart (LPVOID parm)
+{
+	threadstart_t	start;
+
+	start = *(threadstart_t *)parm;
+	free (parm);
+	start.func (start.data);
+
+	return 0;
+}
+
+void *Sys_CreateThread (void (*func) (void *data), void *data)
+{
+	threadstart_t	*start;
+	HANDLE			thread;
+
+	start = malloc (sizeof(*start));
+	if (!start)
+		return NULL;
+	start->func = func;
+	start->data = data;
+
+	thread = CreateThread (NULL, 0, ThreadStart, start, 0, NULL);
+	if (!thread)
+	{
+		free (start);
+		return NULL;
+	}
+
+	return thread;
+}
+
+void Sys_WaitThread (void *thread)
+{
+	WaitForSingleObject ((HANDLE)thread, INFINITE);
+	CloseHandle ((HANDLE)thread);
+}
+
+/*
+================
+Sys_CreateSemaphore
+================
+*/
+void *Sys_CreateSemaphore (void)
+{
+	return CreateSemaphore (NULL, 0, 0x7fffffff, NULL);
+}
+
+void Sys_PostSemaphore (void *sem, int count)
+{
+	ReleaseSemaphore ((HANDLE)sem, count, NULL);
+}
+
+void Sys_WaitSemaphore (void *sem)
+{
+	WaitForSingleObject ((HANDLE)sem, INFINITE);
+}
+
+int Sys_NumProcessors (void)
+{
+	SYSTEM_INFO	info;
+
+	GetSystemInfo (&info);
+	return info.dwNumberOfProcessors;
+}
+
+int Sys_AtomicIncrement (volatile int *value)
+{
+	return InterlockedIncrement ((volatile LONG *)value);
+}
+
+int Sys_AtomicLoad (volatile int *value)
+{
+	return InterlockedCompareExchange ((volatile LONG *)value, 0, 0);
+}
+
 //===============================================================================
 
 
@@ -132,6 +285,28 @@ int Sys_Milliseconds (void)
 	return curtime;
 }
 
+/*
+================
+Sys_FloatTime
+================
+*/
+double Sys_FloatTime (void)
+{
+	static LARGE_INTEGER	base;
+	static double	scale;
+	LARGE_INTEGER	now;
+
+	if (!scale)
+	{
+		QueryPerformanceFrequency (&now);
+		scale = 1.0 / now.QuadPart;
+		QueryPerformanceCounter (&base);
+	}
+	QueryPerformanceCounter (&now);
+
+	return (now.QuadPart - base.QuadPart) * scale;
+}
+
 void Sys_Mkdir (char *path)
 {
 	_mkdir (path);